@@ -2,68 +2,1020 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <pthread.h>
 #include <signal.h>
+#include <getopt.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <glob.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "buffer.h"
+#include "scan.h"
+#include "ac.h"
+#include "dfa.h"
+#include "logindex.h"
+#include "follow.h"
+#include "histogram.h"
+#include "aggregate.h"
+#include "codec.h"
+#include "topology.h"
+#include "scheduler.h"
+#include "output.h"
+#include "reader.h"
+#include "result.h"
+#include "profile.h"
+#include "arena.h"
+#include "daemon.h"
+#include "bloom.h"
+#include "exitcode.h"
 
-// WorkerData structure to hold data for each worker thread
+#define DEFAULT_CHUNK_SIZE (1UL << 20) // Default mmap chunk size (1 MiB)
+#define DEFAULT_BATCH_SIZE 32 // Default number of items moved per buffer lock acquisition
+#define MAX_BATCH_SIZE 1024 // Upper bound for --batch, batches live on the stack
+#define DEFAULT_FOLLOW_INTERVAL 5 // Seconds between rolling match counts in --follow mode
+#define ADAPTIVE_MAX_SIZE 65536 // Largest ring --adaptive grows to unless <buffer_size> is larger
+#define OUTPUT_WINDOW 256 // Least number of chunks whose output may wait for an earlier chunk
+#define FILE_BATCH_MAX 64 // Most small files handed to a worker as one item
+#define READER_DEPTH 8 // Block reads the stream reader keeps in flight
+#define DEFAULT_TOP 10 // Templates and components listed by --aggregate
+#define MAX_SKETCH (1UL << 24) // Upper bound for --sketch, counters are indexed with 32 bits
+#define ARENA_SIZE (1UL << 20) // Bytes of followed lines stored per arena
+#define ARENA_SPARE 16 // Released arenas kept for reuse
+
+// Ids of long options without a short form
+enum {
+    OPT_LEVEL = 256,
+    OPT_SINCE,
+    OPT_UNTIL,
+    OPT_INDEX,
+    OPT_BLOOM,
+    OPT_INTERVAL,
+    OPT_HISTOGRAM,
+    OPT_PIN,
+    OPT_NUMA,
+    OPT_SCHEDULER,
+    OPT_ADAPTIVE,
+    OPT_STATS,
+    OPT_BUFFER,
+    OPT_PRINT,
+    OPT_FORMAT,
+    OPT_AGGREGATE,
+    OPT_TOP,
+    OPT_SKETCH,
+    OPT_DAEMON,
+    OPT_QUERY
+};
+
+// Buffer implementation used when --buffer is not given, `make BUFFER=lockfree` flips it
+#ifndef BUFFER_LOCKFREE_DEFAULT
+#define BUFFER_LOCKFREE_DEFAULT 0
+#endif
+
+// ChunkDesc describes a line-aligned slice of the mmap'ed log file
+typedef struct {
+    size_t offset; // Byte offset of the chunk in the mapped file
+    size_t length; // Length of the chunk, always ends on a line boundary
+    size_t seq; // Position of the chunk in file order
+} ChunkDesc;
+
+// TextChunk holds whole lines, decompressed or read from a stream, owned by
+// the worker that pops it. The lines start at data + start.
+typedef struct {
+    size_t len;
+    size_t start;
+    char data[];
+} TextChunk;
+
+// Kind of the items passed through the buffer
+typedef enum {
+    ITEM_RANGE, // ChunkDesc into the mapped file
+    ITEM_LINE, // LineSlot of a followed file, stored in an arena
+    ITEM_TEXT, // TextChunk of decompressed or streamed lines
+    ITEM_BLOCK, // CodecBlock of the mapped compressed file, decompressed by the worker
+    ITEM_FILES // FileBatch of a multi-file run
+} ItemKind;
+
+// ChunkList collects the descriptors of selected line ranges before they are pushed
+typedef struct {
+    ChunkDesc *descs;
+    size_t n;
+    size_t cap;
+    size_t chunk_size; // Adjacent ranges are merged up to this size
+} ChunkList;
+
+// InputFile is one log of a multi-file run, mapped by the producer and
+// unmapped by the worker that scans its last part
+typedef struct {
+    char *path;
+    const char *map; // NULL if the file is empty or could not be mapped
+    size_t size;
+    CodecFormat codec;
+    atomic_size_t parts_left; // Parts not scanned yet
+    atomic_size_t matches;
+} InputFile;
+
+// InputList collects the files of a multi-file run in command line order
+typedef struct {
+    InputFile *files;
+    size_t n;
+    size_t cap;
+} InputList;
+
+// FilePart is a line-aligned range of an input file
 typedef struct {
+    size_t file; // Position in the input list
+    size_t offset;
+    size_t length;
+} FilePart;
+
+// FileBatch is one part of a large file or several small files whole, so
+// that every item is worth about a chunk of work. Freed by the worker.
+typedef struct {
+    size_t n;
+    FilePart parts[];
+} FileBatch;
+
+// WorkerData structure to hold data for each worker thread, cache line aligned
+// so the counters one worker updates never share a line with another worker's
+typedef struct {
+    Histogram hist; // Matches by level and minute, only filled with --histogram
+    int use_hist;
+    Aggregate agg; // Matches by level, template and component, only filled with --aggregate
+    Profile prof; // Time per phase, only kept in PROFILE=1 builds
+    int use_agg;
+    size_t sketch; // Counters per aggregate table, 0 to count every distinct key
     Buffer *buf;
-    const char *search;
+    Scheduler *sched; // Work-stealing scheduler handing out the items instead of buf, NULL if unused
+    const Scanner *scanner; // Chunk search kernel shared by all workers
+    const AcAutomaton *ac; // Multi-pattern automaton, NULL for a single search term
+    AcCounter ac_counter; // Per-pattern line counts of this worker
+    const Dfa *dfa; // Compiled --regex expression, NULL for a literal search
+    ItemKind kind;
+    const char *map; // Base of the mmap'ed file, NULL in streaming mode
+    size_t map_size;
+    size_t batch_size; // Number of items popped per buffer lock acquisition
+    int cpu; // CPU the worker pins itself to, -1 to let it float
+    size_t node; // Position of the worker's NUMA node in the topology
+    size_t bytes; // Input bytes scanned, decompressed bytes for compressed input
+    double first_item; // Time the first batch arrived, 0 if none did
+    double last_item; // Time the last batch was done
     size_t match_count;
+    atomic_size_t live_count; // Matches so far, read by the --follow reporter
+    Writer *out; // Writer printing the matching lines in file order, NULL to only count
+    const LogFilter *filter; // Filter applied by the worker when printing or scanning several files
+    InputFile *files; // Inputs of a multi-file run
+    size_t before; // Context lines printed before and after each matching line
+    size_t after;
+    AcCounter ac_scratch; // Pattern counts of lines that must not be reported
+    const char **marks; // Matching lines of the chunk being printed and its margins
+    size_t num_marks;
+    size_t marks_cap;
     size_t id;
 } WorkerData;
 
+// SelectedText gathers runs of adjacent lines passing the filter before they are matched
+typedef struct {
+    WorkerData *wd;
+    const char *data;
+    size_t start; // Run of selected lines not matched yet
+    size_t end;
+    size_t count;
+} SelectedText;
+
+// NodeProducer feeds the buffer of one NUMA node with the chunks of its share of the file
+typedef struct {
+    Buffer *buf;
+    const char *map;
+    size_t start; // Line-aligned range of the file
+    size_t end;
+    size_t chunk_size;
+    size_t batch_size;
+    ChunkDesc *chunks; // Descriptors pushed, freed by main
+    Profile prof;
+} NodeProducer;
+
+// LineBatch collects the lines stored in --follow mode until they are pushed
+typedef struct {
+    Buffer *buffer;
+    ArenaPool *pool; // Storage of the lines, released by the workers
+    const LogFilter *filter;
+    void *items[MAX_BATCH_SIZE];
+    size_t n;
+    size_t batch_size;
+} LineBatch;
+
 // Global variables
 static WorkerData *worker_data = NULL;
 static size_t num_workers = 0;
-static pthread_barrier_t finish_barrier;
 static volatile sig_atomic_t terminate_flag = 0;
+static FILE *report; // stdout, or stderr when stdout carries the matching lines
+static ResultWriter *results = NULL; // Writer of the --format json or csv report, NULL for the text report
+static atomic_int input_errors = 0; // Inputs that could not be read in full, the exit status is EXIT_ERROR
+static Profile producer_prof; // Time the producers spent reading and pushing
+static Scheduler *waiting_sched = NULL; // Scheduler main waits on, woken by SIGINT
 
 // Signal handler for SIGINT
 static void sigint_handler(int sig) {
     (void)sig;
     terminate_flag = 1;
+    if (waiting_sched)
+        scheduler_wake(waiting_sched);
+}
+
+// Function to get the current monotonic time in seconds
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to record a matching line in the worker's histogram and aggregate
+static void tally_line(const char *line, size_t len, void *ctx) {
+    WorkerData *wd = ctx;
+    if (wd->use_hist)
+        histogram_add(&wd->hist, line, len);
+    if (wd->use_agg)
+        aggregate_add(&wd->agg, line, len);
+}
+
+// Function to count the matching lines of a line-aligned range, passing each to on_match if set
+static size_t match_range(WorkerData *wd, AcCounter *counter, const char *data, size_t len, match_fn on_match,
+                          void *ctx) {
+    if (wd->dfa)
+        return dfa_count_lines(wd->dfa, data, len, on_match, ctx);
+    if (wd->ac)
+        return ac_count_lines(wd->ac, counter, data, len, on_match, ctx);
+    return scan_count_lines(wd->scanner, data, len, on_match, ctx);
+}
+
+// Function to count the matching lines of a line-aligned chunk
+static size_t match_chunk(WorkerData *wd, const char *data, size_t len) {
+    return match_range(wd, &wd->ac_counter, data, len, wd->use_hist || wd->use_agg ? tally_line : NULL, wd);
+}
+
+// Function to remember a matching line of the chunk being printed or of its margins
+static void mark_line(const char *line, size_t len, void *ctx) {
+    WorkerData *wd = ctx;
+    if (wd->filter && !log_filter_match(wd->filter, line, len))
+        return;
+    if (wd->num_marks == wd->marks_cap) {
+        wd->marks_cap = wd->marks_cap ? wd->marks_cap * 2 : 256;
+        wd->marks = realloc(wd->marks, wd->marks_cap * sizeof(const char *));
+        if (!wd->marks) {
+            perror("realloc");
+            exit(EXIT_ERROR);
+        }
+    }
+    wd->marks[wd->num_marks++] = line;
+}
+
+// Function to remember a matching line of the chunk itself, which also counts
+// for --histogram and --aggregate and, once it passed the filter, for its patterns
+static void mark_counted_line(const char *line, size_t len, void *ctx) {
+    WorkerData *wd = ctx;
+    size_t marked = wd->num_marks;
+    mark_line(line, len, ctx);
+    if (wd->num_marks == marked)
+        return;
+    if (wd->filter && wd->ac)
+        ac_count_lines(wd->ac, &wd->ac_counter, line, len, NULL, NULL);
+    tally_line(line, len, wd);
+}
+
+// Function to get the start of the line n lines before the one starting at pos, not going below lo
+static size_t lines_back(const char *map, size_t pos, size_t n, size_t lo) {
+    while (n-- > 0 && pos > lo) {
+        const char *nl = pos - 1 > lo ? memrchr(map + lo, '\n', pos - 1 - lo) : NULL;
+        pos = nl ? (size_t)(nl - map) + 1 : lo;
+    }
+    return pos;
+}
+
+// Function to get the end of the n-th line starting at pos, not going beyond hi
+static size_t lines_forward(const char *map, size_t pos, size_t n, size_t hi) {
+    while (n-- > 0 && pos < hi) {
+        const char *nl = memchr(map + pos, '\n', hi - pos);
+        pos = nl ? (size_t)(nl - map) + 1 : hi;
+    }
+    return pos;
+}
+
+// Function to add a group of consecutive lines of the mapped file to a batch
+static void add_group(WorkerData *wd, OutBatch *b, size_t from, size_t to) {
+    if (b->n == 0)
+        b->first = from;
+    else if (wd->before || wd->after)
+        out_batch_add(b, "--\n", 3);
+    out_batch_add(b, wd->map + from, to - from);
+    if (wd->map[to - 1] != '\n') // Last line of the file
+        out_batch_add(b, "\n", 1);
+    b->end = to;
+}
+
+// Function to count the matching lines of a chunk and hand them with their
+// context to the writer. Matches in the margins around the chunk are found
+// too, but each chunk only prints its own lines, so context crossing a chunk
+// boundary is printed once, by the chunk that holds it.
+static size_t match_output(WorkerData *wd, const ChunkDesc *chunk) {
+    const char *map = wd->map;
+    size_t start = chunk->offset, end = chunk->offset + chunk->length;
+    size_t lo = lines_back(map, start, wd->after, 0);
+    size_t hi = lines_forward(map, end, wd->before, wd->map_size);
+
+    // Pattern counts are taken per marked line when lines failing the filter must not count
+    wd->num_marks = 0;
+    if (lo < start)
+        match_range(wd, &wd->ac_scratch, map + lo, start - lo, mark_line, wd);
+    size_t marked = wd->num_marks;
+    match_range(wd, wd->filter ? &wd->ac_scratch : &wd->ac_counter, map + start, chunk->length, mark_counted_line,
+                wd);
+    size_t count = wd->num_marks - marked;
+    if (end < hi)
+        match_range(wd, &wd->ac_scratch, map + end, hi - end, mark_line, wd);
+
+    // Merge the context of every matching line into groups within the chunk
+    OutBatch *b = out_batch_new(chunk->seq);
+    size_t group_from = 0, group_to = 0;
+    for (size_t i = 0; i < wd->num_marks; ++i) {
+        size_t line = (size_t)(wd->marks[i] - map);
+        size_t from = lines_back(map, line, wd->before, start);
+        size_t to = lines_forward(map, line, wd->after + 1, end);
+        if (from < start)
+            from = start;
+        if (to > end)
+            to = end;
+        if (from >= to)
+            continue;
+        if (group_to > group_from && from <= group_to) {
+            if (to > group_to)
+                group_to = to;
+            continue;
+        }
+        if (group_to > group_from)
+            add_group(wd, b, group_from, group_to);
+        group_from = from;
+        group_to = to;
+    }
+    if (group_to > group_from)
+        add_group(wd, b, group_from, group_to);
+    PROFILE_BEGIN(submitted);
+    writer_submit(wd->out, b);
+    PROFILE_END(PROF_OUTPUT, submitted);
+    return count;
+}
+
+// Function to match a run of selected lines once the next selected line does not follow it
+static void select_line(size_t offset, size_t length, void *ctx) {
+    SelectedText *sel = ctx;
+    if (offset != sel->end) {
+        if (sel->end > sel->start)
+            sel->count += match_chunk(sel->wd, sel->data + sel->start, sel->end - sel->start);
+        sel->start = offset;
+    }
+    sel->end = offset + length;
+}
+
+// Function to count the matching lines of whole lines, only those passing the filter if there is one
+static size_t match_text(WorkerData *wd, const char *data, size_t len) {
+    if (!wd->filter)
+        return match_chunk(wd, data, len);
+    SelectedText sel = { wd, data, 0, 0, 0 };
+    log_scan_select(wd->filter, data, 0, len, select_line, &sel);
+    if (sel.end > sel.start)
+        sel.count += match_chunk(wd, data + sel.start, sel.end - sel.start);
+    return sel.count;
+}
+
+// Function to decompress a whole input file and count its matching lines
+static size_t match_decoded(WorkerData *wd, const InputFile *file) {
+    Decoder *dec = decoder_open(file->codec, file->map, file->size);
+    if (!dec) { // The format is not supported by this build
+        atomic_fetch_add(&input_errors, 1);
+        return 0;
+    }
+
+    size_t cap = DEFAULT_CHUNK_SIZE, have = 0, count = 0;
+    char *text = malloc(cap);
+    for (;;) {
+        if (have == cap) { // A line longer than the buffer, let it grow
+            cap *= 2;
+            text = realloc(text, cap);
+        }
+        if (!text) {
+            perror("malloc");
+            exit(EXIT_ERROR);
+        }
+        ssize_t n = decoder_read(dec, text + have, cap - have);
+        if (n == -1) {
+            fprintf(stderr, "%s: compressed input is corrupt or truncated\n", file->path);
+            atomic_fetch_add(&input_errors, 1);
+            break;
+        }
+        have += (size_t)n;
+
+        // Match up to the last complete line, the rest waits for more text
+        size_t cut = have;
+        if (n > 0) {
+            const char *nl = memrchr(text, '\n', have);
+            if (!nl)
+                continue;
+            cut = (size_t)(nl - text) + 1;
+        }
+        count += match_text(wd, text, cut);
+        wd->bytes += cut;
+        memmove(text, text + cut, have - cut);
+        have -= cut;
+        if (n == 0)
+            break;
+    }
+    free(text);
+    decoder_close(dec);
+    return count;
+}
+
+// Function to count the matching lines of a part of a multi-file run and
+// unmap its file once every part of it is done
+static size_t match_part(WorkerData *wd, const FilePart *part) {
+    InputFile *file = &wd->files[part->file];
+    size_t count;
+    if (file->codec != CODEC_NONE) {
+        count = match_decoded(wd, file);
+    } else {
+        count = match_text(wd, file->map + part->offset, part->length);
+        wd->bytes += part->length;
+    }
+    atomic_fetch_add_explicit(&file->matches, count, memory_order_relaxed);
+    if (atomic_fetch_sub_explicit(&file->parts_left, 1, memory_order_acq_rel) == 1)
+        munmap((void *)file->map, file->size);
+    return count;
+}
+
+// Function to check whether a line matches
+static int match_line(WorkerData *wd, const char *line, size_t len) {
+    int matched;
+    if (wd->dfa)
+        matched = dfa_count_lines(wd->dfa, line, len, NULL, NULL) > 0;
+    else if (wd->ac)
+        matched = ac_count_lines(wd->ac, &wd->ac_counter, line, len, NULL, NULL) > 0;
+    else
+        matched = scan_count_lines(wd->scanner, line, len, NULL, NULL) > 0;
+    if (matched)
+        tally_line(line, len, wd);
+    return matched;
+}
+
+// Function to copy a line fragment, NULL if it is empty
+static char *copy_fragment(const char *data, size_t len) {
+    if (len == 0)
+        return NULL;
+    char *copy = malloc(len);
+    if (!copy) {
+        perror("malloc");
+        exit(EXIT_ERROR);
+    }
+    memcpy(copy, data, len);
+    return copy;
+}
+
+// Function to decompress a block and count its whole lines. The partial lines
+// at both ends are kept in the block for match_boundaries.
+static size_t match_block(WorkerData *wd, CodecBlock *block) {
+    size_t len;
+    char *data = codec_block_decompress(wd->map, block, &len);
+    if (!data) {
+        fprintf(stderr, "Corrupt compressed block at offset %zu\n", block->offset);
+        exit(EXIT_ERROR);
+    }
+    wd->bytes += len;
+
+    const char *first = memchr(data, '\n', len);
+    if (!first) { // The whole block is the middle of a line
+        block->head = data;
+        block->head_len = len;
+        return 0;
+    }
+
+    const char *last = memrchr(data, '\n', len);
+    block->has_newline = 1;
+    block->head = copy_fragment(data, (size_t)(first - data));
+    block->head_len = (size_t)(first - data);
+    block->tail = copy_fragment(last + 1, (size_t)(data + len - last - 1));
+    block->tail_len = (size_t)(data + len - last - 1);
+    size_t count = match_chunk(wd, first + 1, (size_t)(last - first));
+    free(data);
+    return count;
+}
+
+// Function to append bytes to a growing line
+static void line_append(char **line, size_t *len, size_t *cap, const char *data, size_t n) {
+    if (*len + n > *cap) {
+        *cap = (*len + n) * 2;
+        *line = realloc(*line, *cap);
+        if (!*line) {
+            perror("realloc");
+            exit(EXIT_ERROR);
+        }
+    }
+    if (n > 0)
+        memcpy(*line + *len, data, n);
+    *len += n;
+}
+
+// Function to match the lines cut by block boundaries once every block has
+// been decompressed, and to release the fragments
+static size_t match_boundaries(WorkerData *wd, CodecBlock *blocks, size_t n) {
+    char *line = NULL;
+    size_t len = 0, cap = 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        line_append(&line, &len, &cap, blocks[i].head, blocks[i].head_len);
+        if (blocks[i].has_newline) {
+            line_append(&line, &len, &cap, "\n", 1);
+            count += match_line(wd, line, len);
+            len = 0;
+            line_append(&line, &len, &cap, blocks[i].tail, blocks[i].tail_len);
+        }
+        free(blocks[i].head);
+        free(blocks[i].tail);
+    }
+    if (len > 0) // Last line without a trailing newline
+        count += match_line(wd, line, len);
+    free(line);
+    return count;
 }
 
 // Worker thread routine
 static void *worker(void *arg) {
     WorkerData *wd = (WorkerData *)arg;
     Buffer *buf = wd->buf;
-    const char *search = wd->search;
     size_t local = 0;
 
+    // Pin first so the per-worker state below is first touched on the local node
+    if (wd->cpu >= 0 && topology_pin_self(wd->cpu) == -1)
+        fprintf(stderr, "Thread %zu could not be pinned to CPU %d\n", wd->id, wd->cpu);
+    if (wd->ac)
+        ac_counter_init(&wd->ac_counter, wd->ac);
+    if (wd->ac && wd->out)
+        ac_counter_init(&wd->ac_scratch, wd->ac);
+    if (wd->use_hist)
+        histogram_init(&wd->hist);
+    if (wd->use_agg)
+        aggregate_init(&wd->agg, wd->sketch);
+    PROFILE_ATTACH(&wd->prof);
 
-    while (1) {
-        char *line = buffer_pop(buf);
-        if (line == NULL) { // Sentinel value indicating termination
+    void *items[MAX_BATCH_SIZE];
+    int done = 0;
+
+    while (!done) {
+        size_t n;
+        PROFILE_BEGIN(waited);
+        if (wd->sched) { // Own deque first, then a victim's
+            items[0] = scheduler_next(wd->sched, wd->id);
+            n = items[0] != NULL;
+        } else {
+            n = buffer_pop_batch(buf, items, wd->batch_size);
+        }
+        PROFILE_END(PROF_WAIT, waited);
+        if (n == 0) { // Buffer is terminating and drained, or no chunk is left to steal
             break;
         }
+        if (wd->first_item == 0 && items[0] != NULL)
+            wd->first_item = now();
 
-        if (strstr(line, search) != NULL)
-            local++;
+        PROFILE_BEGIN(scanned);
+        for (size_t i = 0; i < n; ++i) {
+            if (items[i] == NULL) { // Sentinel value indicating termination, always last in a batch
+                done = 1;
+                break;
+            }
 
-        free(line);
+            switch (wd->kind) {
+            case ITEM_RANGE: { // The chunk descriptor is owned by main
+                const ChunkDesc *chunk = items[i];
+                if (wd->out)
+                    local += match_output(wd, chunk);
+                else
+                    local += match_chunk(wd, wd->map + chunk->offset, chunk->length);
+                wd->bytes += chunk->length;
+                break;
+            }
+            case ITEM_LINE: {
+                LineSlot *slot = items[i];
+                if (match_line(wd, slot->line, slot->len))
+                    local++;
+                wd->bytes += slot->len;
+                arena_release(slot);
+                break;
+            }
+            case ITEM_TEXT: {
+                TextChunk *text = items[i];
+                local += match_chunk(wd, text->data + text->start, text->len);
+                wd->bytes += text->len;
+                free(text);
+                break;
+            }
+            case ITEM_BLOCK:
+                local += match_block(wd, items[i]);
+                break;
+            case ITEM_FILES: {
+                FileBatch *fb = items[i];
+                for (size_t k = 0; k < fb->n; ++k)
+                    local += match_part(wd, &fb->parts[k]);
+                free(fb);
+                break;
+            }
+            }
+        }
+        PROFILE_END(PROF_SCAN, scanned);
+        atomic_store_explicit(&wd->live_count, local, memory_order_relaxed);
+        if (wd->first_item != 0)
+            wd->last_item = now();
     }
 
     wd->match_count = local;
 
-    printf("Thread %zu finished search with %zu matches.\n", wd->id, local);
+    if (!results)
+        fprintf(report, "Thread %zu finished search with %zu matches.\n", wd->id, local);
+    return NULL;
+}
 
-    // Wait for all threads to finish
-    int rc = pthread_barrier_wait(&finish_barrier);
-    if (rc == PTHREAD_BARRIER_SERIAL_THREAD) {
-        size_t total = 0;
+// Function to write the matches by level to the structured report
+static void write_levels(const size_t *by_level) {
+    result_begin(results, "levels", 1);
+    for (int l = 0; l < LEVEL_COUNT; ++l) {
+        if (by_level[l] == 0)
+            continue;
+        result_record(results, log_level_name((LogLevel)l));
+        result_string(results, "level", log_level_name((LogLevel)l));
+        result_uint(results, "matches", by_level[l]);
+        result_record_end(results);
+    }
+    result_end(results, 1);
+}
+
+// Function to write the k largest counters of an aggregate table as a list of records
+static void write_top(const CountTable *t, size_t k, const char *section, const char *field) {
+    const AggCounter **top;
+    size_t n = aggregate_top(t, k, &top);
+    result_begin(results, section, 1);
+    for (size_t i = 0; i < n; ++i) {
+        result_record(results, top[i]->key);
+        result_string(results, field, top[i]->key);
+        result_uint(results, "matches", top[i]->count);
+        result_uint(results, "error", top[i]->error);
+        result_record_end(results);
+    }
+    result_end(results, 1);
+    free(top);
+}
+
+// Function to write the per-worker counts, the totals and the pattern,
+// histogram and aggregate counts to the structured report
+static void write_totals(const AcAutomaton *ac, const Histogram *merged, const Aggregate *agg, size_t top,
+                         size_t total, double elapsed) {
+    size_t bytes = 0;
+    char name[32];
+    result_begin(results, "threads", 1);
+    for (size_t i = 0; i < num_workers; ++i) {
+        const WorkerData *wd = &worker_data[i];
+        snprintf(name, sizeof(name), "%zu", wd->id);
+        result_record(results, name);
+        result_uint(results, "id", wd->id);
+        result_uint(results, "matches", wd->match_count);
+        result_uint(results, "bytes", wd->bytes);
+        result_double(results, "seconds", wd->first_item != 0 ? wd->last_item - wd->first_item : 0.0);
+        result_record_end(results);
+        bytes += wd->bytes;
+    }
+    result_end(results, 1);
+
+    result_begin(results, "total", 0);
+    result_uint(results, "matches", total);
+    result_uint(results, "bytes", bytes);
+    result_double(results, "seconds", elapsed);
+    result_double(results, "mb_per_s", elapsed > 0 ? bytes / 1e6 / elapsed : 0.0);
+    result_end(results, 0);
+
+    if (ac) {
+        result_begin(results, "patterns", 1);
+        for (size_t p = 0; p < ac->num_patterns; ++p) {
+            size_t count = 0;
+            for (size_t i = 0; i < num_workers; ++i)
+                count += worker_data[i].ac_counter.counts[p];
+            result_record(results, ac->patterns[p]);
+            result_string(results, "pattern", ac->patterns[p]);
+            result_uint(results, "matches", count);
+            result_record_end(results);
+        }
+        result_end(results, 1);
+    }
+
+    if (merged) {
+        write_levels(merged->by_level);
+
+        MinuteBucket *sorted;
+        size_t n = histogram_minutes(merged, &sorted);
+        result_begin(results, "minutes", 1);
+        for (size_t i = 0; i < n; ++i) {
+            histogram_minute_name(sorted[i].minute, name, sizeof(name));
+            result_record(results, name);
+            result_string(results, "minute", name);
+            result_uint(results, "matches", sorted[i].count);
+            result_record_end(results);
+        }
+        result_end(results, 1);
+        free(sorted);
+    }
+
+    if (agg) {
+        if (!merged) // The histogram already wrote the same level counts
+            write_levels(agg->by_level);
+        write_top(&agg->templates, top, "templates", "template");
+        write_top(&agg->components, top, "components", "component");
+    }
+}
+
+// Function to merge the per-worker results after all workers have been joined,
+// listing the top aggregated keys, returns the total number of matching lines
+static size_t report_totals(const AcAutomaton *ac, int use_hist, int use_agg, size_t top, size_t boundary_matches,
+                            double elapsed) {
+    size_t total = boundary_matches;
+    for (size_t i = 0; i < num_workers; ++i)
+        total += worker_data[i].match_count;
+
+    Histogram merged;
+    if (use_hist) {
+        histogram_init(&merged);
         for (size_t i = 0; i < num_workers; ++i)
-            total += worker_data[i].match_count;
-        printf("Total matches: %zu\n", total);
+            histogram_merge(&merged, &worker_data[i].hist);
     }
-    return NULL;
+    Aggregate agg;
+    if (use_agg) { // Exact, however many counters the worker sketches kept
+        aggregate_init(&agg, 0);
+        for (size_t i = 0; i < num_workers; ++i)
+            aggregate_merge(&agg, &worker_data[i].agg);
+    }
+    if (results) {
+        write_totals(ac, use_hist ? &merged : NULL, use_agg ? &agg : NULL, top, total, elapsed);
+        if (use_hist)
+            histogram_destroy(&merged);
+        if (use_agg)
+            aggregate_destroy(&agg);
+        return total;
+    }
+
+    fprintf(report, "Total matches: %zu\n", total);
+    if (ac) {
+        for (size_t p = 0; p < ac->num_patterns; ++p) {
+            size_t count = 0;
+            for (size_t i = 0; i < num_workers; ++i)
+                count += worker_data[i].ac_counter.counts[p];
+            fprintf(report, "Pattern \"%s\": %zu matches\n", ac->patterns[p], count);
+        }
+    }
+    if (use_hist) {
+        histogram_print(&merged, report);
+        histogram_destroy(&merged);
+    }
+    if (use_agg) {
+        aggregate_print(&agg, top, !use_hist, report);
+        aggregate_destroy(&agg);
+    }
+    return total;
+}
+
+// Function to print the bytes each NUMA node scanned and its throughput,
+// measured from its first worker starting to its last worker finishing
+static void report_nodes(const Topology *topo) {
+    if (results)
+        result_begin(results, "nodes", 1);
+    for (size_t n = 0; n < topo->num_nodes; ++n) {
+        size_t workers = 0, bytes = 0;
+        double first = 0, last = 0;
+        for (size_t i = 0; i < num_workers; ++i) {
+            const WorkerData *wd = &worker_data[i];
+            if (wd->node != n)
+                continue;
+            workers++;
+            bytes += wd->bytes;
+            if (wd->first_item != 0 && (first == 0 || wd->first_item < first))
+                first = wd->first_item;
+            if (wd->last_item > last)
+                last = wd->last_item;
+        }
+        if (workers == 0)
+            continue;
+        double elapsed = last - first;
+        if (!results) {
+            fprintf(report, "Node %d: %zu workers, %.1f MB in %.3f s, %.1f MB/s\n", topo->nodes[n].id, workers,
+                    bytes / 1e6, elapsed, elapsed > 0 ? bytes / 1e6 / elapsed : 0.0);
+            continue;
+        }
+        char name[16];
+        snprintf(name, sizeof(name), "%d", topo->nodes[n].id);
+        result_record(results, name);
+        result_uint(results, "node", (size_t)topo->nodes[n].id);
+        result_uint(results, "workers", workers);
+        result_uint(results, "bytes", bytes);
+        result_double(results, "seconds", elapsed);
+        result_double(results, "mb_per_s", elapsed > 0 ? bytes / 1e6 / elapsed : 0.0);
+        result_record_end(results);
+    }
+    if (results)
+        result_end(results, 1);
+}
+
+// Function to write the counters of every buffer to the structured report
+static void write_buffers(Buffer *buffers, size_t num_buffers, int use_steal, const char *bottleneck) {
+    result_begin(results, "buffers", 1);
+    for (size_t b = 0; b < num_buffers && !use_steal; ++b) {
+        BufferStats st;
+        buffer_stats(&buffers[b], &st);
+        char name[32];
+        snprintf(name, sizeof(name), "%zu", b);
+        result_record(results, name);
+        result_uint(results, "buffer", b);
+        result_string(results, "kind", buffers[b].lf ? "lockfree" : "mutex");
+        result_uint(results, "size", buffers[b].size);
+        result_uint(results, "peak_size", st.peak_size);
+        result_uint(results, "grows", st.grows);
+        result_uint(results, "shrinks", st.shrinks);
+        result_uint(results, "pushes", st.pushes);
+        result_double(results, "average_occupancy", st.samples ? (double)st.occupancy_sum / st.samples : 0.0);
+        result_uint(results, "producer_waits", st.producer_waits);
+        result_uint(results, "consumer_waits", st.consumer_waits);
+        result_record_end(results);
+    }
+    result_end(results, 1);
+    result_begin(results, "scheduling", 0);
+    result_string(results, "scheduler", use_steal ? "steal" : "queue");
+    result_string(results, "bottleneck", bottleneck);
+    result_end(results, 0);
+}
+
+// Function to print the counters of every buffer and which side of it was
+// waiting more, the producer on a full ring or the workers on an empty one
+static void report_buffers(Buffer *buffers, size_t num_buffers, int use_steal) {
+    size_t producer_waits = 0, consumer_waits = 0;
+    for (size_t b = 0; b < num_buffers && !use_steal; ++b) {
+        BufferStats st;
+        buffer_stats(&buffers[b], &st);
+        producer_waits += st.producer_waits;
+        consumer_waits += st.consumer_waits;
+    }
+    const char *bottleneck = use_steal ? "none"
+                             : producer_waits > consumer_waits ? "workers"
+                             : consumer_waits > producer_waits ? "producer"
+                                                               : "none";
+    if (results) {
+        write_buffers(buffers, num_buffers, use_steal, bottleneck);
+        return;
+    }
+
+    if (use_steal) {
+        fprintf(report, "Buffer: not used, the work-stealing scheduler handed out the chunks\n");
+        return;
+    }
+    for (size_t b = 0; b < num_buffers; ++b) {
+        BufferStats st;
+        buffer_stats(&buffers[b], &st);
+        fprintf(report, "Buffer %zu (%s): size %zu, peak %zu, %zu grows, %zu shrinks\n", b,
+                buffers[b].lf ? "lockfree" : "mutex", buffers[b].size, st.peak_size, st.grows, st.shrinks);
+        fprintf(report, "  %zu pushes, average occupancy %.1f (%.1f%% full)\n", st.pushes,
+                st.samples ? (double)st.occupancy_sum / st.samples : 0.0,
+                st.size_sum ? 100.0 * st.occupancy_sum / st.size_sum : 0.0);
+        fprintf(report, "  producer waits %zu, consumer waits %zu\n", st.producer_waits, st.consumer_waits);
+    }
+    if (strcmp(bottleneck, "workers") == 0)
+        fprintf(report, "Bottleneck: workers, the producer waited on a full buffer more often\n");
+    else if (strcmp(bottleneck, "producer") == 0)
+        fprintf(report, "Bottleneck: producer, the workers waited on an empty buffer more often\n");
+    else
+        fprintf(report, "Bottleneck: none, producer and workers waited equally often\n");
+}
+
+// Function to print the time each worker and the producers spent in every
+// phase, summed over the timed batches
+static void report_profile(void) {
+    if (results)
+        result_begin(results, "profile", 1);
+    else
+        fprintf(report, "Profile (seconds, timed batches):\n");
+    for (size_t i = 0; i <= num_workers; ++i) {
+        const Profile *prof = i < num_workers ? &worker_data[i].prof : &producer_prof;
+        char name[32];
+        if (i < num_workers)
+            snprintf(name, sizeof(name), "thread %zu", worker_data[i].id);
+        else
+            snprintf(name, sizeof(name), "producer");
+        uint64_t calls = 0;
+        for (int ph = 0; ph < PROF_PHASES; ++ph)
+            calls += prof->calls[ph];
+        if (calls == 0) // A producer that only dealt chunks to the workers' deques
+            continue;
+        if (results) {
+            result_record(results, name);
+            result_string(results, "thread", name);
+        } else {
+            fprintf(report, "  %-10s", name);
+        }
+        for (int ph = 0; ph < PROF_PHASES; ++ph) {
+            const char *phase = profile_phase_name((ProfPhase)ph);
+            double seconds = profile_seconds(prof->ticks[ph]);
+            if (results) {
+                char field[32];
+                snprintf(field, sizeof(field), "%s_seconds", phase);
+                result_double(results, field, seconds);
+                snprintf(field, sizeof(field), "%s_batches", phase);
+                result_uint(results, field, prof->calls[ph]);
+            } else if (prof->calls[ph] > 0) {
+                fprintf(report, " %s %.6f (%llu)", phase, seconds, (unsigned long long)prof->calls[ph]);
+            }
+        }
+        if (results)
+            result_record_end(results);
+        else
+            fputc('\n', report);
+    }
+    if (results)
+        result_end(results, 1);
 }
 
 // Function to print usage information
 static void usage(const char *prog) {
-    fprintf(stderr, "Usage: %s <buffer_size> <num_workers> <log_file> \"<search_term>\"\n" "Note: Enclose <search_term> in double quotes if it contains spaces.\n", prog);
+    fprintf(stderr, "Usage: %s [options] <buffer_size> <num_workers> <log_file>... \"<search_term>\"\n"
+                    "       %s [options] -p <pattern_file> <buffer_size> <num_workers> <log_file>...\n"
+                    "       %s --daemon SOCKET [-c BYTES] <buffer_size> <num_workers> <log_file>...\n"
+                    "       %s --query SOCKET [-i] [-w] [-r] [--level LIST] [--since TIME] [--until TIME]\n"
+                    "                         <log_file> \"<search_term>\"\n"
+                    "Note: Enclose <search_term> in double quotes if it contains spaces.\n"
+                    "      Use - as <log_file> to read from stdin.\n"
+                    "      Several log files, directories (scanned recursively) or quoted glob patterns are\n"
+                    "      scanned together by one pool of workers, with the matches reported per file.\n"
+                    "      Exit status: 0 if a line matched, 1 if none did, 2 on an error, 130 after SIGINT\n"
+                    "      (--follow ends with SIGINT and exits with 0 or 1).\n"
+                    "Options:\n"
+                    "  -p, --patterns FILE     Count lines matching any of the patterns in FILE, one per line\n"
+                    "  -r, --regex             Treat <search_term> as a regular expression matched per line\n"
+                    "  -i, --ignore-case       Ignore ASCII case in <search_term>, the patterns or the expression\n"
+                    "  -w, --word-regexp       Only count matches that are whole words, not preceded or followed\n"
+                    "                          by a letter, digit or underscore\n"
+                    "      --level LIST        Only lines with one of the comma separated levels (DEBUG,INFO,WARN,\n"
+                    "                          ERROR,FAIL,OTHER,UNPARSED)\n"
+                    "      --since TIME        Only lines at or after TIME (YYYY-MM-DD[ HH:MM[:SS]])\n"
+                    "      --until TIME        Only lines at or before TIME\n"
+                    "      --index             Build or extend the sidecar index <log_file>" INDEX_SUFFIX " now\n"
+                    "      --bloom             Build or extend the trigram filters <log_file>" BLOOM_SUFFIX " now. While\n"
+                    "                          they are current, chunks that cannot hold the search term or any\n"
+                    "                          pattern of three bytes or more are skipped\n"
+                    "      --histogram         Also print the matches by level and by minute\n"
+                    "      --aggregate         Also group the matches by level, message template (digit runs masked\n"
+                    "                          as #) and component, and list the most frequent templates and\n"
+                    "                          components\n"
+                    "      --top K             Templates and components listed by --aggregate (default %d)\n"
+                    "      --sketch COUNTERS   Bound --aggregate memory: each worker keeps at most COUNTERS\n"
+                    "                          templates and components, approximating the counts with the\n"
+                    "                          space-saving algorithm and reporting each count's error bound\n"
+                    "  -f, --follow            Count the lines already in <log_file>, then keep running and count\n"
+                    "                          the lines appended to it, surviving truncation and rotation, until\n"
+                    "                          SIGINT\n"
+                    "      --interval SECONDS  Seconds between rolling match counts with --follow (default %d)\n"
+                    "  -s, --stream            Read the file in blocks instead of mmap'ing it, keeping %d reads in\n"
+                    "                          flight with io_uring, or with readahead where io_uring is unavailable\n"
+                    "  -c, --chunk-size BYTES  Size of the chunks and stream blocks handed to workers (default 1 MiB)\n"
+                    "  -b, --batch N           Items moved per buffer lock acquisition (default %d, max %d)\n"
+                    "      --buffer KIND       Buffer implementation: mutex or lockfree (default %s)\n"
+                    "      --adaptive          Start the mutex buffer at <buffer_size> and let it grow and shrink\n"
+                    "                          at runtime from its wait counters (up to %d items)\n"
+                    "      --print             Print the matching lines in file order, counts go to stderr\n"
+                    "  -A, --after-context N   Print N lines after each matching line, implies --print\n"
+                    "  -B, --before-context N  Print N lines before each matching line, implies --print\n"
+                    "  -C, --context N         Print N lines before and after each matching line, implies --print\n"
+                    "                          Printing needs an uncompressed regular file and uses the queue\n"
+                    "                          scheduler with a single buffer, so output stays in file order\n"
+                    "      --stats             Print buffer waits and occupancy at exit and name the bottleneck\n"
+                    "      --format FORMAT     Report as text (default), json or csv: per-thread counts, totals with\n"
+                    "                          wall time, bytes and throughput, and the buffer counters. CSV has one\n"
+                    "                          section,name,field,value row per value\n"
+                    "      --pin               Pin each worker to its own CPU, filling one NUMA node after another\n"
+                    "      --scheduler KIND    How mapped chunks reach the workers: steal (per-worker deques with\n"
+                    "                          work stealing) or queue (the shared buffer), default steal\n"
+                    "      --numa              Spread workers over the NUMA nodes, give each node its own buffer and\n"
+                    "                          share of the mapped file, and report per-node throughput\n"
+                    "      --daemon SOCKET     Keep the log files mapped and the workers running, and count the\n"
+                    "                          matches of queries sent to the UNIX socket SOCKET until SIGINT or\n"
+                    "                          SIGTERM. Queries arriving together share one scan of each file\n"
+                    "      --query SOCKET      Send the search to the daemon listening on SOCKET, * as <log_file>\n"
+                    "                          searches all of its files\n", prog, prog, prog, prog,
+            DEFAULT_TOP, DEFAULT_FOLLOW_INTERVAL, READER_DEPTH, DEFAULT_BATCH_SIZE, MAX_BATCH_SIZE, BUFFER_LOCKFREE_DEFAULT ? "lockfree" : "mutex",
+            ADAPTIVE_MAX_SIZE);
 }
 
 // Function to allocate memory and handle errors
@@ -71,109 +1023,1476 @@ void *xmalloc(size_t size) {
     void *pointer = malloc(size);
     if (!pointer) {
         perror("malloc");
-        exit(EXIT_FAILURE);
+        exit(EXIT_ERROR);
     }
     return pointer;
 }
 
+// Function to split the line-aligned range [start, end) of the mapped file
+// into line-aligned chunks, every chunk except the last one is at least
+// chunk_size long
+static ChunkDesc *split_chunks(const char *map, size_t start, size_t end, size_t chunk_size, size_t *num_chunks) {
+    ChunkDesc *chunks = xmalloc(sizeof(ChunkDesc) * ((end - start) / chunk_size + 1));
+    size_t n = 0;
+    size_t offset = start;
+
+    while (offset < end) {
+        size_t cut = offset + chunk_size;
+        if (cut >= end) {
+            cut = end;
+        } else { // Extend the chunk up to the end of the line it cuts
+            const char *nl = memchr(map + cut - 1, '\n', end - cut + 1);
+            cut = nl ? (size_t)(nl - map) + 1 : end;
+        }
+        chunks[n].offset = offset;
+        chunks[n].length = cut - offset;
+        chunks[n].seq = n;
+        n++;
+        offset = cut;
+    }
+    *num_chunks = n;
+    return chunks;
+}
+
+// Function to push chunk descriptors in batches
+static void push_chunks(Buffer *buffer, ChunkDesc *chunks, size_t num_chunks, size_t batch_size) {
+    void *batch[MAX_BATCH_SIZE];
+    for (size_t i = 0; i < num_chunks && !terminate_flag; i += batch_size) {
+        size_t n = num_chunks - i < batch_size ? num_chunks - i : batch_size;
+        for (size_t j = 0; j < n; ++j)
+            batch[j] = &chunks[i + j];
+        PROFILE_BEGIN(pushed);
+        buffer_push_batch(buffer, batch, n);
+        PROFILE_END(PROF_PUSH, pushed);
+    }
+}
+
+// Function to split the line-aligned range [start, end) of the mapped file into chunks and push them
+static ChunkDesc *produce_chunks(Buffer *buffer, const char *map, size_t start, size_t end, size_t chunk_size,
+                                 size_t batch_size) {
+    size_t n;
+    ChunkDesc *chunks = split_chunks(map, start, end, chunk_size, &n);
+    push_chunks(buffer, chunks, n, batch_size);
+    return chunks;
+}
+
+// Function to get the share of the file of a node, proportional to its
+// workers and cut at the start of a line
+static void node_range(size_t node, size_t num_nodes, const char *map, size_t file_size, size_t *start,
+                       size_t *end) {
+    size_t cut[2];
+    for (size_t k = 0; k < 2; ++k) {
+        size_t assigned = 0; // Workers on the nodes before this boundary
+        for (size_t i = 0; i < num_workers; ++i)
+            assigned += worker_data[i].node < node + k;
+        cut[k] = k == 0 && node == 0 ? 0 : file_size;
+        if ((k == 0 && node > 0) || (k == 1 && node + 1 < num_nodes)) {
+            cut[k] = (size_t)((double)file_size * assigned / num_workers);
+            if (cut[k] > 0) {
+                const char *nl = memchr(map + cut[k] - 1, '\n', file_size - cut[k] + 1);
+                cut[k] = nl ? (size_t)(nl - map) + 1 : file_size;
+            }
+        }
+    }
+    *start = cut[0];
+    *end = cut[1];
+}
+
+// Node producer thread routine
+static void *node_producer(void *arg) {
+    NodeProducer *np = arg;
+    PROFILE_ATTACH(&np->prof);
+    np->chunks = produce_chunks(np->buf, np->map, np->start, np->end, np->chunk_size, np->batch_size);
+    return NULL;
+}
+
+// Function to give every node a share of the file proportional to its
+// workers, each fed by its own producer thread
+static ChunkDesc **produce_per_node(Buffer *buffers, size_t num_nodes, const char *map, size_t file_size,
+                                    size_t chunk_size, size_t batch_size) {
+    NodeProducer *producers = xmalloc(sizeof(NodeProducer) * num_nodes);
+    pthread_t *threads = xmalloc(sizeof(pthread_t) * num_nodes);
+    ChunkDesc **chunks = xmalloc(sizeof(ChunkDesc *) * num_nodes);
+
+    for (size_t n = 0; n < num_nodes; ++n) {
+        size_t start, end;
+        node_range(n, num_nodes, map, file_size, &start, &end);
+        producers[n] = (NodeProducer){ &buffers[n], map, start, end, chunk_size, batch_size, NULL, { { 0 }, { 0 } } };
+        if (pthread_create(&threads[n], NULL, node_producer, &producers[n])) {
+            perror("pthread_create");
+            exit(EXIT_ERROR);
+        }
+    }
+
+    for (size_t n = 0; n < num_nodes; ++n) {
+        pthread_join(threads[n], NULL);
+        chunks[n] = producers[n].chunks;
+        profile_merge(&producer_prof, &producers[n].prof);
+    }
+    free(producers);
+    free(threads);
+    return chunks;
+}
+
+// Function to deal contiguous runs of chunks to the given workers, pushed in
+// reverse so every owner takes its run front to back
+static void deal_chunks(Scheduler *sched, ChunkDesc *chunks, size_t num_chunks, const size_t *workers,
+                        size_t count) {
+    for (size_t w = 0; w < count; ++w) {
+        size_t lo = num_chunks * w / count, hi = num_chunks * (w + 1) / count;
+        for (size_t c = hi; c > lo; --c)
+            scheduler_push(sched, workers[w], &chunks[c - 1]);
+    }
+}
+
+// Function to set up the work-stealing scheduler: each node's share of the
+// file, or the selected chunks when filtering, is dealt to the node's workers
+// before they start. Returns the chunk arrays, one per node.
+static ChunkDesc **schedule_chunks(Scheduler *sched, size_t num_nodes, const char *map, size_t file_size,
+                                   ChunkList *selected, size_t chunk_size) {
+    ChunkDesc **chunks = xmalloc(sizeof(ChunkDesc *) * num_nodes);
+    size_t *counts = xmalloc(sizeof(size_t) * num_nodes);
+    size_t *members = xmalloc(sizeof(size_t) * num_workers);
+    size_t capacity = 1;
+
+    for (size_t n = 0; n < num_nodes; ++n) {
+        size_t workers = 0;
+        for (size_t i = 0; i < num_workers; ++i)
+            workers += worker_data[i].node == n;
+        if (selected) { // Filtered chunks are spread over every worker regardless of node
+            chunks[n] = n == 0 ? selected->descs : NULL;
+            counts[n] = n == 0 ? selected->n : 0;
+            workers = n == 0 ? num_workers : 1;
+        } else {
+            size_t start, end;
+            node_range(n, num_nodes, map, file_size, &start, &end);
+            chunks[n] = split_chunks(map, start, end, chunk_size, &counts[n]);
+        }
+        size_t share = workers ? (counts[n] + workers - 1) / workers : counts[n];
+        if (share > capacity)
+            capacity = share;
+    }
+
+    scheduler_init(sched, num_workers, capacity);
+    for (size_t n = 0; n < num_nodes; ++n) {
+        size_t count = 0;
+        for (size_t i = 0; i < num_workers; ++i) {
+            scheduler_set_group(sched, i, worker_data[i].node);
+            if (selected || worker_data[i].node == n)
+                members[count++] = i;
+        }
+        if (chunks[n])
+            deal_chunks(sched, chunks[n], counts[n], members, count);
+    }
+    free(counts);
+    free(members);
+    return chunks;
+}
+
+// Function to add a selected line range, merging it into the previous chunk when adjacent
+static void chunk_list_add(size_t offset, size_t length, void *ctx) {
+    ChunkList *list = ctx;
+    if (list->n > 0) {
+        ChunkDesc *last = &list->descs[list->n - 1];
+        if (last->offset + last->length == offset && last->length < list->chunk_size) {
+            last->length += length;
+            return;
+        }
+    }
+    if (list->n == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 1024;
+        list->descs = realloc(list->descs, list->cap * sizeof(ChunkDesc));
+        if (!list->descs) {
+            perror("realloc");
+            exit(EXIT_ERROR);
+        }
+    }
+    list->descs[list->n].offset = offset;
+    list->descs[list->n].length = length;
+    list->descs[list->n].seq = list->n;
+    list->n++;
+}
+
+// Function to select the lines passing the filter, located through the
+// sidecar index, or by parsing every line header if no index can be written
+static void select_chunks(ChunkList *list, const char *map, size_t file_size, const char *file_path,
+                          const LogFilter *filter) {
+    LogIndex idx;
+    if (logindex_update(file_path, map, file_size, 0) == 0 && logindex_open(&idx, file_path) == 0) {
+        logindex_select(&idx, filter, map, file_size, chunk_list_add, list);
+        logindex_close(&idx);
+    } else {
+        fprintf(stderr, "Index unavailable, parsing every line header instead\n");
+        log_scan_select(filter, map, 0, file_size, chunk_list_add, list);
+    }
+}
+
+// Function to drop the chunks the trigram filters rule out, the others keep
+// their order and are numbered again. Returns the number of chunks left.
+static size_t prune_chunks(ChunkDesc *chunks, size_t num_chunks, const BloomIndex *bi, const BloomQuery *q) {
+    size_t n = 0;
+    for (size_t c = 0; c < num_chunks; ++c) {
+        if (!bloom_may_contain(bi, q, chunks[c].offset, chunks[c].length))
+            continue;
+        chunks[n] = chunks[c];
+        chunks[n].seq = n;
+        n++;
+    }
+    return n;
+}
+
+// Function to push the compressed blocks, the workers decompress them
+static void produce_blocks(Buffer *buffer, CodecBlock *blocks, size_t num_blocks, size_t batch_size) {
+    void *batch[MAX_BATCH_SIZE];
+    for (size_t i = 0; i < num_blocks && !terminate_flag; i += batch_size) {
+        size_t n = num_blocks - i < batch_size ? num_blocks - i : batch_size;
+        for (size_t j = 0; j < n; ++j)
+            batch[j] = &blocks[i + j];
+        PROFILE_BEGIN(pushed);
+        buffer_push_batch(buffer, batch, n);
+        PROFILE_END(PROF_PUSH, pushed);
+    }
+}
+
+// Function to allocate a text chunk with room for cap bytes
+static TextChunk *text_chunk_alloc(size_t cap) {
+    TextChunk *text = xmalloc(sizeof(TextChunk) + cap);
+    text->len = 0;
+    text->start = 0;
+    return text;
+}
+
+// Function to append a selected line range to a text chunk
+static void text_chunk_add(size_t offset, size_t length, void *ctx) {
+    TextChunk **parts = ctx; // { destination, source }
+    memcpy(parts[0]->data + parts[0]->len, parts[1]->data + parts[1]->start + offset, length);
+    parts[0]->len += length;
+}
+
+// Function to copy bytes into a new text chunk
+static TextChunk *text_chunk_copy(const char *data, size_t len) {
+    TextChunk *text = text_chunk_alloc(len);
+    memcpy(text->data, data, len);
+    text->len = len;
+    return text;
+}
+
+// Function to push a batch of line copies, freeing the ones dropped on termination
+static void flush_lines(Buffer *buffer, void **batch, size_t n) {
+    PROFILE_BEGIN(started);
+    size_t pushed = buffer_push_batch(buffer, batch, n);
+    PROFILE_END(PROF_PUSH, started);
+    for (size_t i = pushed; i < n; ++i)
+        free(batch[i]);
+}
+
+// Function to queue a text chunk, keeping only the lines passing the filter
+// and dropping it if none is left
+static void queue_text(Buffer *buffer, void **batch, size_t *batched, size_t batch_size, TextChunk *text,
+                       const LogFilter *filter) {
+    if (filter) {
+        TextChunk *selected = text_chunk_alloc(text->len);
+        TextChunk *parts[2] = { selected, text };
+        log_scan_select(filter, text->data + text->start, 0, text->len, text_chunk_add, parts);
+        free(text);
+        text = selected;
+    }
+    if (text->len == 0) {
+        free(text);
+        return;
+    }
+    batch[(*batched)++] = text;
+    if (*batched == batch_size) {
+        flush_lines(buffer, batch, *batched);
+        *batched = 0;
+    }
+}
+
+// Function to decompress a stream that cannot be split into blocks and push
+// it as line-aligned text chunks, keeping only the lines passing the filter
+static void produce_decoded(Buffer *buffer, Decoder *dec, const LogFilter *filter, size_t chunk_size,
+                            size_t batch_size) {
+    void *batch[MAX_BATCH_SIZE];
+    size_t batched = 0;
+    size_t cap = chunk_size;
+    TextChunk *cur = text_chunk_alloc(cap);
+    size_t have = 0;
+    int eof = 0;
+
+    while (!terminate_flag && !eof) {
+        if (have == cap) { // A line longer than the chunk, let the chunk grow
+            cap *= 2;
+            cur = realloc(cur, sizeof(TextChunk) + cap);
+            if (!cur) {
+                perror("realloc");
+                exit(EXIT_ERROR);
+            }
+        }
+        PROFILE_BEGIN(decoded);
+        ssize_t n = decoder_read(dec, cur->data + have, cap - have);
+        PROFILE_END(PROF_READ, decoded);
+        if (n == -1) {
+            fprintf(stderr, "Compressed input is corrupt or truncated\n");
+            atomic_fetch_add(&input_errors, 1);
+            break;
+        }
+        have += (size_t)n;
+        eof = n == 0;
+
+        // Cut after the last complete line, the rest moves to the next chunk
+        size_t cut = have;
+        if (!eof) {
+            const char *nl = memrchr(cur->data, '\n', have);
+            if (!nl)
+                continue;
+            cut = (size_t)(nl - cur->data) + 1;
+        }
+        if (cut == 0)
+            break;
+
+        TextChunk *next = text_chunk_alloc(cap);
+        memcpy(next->data, cur->data + cut, have - cut);
+        have -= cut;
+        cur->len = cut;
+
+        queue_text(buffer, batch, &batched, batch_size, cur, filter);
+        cur = next;
+    }
+
+    flush_lines(buffer, batch, batched);
+    free(cur);
+}
+
+// Function to get the next block of a stream, timed as producer reading
+static ssize_t read_block(Reader *reader, char **buf) {
+    PROFILE_BEGIN(started);
+    ssize_t n = reader_next(reader, buf);
+    PROFILE_END(PROF_READ, started);
+    return n;
+}
+
+// Function to read a plain stream block by block and push every block as a
+// text chunk without copying it. The line cut by a block boundary is copied
+// and pushed as a chunk of its own.
+static void produce_stream(Buffer *buffer, Reader *reader, const LogFilter *filter, size_t batch_size) {
+    void *batch[MAX_BATCH_SIZE];
+    size_t batched = 0;
+    char *carry = NULL; // Start of the line the next block continues
+    size_t carry_len = 0, carry_cap = 0;
+    char *buf;
+    ssize_t n;
+
+    while (!terminate_flag && (n = read_block(reader, &buf)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            atomic_fetch_add(&input_errors, 1);
+            break;
+        }
+        TextChunk *text = (TextChunk *)buf;
+        text->start = 0;
+        const char *first = memchr(text->data, '\n', (size_t)n);
+        if (!first) { // The whole block belongs to a line longer than a block
+            line_append(&carry, &carry_len, &carry_cap, text->data, (size_t)n);
+            free(text);
+            continue;
+        }
+        if (carry_len > 0) {
+            text->start = (size_t)(first - text->data) + 1;
+            line_append(&carry, &carry_len, &carry_cap, text->data, text->start);
+            queue_text(buffer, batch, &batched, batch_size, text_chunk_copy(carry, carry_len), filter);
+            carry_len = 0;
+        }
+
+        const char *last = memrchr(text->data, '\n', (size_t)n);
+        size_t end = (size_t)(last - text->data) + 1;
+        line_append(&carry, &carry_len, &carry_cap, text->data + end, (size_t)n - end);
+        text->len = end - text->start;
+        queue_text(buffer, batch, &batched, batch_size, text, filter);
+    }
+    if (carry_len > 0 && !terminate_flag) // Last line without a trailing newline
+        queue_text(buffer, batch, &batched, batch_size, text_chunk_copy(carry, carry_len), filter);
+
+    flush_lines(buffer, batch, batched);
+    free(carry);
+}
+
+// Function to check whether a path is a sidecar index rather than a log
+static int is_index_path(const char *path) {
+    size_t len = strlen(path), suffix = strlen(INDEX_SUFFIX);
+    return len >= suffix && strcmp(path + len - suffix, INDEX_SUFFIX) == 0;
+}
+
+// Function to append a file to the input list
+static void input_add(InputList *list, const char *path) {
+    if (list->n == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 64;
+        list->files = realloc(list->files, list->cap * sizeof(InputFile));
+        if (!list->files) {
+            perror("realloc");
+            exit(EXIT_ERROR);
+        }
+    }
+    InputFile *file = &list->files[list->n++];
+    file->path = strdup(path);
+    if (!file->path) {
+        perror("strdup");
+        exit(EXIT_ERROR);
+    }
+    file->map = NULL;
+    file->size = 0;
+    file->codec = CODEC_NONE;
+    atomic_init(&file->parts_left, 0);
+    atomic_init(&file->matches, 0);
+}
+
+static void collect_input(InputList *list, const char *arg);
+
+// Function to add the regular files below a directory in name order,
+// skipping hidden entries, sidecar indexes and symlinked directories
+static void collect_dir(InputList *list, const char *dir) {
+    struct dirent **names;
+    int n = scandir(dir, &names, NULL, alphasort);
+    if (n == -1) {
+        perror(dir);
+        return;
+    }
+    for (int i = 0; i < n; ++i) {
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]->d_name);
+        if (names[i]->d_name[0] != '.' && !is_index_path(path) && lstat(path, &st) == 0 &&
+            (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && stat(path, &st) == 0 &&
+                                                            S_ISREG(st.st_mode))))
+            collect_input(list, path);
+        free(names[i]);
+    }
+    free(names);
+}
+
+// Function to add a log file, the files below a directory or the matches of a glob pattern
+static void collect_input(InputList *list, const char *arg) {
+    struct stat st;
+    if (stat(arg, &st) == 0) {
+        if (S_ISDIR(st.st_mode))
+            collect_dir(list, arg);
+        else if (S_ISREG(st.st_mode))
+            input_add(list, arg);
+        else
+            fprintf(stderr, "%s: not a regular file, skipping\n", arg);
+        if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode))
+            atomic_fetch_add(&input_errors, 1);
+        return;
+    }
+
+    glob_t g;
+    if (strpbrk(arg, "*?[") && glob(arg, 0, NULL, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; ++i)
+            if (!is_index_path(g.gl_pathv[i]))
+                collect_input(list, g.gl_pathv[i]);
+        globfree(&g);
+        return;
+    }
+    fprintf(stderr, "%s: no such file, directory or matching files\n", arg);
+    atomic_fetch_add(&input_errors, 1);
+}
+
+// Function to map an input file, the mapping outlives the descriptor
+static void map_input(InputFile *file) {
+    int fd = open(file->path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(file->path);
+        atomic_fetch_add(&input_errors, 1);
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    file->size = (size_t)st.st_size;
+    if (file->size > 0) {
+        void *map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror(file->path);
+            atomic_fetch_add(&input_errors, 1);
+        } else {
+            madvise(map, file->size, MADV_SEQUENTIAL);
+            file->map = map;
+            file->codec = codec_detect(file->map, file->size);
+        }
+    }
+    close(fd);
+}
+
+// Function to read up to size bytes, fewer only at the end of the input
+static size_t read_full(int fd, char *buf, size_t size) {
+    size_t len = 0;
+    while (len < size) {
+        ssize_t n = read(fd, buf + len, size - len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1) {
+            perror("read");
+            exit(EXIT_ERROR);
+        }
+        if (n == 0)
+            break;
+        len += (size_t)n;
+    }
+    return len;
+}
+
+// Function to read compressed unseekable input into anonymous memory that
+// stands in for the mapping of a file, starting with the magic bytes
+// already read. The memory is released with munmap like a mapped file.
+static const char *slurp_input(int fd, const char *magic, size_t nmagic, size_t *size) {
+    size_t cap = DEFAULT_CHUNK_SIZE, len = nmagic;
+    char *data = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_ERROR);
+    }
+    memcpy(data, magic, nmagic);
+    for (;;) {
+        if (len == cap) {
+            data = mremap(data, cap, cap * 2, MREMAP_MAYMOVE);
+            if (data == MAP_FAILED) {
+                perror("mremap");
+                exit(EXIT_ERROR);
+            }
+            cap *= 2;
+        }
+        size_t n = read_full(fd, data + len, cap - len);
+        len += n;
+        if (len < cap)
+            break;
+    }
+    if ((data = mremap(data, cap, len, 0)) == MAP_FAILED) { // Give back the pages past the end
+        perror("mremap");
+        exit(EXIT_ERROR);
+    }
+    *size = len;
+    return data;
+}
+
+// Function to queue an item, pushing the queued ones once batch_size are queued
+static void queue_item(Buffer *buffer, void **batch, size_t *batched, size_t batch_size, void *item) {
+    batch[(*batched)++] = item;
+    if (*batched == batch_size) {
+        flush_lines(buffer, batch, *batched);
+        *batched = 0;
+    }
+}
+
+// Function to allocate a file batch with room for cap parts
+static FileBatch *file_batch_alloc(size_t cap) {
+    FileBatch *fb = xmalloc(sizeof(FileBatch) + cap * sizeof(FilePart));
+    fb->n = 0;
+    return fb;
+}
+
+// Function to map the input files one after another and push them: files
+// larger than a chunk are split into line-aligned parts for several workers,
+// smaller ones are grouped until a group is worth a chunk. Compressed files
+// are decompressed whole by a single worker.
+static void produce_files(Buffer *buffer, InputFile *files, size_t num_files, size_t chunk_size, size_t batch_size) {
+    void *batch[MAX_BATCH_SIZE];
+    size_t batched = 0;
+    FileBatch *group = NULL;
+    size_t group_bytes = 0;
+
+    for (size_t f = 0; f < num_files && !terminate_flag; ++f) {
+        InputFile *file = &files[f];
+        PROFILE_BEGIN(mapped);
+        map_input(file);
+        PROFILE_END(PROF_READ, mapped);
+        if (!file->map)
+            continue;
+
+        if (file->codec == CODEC_NONE && file->size > chunk_size) {
+            size_t n;
+            ChunkDesc *chunks = split_chunks(file->map, 0, file->size, chunk_size, &n);
+            atomic_store_explicit(&file->parts_left, n, memory_order_relaxed);
+            for (size_t c = 0; c < n; ++c) {
+                FileBatch *fb = file_batch_alloc(1);
+                fb->parts[fb->n++] = (FilePart){ f, chunks[c].offset, chunks[c].length };
+                queue_item(buffer, batch, &batched, batch_size, fb);
+            }
+            free(chunks);
+            continue;
+        }
+
+        atomic_store_explicit(&file->parts_left, 1, memory_order_relaxed);
+        if (!group) {
+            group = file_batch_alloc(FILE_BATCH_MAX);
+            group_bytes = 0;
+        }
+        group->parts[group->n++] = (FilePart){ f, 0, file->size };
+        group_bytes += file->size;
+        if (group->n == FILE_BATCH_MAX || group_bytes >= chunk_size) {
+            queue_item(buffer, batch, &batched, batch_size, group);
+            group = NULL;
+        }
+    }
+    if (group)
+        queue_item(buffer, batch, &batched, batch_size, group);
+    flush_lines(buffer, batch, batched);
+}
+
+// Function to print the matches of every input file of a multi-file run
+static void report_files(const InputList *inputs) {
+    if (!results) {
+        for (size_t f = 0; f < inputs->n; ++f)
+            fprintf(report, "File %s: %zu matches\n", inputs->files[f].path,
+                    atomic_load_explicit(&inputs->files[f].matches, memory_order_relaxed));
+        return;
+    }
+    result_begin(results, "files", 1);
+    for (size_t f = 0; f < inputs->n; ++f) {
+        result_record(results, inputs->files[f].path);
+        result_string(results, "path", inputs->files[f].path);
+        result_uint(results, "bytes", inputs->files[f].size);
+        result_uint(results, "matches", atomic_load_explicit(&inputs->files[f].matches, memory_order_relaxed));
+        result_record_end(results);
+    }
+    result_end(results, 1);
+}
+
+// Function to push a batch of arena lines, releasing the ones dropped on termination
+static void flush_slots(Buffer *buffer, void **batch, size_t n) {
+    PROFILE_BEGIN(started);
+    size_t pushed = buffer_push_batch(buffer, batch, n);
+    PROFILE_END(PROF_PUSH, started);
+    for (size_t i = pushed; i < n; ++i)
+        arena_release(batch[i]);
+}
+
+// Function to store a line read by the follower in the current arena and queue it, pushing full batches
+static void batch_line(const char *line, size_t len, void *ctx) {
+    LineBatch *lb = ctx;
+    if (lb->filter && !log_filter_match(lb->filter, line, len))
+        return;
+
+    lb->items[lb->n++] = arena_add_line(lb->pool, line, len);
+    if (lb->n == lb->batch_size) {
+        flush_slots(lb->buffer, lb->items, lb->n);
+        lb->n = 0;
+    }
+}
+
+// Function to sum the matches the workers have counted so far
+static size_t live_matches(void) {
+    size_t total = 0;
+    for (size_t i = 0; i < num_workers; ++i)
+        total += atomic_load_explicit(&worker_data[i].live_count, memory_order_relaxed);
+    return total;
+}
+
+// Function to push the existing lines and then every appended line until SIGINT,
+// printing the matches counted in each interval
+static void produce_follow(Buffer *buffer, ArenaPool *pool, Follower *follower, const LogFilter *filter,
+                           size_t batch_size, unsigned interval) {
+    LineBatch lb = { .buffer = buffer, .pool = pool, .filter = filter, .n = 0, .batch_size = batch_size };
+    size_t last_total = 0;
+    struct timespec now, next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    next.tv_sec += interval;
+
+    while (!terminate_flag) {
+        PROFILE_BEGIN(polled); // Includes pushing the batches that fill up meanwhile
+        follower_read(follower, batch_line, &lb);
+        PROFILE_END(PROF_READ, polled);
+        flush_slots(buffer, lb.items, lb.n); // Do not hold lines back while the file is idle
+        lb.n = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec >= next.tv_nsec)) {
+            size_t total = live_matches();
+            printf("Follow: %zu new matches in the last %us, %zu total\n", total - last_total, interval, total);
+            fflush(stdout);
+            last_total = total;
+            while (next.tv_sec <= now.tv_sec)
+                next.tv_sec += interval;
+        }
+
+        long timeout_ms = (next.tv_sec - now.tv_sec) * 1000 + (next.tv_nsec - now.tv_nsec) / 1000000;
+        follower_wait(follower, timeout_ms > 0 ? (int)timeout_ms : 0);
+    }
+}
+
 // Main function
 int main(int argc, char *argv[]) {
-    if (argc != 5) {
+    int force_stream = 0;
+    size_t chunk_size = DEFAULT_CHUNK_SIZE;
+    size_t batch_size = DEFAULT_BATCH_SIZE;
+    int lockfree = BUFFER_LOCKFREE_DEFAULT;
+    const char *pattern_file = NULL;
+    int use_regex = 0;
+    int scan_flags = 0;
+    int build_index = 0;
+    int build_bloom = 0;
+    int follow = 0;
+    int use_hist = 0;
+    int use_agg = 0;
+    size_t top = DEFAULT_TOP;
+    size_t sketch = 0;
+    int pin = 0;
+    int numa = 0;
+    int steal = 1;
+    int adaptive = 0;
+    int show_stats = 0;
+    int print = 0;
+    const char *daemon_socket = NULL;
+    const char *query_socket = NULL;
+    ResultFormat format = FORMAT_TEXT;
+    ResultWriter result_writer;
+    size_t before = 0, after = 0;
+    report = stdout;
+    unsigned interval = DEFAULT_FOLLOW_INTERVAL;
+    LogFilter filter;
+    log_filter_init(&filter);
+
+    static const struct option long_options[] = {
+        { "patterns", required_argument, NULL, 'p' },
+        { "regex", no_argument, NULL, 'r' },
+        { "ignore-case", no_argument, NULL, 'i' },
+        { "word-regexp", no_argument, NULL, 'w' },
+        { "level", required_argument, NULL, OPT_LEVEL },
+        { "since", required_argument, NULL, OPT_SINCE },
+        { "until", required_argument, NULL, OPT_UNTIL },
+        { "index", no_argument, NULL, OPT_INDEX },
+        { "bloom", no_argument, NULL, OPT_BLOOM },
+        { "histogram", no_argument, NULL, OPT_HISTOGRAM },
+        { "aggregate", no_argument, NULL, OPT_AGGREGATE },
+        { "top", required_argument, NULL, OPT_TOP },
+        { "sketch", required_argument, NULL, OPT_SKETCH },
+        { "follow", no_argument, NULL, 'f' },
+        { "interval", required_argument, NULL, OPT_INTERVAL },
+        { "stream", no_argument, NULL, 's' },
+        { "chunk-size", required_argument, NULL, 'c' },
+        { "batch", required_argument, NULL, 'b' },
+        { "buffer", required_argument, NULL, OPT_BUFFER },
+        { "pin", no_argument, NULL, OPT_PIN },
+        { "numa", no_argument, NULL, OPT_NUMA },
+        { "scheduler", required_argument, NULL, OPT_SCHEDULER },
+        { "adaptive", no_argument, NULL, OPT_ADAPTIVE },
+        { "stats", no_argument, NULL, OPT_STATS },
+        { "print", no_argument, NULL, OPT_PRINT },
+        { "format", required_argument, NULL, OPT_FORMAT },
+        { "daemon", required_argument, NULL, OPT_DAEMON },
+        { "query", required_argument, NULL, OPT_QUERY },
+        { "after-context", required_argument, NULL, 'A' },
+        { "before-context", required_argument, NULL, 'B' },
+        { "context", required_argument, NULL, 'C' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    // Options must precede the positional arguments so search terms may start with '-'
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+p:riwfsc:b:A:B:C:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            pattern_file = optarg;
+            break;
+        case 'r':
+            use_regex = 1;
+            break;
+        case 'i':
+            scan_flags |= SCAN_ICASE;
+            break;
+        case 'w':
+            scan_flags |= SCAN_WORD;
+            break;
+        case OPT_LEVEL:
+            if (log_parse_levels(optarg, &filter.level_mask) == -1) {
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        case OPT_SINCE:
+        case OPT_UNTIL:
+            if (log_parse_time(optarg, opt == OPT_UNTIL, opt == OPT_SINCE ? &filter.since : &filter.until) == -1) {
+                fprintf(stderr, "Invalid time: %s\n", optarg);
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        case OPT_INDEX:
+            build_index = 1;
+            break;
+        case OPT_BLOOM:
+            build_bloom = 1;
+            break;
+        case OPT_HISTOGRAM:
+            use_hist = 1;
+            break;
+        case OPT_AGGREGATE:
+            use_agg = 1;
+            break;
+        case OPT_TOP:
+            top = strtoul(optarg, NULL, 10);
+            if (top == 0) {
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        case OPT_SKETCH:
+            sketch = strtoul(optarg, NULL, 10);
+            if (sketch == 0 || sketch > MAX_SKETCH) {
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        case OPT_PIN:
+            pin = 1;
+            break;
+        case OPT_NUMA:
+            numa = 1;
+            break;
+        case OPT_SCHEDULER:
+            if (strcmp(optarg, "steal") == 0) {
+                steal = 1;
+            } else if (strcmp(optarg, "queue") == 0) {
+                steal = 0;
+            } else {
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        case OPT_ADAPTIVE:
+            adaptive = 1;
+            break;
+        case OPT_STATS:
+            show_stats = 1;
+            break;
+        case OPT_PRINT:
+            print = 1;
+            break;
+        case OPT_FORMAT:
+            if (result_parse_format(optarg, &format) == -1) {
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        case OPT_DAEMON:
+            daemon_socket = optarg;
+            break;
+        case OPT_QUERY:
+            query_socket = optarg;
+            break;
+        case 'A':
+        case 'B':
+        case 'C':
+            if (opt != 'B')
+                after = strtoul(optarg, NULL, 10);
+            if (opt != 'A')
+                before = strtoul(optarg, NULL, 10);
+            print = 1;
+            break;
+        case 'f':
+            follow = 1;
+            break;
+        case OPT_INTERVAL:
+            interval = (unsigned)strtoul(optarg, NULL, 10);
+            if (interval == 0) {
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        case 's':
+            force_stream = 1;
+            break;
+        case 'c':
+            chunk_size = strtoul(optarg, NULL, 10);
+            if (chunk_size == 0) {
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        case 'b':
+            batch_size = strtoul(optarg, NULL, 10);
+            if (batch_size == 0 || batch_size > MAX_BATCH_SIZE) {
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        case OPT_BUFFER:
+            if (strcmp(optarg, "mutex") == 0) {
+                lockfree = 0;
+            } else if (strcmp(optarg, "lockfree") == 0) {
+                lockfree = 1;
+            } else {
+                usage(argv[0]);
+                return EXIT_ERROR;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_ERROR;
+        }
+    }
+
+    // A query only names the file and the search term, the daemon does the rest
+    if (query_socket) {
+        if (argc - optind != 2 || pattern_file || daemon_socket) {
+            usage(argv[0]);
+            return EXIT_ERROR;
+        }
+        return daemon_query(query_socket, scan_flags, use_regex, &filter, argv[optind], argv[optind + 1]);
+    }
+
+    // A pattern file replaces the <search_term> argument, a daemon gets its searches from the socket
+    int num_paths = argc - optind - (pattern_file || daemon_socket ? 2 : 3);
+    if (num_paths < 1 || (pattern_file && use_regex)) {
         usage(argv[0]);
-        return EXIT_FAILURE;
+        return EXIT_ERROR;
     }
 
     // Parse command line arguments
-    size_t buffer_size = strtoul(argv[1], NULL, 10);
-    num_workers = strtoul(argv[2], NULL, 10);
-    const char *file_path = argv[3];
-    const char *search_term = argv[4];
+    size_t buffer_size = strtoul(argv[optind], NULL, 10);
+    num_workers = strtoul(argv[optind + 1], NULL, 10);
+    const char *file_path = argv[optind + 2];
+    const char *search_term = pattern_file || daemon_socket ? "" : argv[argc - 1];
 
-    if (buffer_size == 0 || num_workers == 0) {
+    if (buffer_size == 0 || num_workers == 0 || (follow && strcmp(file_path, "-") == 0)) {
         usage(argv[0]);
-        return EXIT_FAILURE;
+        return EXIT_ERROR;
+    }
+
+    // Several paths, a directory or a glob pattern make a multi-file run
+    struct stat path_st;
+    int multi = num_paths > 1;
+    if (strcmp(file_path, "-") != 0 && stat(file_path, &path_st) == 0)
+        multi |= S_ISDIR(path_st.st_mode);
+    else if (strcmp(file_path, "-") != 0)
+        multi |= strpbrk(file_path, "*?[") != NULL;
+    if (multi && (follow || force_stream || print || build_index || build_bloom)) {
+        fprintf(stderr, "--follow, --stream, --print, --index and --bloom take a single log file\n");
+        return EXIT_ERROR;
+    }
+    if (daemon_socket && (follow || force_stream || print || build_index || build_bloom || pattern_file || use_regex || scan_flags ||
+                          use_hist || use_agg || format != FORMAT_TEXT || log_filter_active(&filter))) {
+        fprintf(stderr, "--daemon takes the search options with each query\n");
+        return EXIT_ERROR;
+    }
+    if (adaptive && lockfree) {
+        fprintf(stderr, "--adaptive needs --buffer mutex\n");
+        return EXIT_ERROR;
+    }
+    if (follow && format != FORMAT_TEXT) {
+        fprintf(stderr, "--follow prints rolling counts and only supports --format text\n");
+        return EXIT_ERROR;
+    }
+    if (sketch && sketch < top) {
+        fprintf(stderr, "--sketch must keep at least the --top %zu counters\n", top);
+        return EXIT_ERROR;
+    }
+    if (format != FORMAT_TEXT)
+        results = &result_writer;
+
+    // Set up the search kernel for the literal search term
+    Scanner scanner;
+    scanner_init(&scanner, search_term, strlen(search_term), scan_flags);
+
+    // Build the automaton once, workers share it read-only
+    AcAutomaton *ac = NULL;
+    if (pattern_file && !(ac = ac_load(pattern_file, scan_flags)))
+        exit(EXIT_ERROR);
+
+    // Compile the expression once, workers only walk the transition table
+    Dfa *dfa = NULL;
+    if (use_regex) {
+        char err[128];
+        if (!(dfa = dfa_compile(search_term, scan_flags, err, sizeof(err)))) {
+            fprintf(stderr, "Invalid regular expression: %s\n", err);
+            exit(EXIT_ERROR);
+        }
     }
 
     // Set up signal handler for SIGINT
     struct sigaction sa = { 0 };
     sa.sa_handler = sigint_handler;
     sigemptyset(&sa.sa_mask);
-    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL); // No SA_RESTART, so a blocked read or wait returns on SIGINT
 
-    // Allocate memory for worker data and threads
-    Buffer buffer;
-    buffer_init(&buffer, buffer_size);
+    // A daemon keeps its files and workers until it is stopped, so it runs on its own
+    if (daemon_socket) {
+        sigaction(SIGTERM, &sa, NULL);
+        InputList resident = { NULL, 0, 0 };
+        for (int a = optind + 2; a < optind + 2 + num_paths; ++a)
+            collect_input(&resident, argv[a]);
+        char **paths = xmalloc(sizeof(char *) * (resident.n + 1));
+        for (size_t f = 0; f < resident.n; ++f)
+            paths[f] = resident.files[f].path;
+        int status = daemon_run(daemon_socket, paths, resident.n, buffer_size, num_workers, chunk_size,
+                                &terminate_flag);
+        for (size_t f = 0; f < resident.n; ++f)
+            free(resident.files[f].path);
+        free(resident.files);
+        free(paths);
+        return status;
+    }
 
-    worker_data = xmalloc(sizeof(WorkerData) * num_workers);
-    pthread_t *threads = xmalloc(sizeof(pthread_t) * num_workers);
+    // Open the input: the files of a multi-file run are mapped by the producer,
+    // a single regular log file is mapped here, pipes and stdin are streamed
+    int fd = -1;
+    CodecFormat codec = CODEC_NONE;
+    const char *map = NULL;
+    size_t file_size = 0;
+    int use_mmap = 0;
+    ItemKind kind = ITEM_FILES;
+    CodecBlock *blocks = NULL;
+    size_t num_blocks = 0;
+    Decoder *dec = NULL;
+    Reader reader;
+    ArenaPool line_arenas; // Storage of the followed lines
+    const char *reader_mode = NULL; // How streamed input was read, for the structured report
+    const LogFilter *line_filter = log_filter_active(&filter) ? &filter : NULL;
+    InputList inputs = { NULL, 0, 0 };
+    if (multi) {
+        for (int a = optind + 2; a < optind + 2 + num_paths; ++a)
+            collect_input(&inputs, argv[a]);
+        if (inputs.n == 0) {
+            fprintf(stderr, "No log files to scan\n");
+            exit(EXIT_ERROR);
+        }
+    } else {
+        fd = strcmp(file_path, "-") == 0 ? STDIN_FILENO : open(file_path, O_RDONLY);
+        if (fd == -1) {
+            perror("open");
+            exit(EXIT_ERROR);
+        }
 
-    // Initialize the barrier for synchronization
-    if (pthread_barrier_init(&finish_barrier, NULL, num_workers)) {
-        perror("pthread_barrier_init");
-        exit(EXIT_FAILURE);
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            perror("fstat");
+            exit(EXIT_ERROR);
+        }
+
+        if (follow && !S_ISREG(st.st_mode)) {
+            fprintf(stderr, "--follow needs a regular file\n");
+            exit(EXIT_ERROR);
+        }
+
+        // Compressed files are recognized by their magic bytes and always
+        // mapped. Compressed pipes and stdin are read into memory first; the
+        // magic bytes of plain ones are handed back to the reader.
+        char magic[4];
+        size_t nmagic = 0;
+        if (S_ISREG(st.st_mode)) {
+            ssize_t n = pread(fd, magic, sizeof(magic), 0);
+            nmagic = n > 0 ? (size_t)n : 0;
+            codec = codec_detect(magic, nmagic);
+        } else {
+            nmagic = read_full(fd, magic, sizeof(magic));
+            codec = codec_detect(magic, nmagic);
+            if (codec != CODEC_NONE) {
+                map = slurp_input(fd, magic, nmagic, &file_size);
+                codec = codec_detect(map, file_size);
+            }
+        }
+        if (follow && codec != CODEC_NONE) {
+            fprintf(stderr, "--follow does not support %s input\n", codec_name(codec));
+            exit(EXIT_ERROR);
+        }
+
+        // Followed files grow, so their lines are always streamed
+        use_mmap = codec != CODEC_NONE || (!force_stream && !follow && S_ISREG(st.st_mode));
+        if (use_mmap && !map && st.st_size > 0) {
+            file_size = (size_t)st.st_size;
+            map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED && codec != CODEC_NONE) {
+                perror("mmap");
+                exit(EXIT_ERROR);
+            } else if (map == MAP_FAILED) { // Fall back to streaming if the file cannot be mapped
+                map = NULL;
+                use_mmap = 0;
+            } else {
+                madvise((void *)map, file_size, MADV_SEQUENTIAL);
+            }
+        }
+
+        // BGZF blocks and zstd frames are decompressed in parallel by the workers,
+        // other compressed input by the producer. Filtering needs the sequential path.
+        kind = use_mmap ? ITEM_RANGE : follow ? ITEM_LINE : ITEM_TEXT;
+        if (codec != CODEC_NONE) {
+            if (!line_filter)
+                num_blocks = codec_blocks(codec, map, file_size, &blocks);
+            if (num_blocks > 0) {
+                kind = ITEM_BLOCK;
+            } else {
+                kind = ITEM_TEXT;
+                if (!(dec = decoder_open(codec, map, file_size)))
+                    exit(EXIT_ERROR);
+            }
+        } else if (kind == ITEM_TEXT) { // Blocks of a chunk each are read ahead and go to the workers as they are
+            reader_open(&reader, fd, chunk_size, READER_DEPTH, sizeof(TextChunk));
+            if (!S_ISREG(st.st_mode))
+                reader_unread(&reader, magic, nmagic);
+        }
     }
 
-    // Create worker threads
+    // Matching lines are printed straight from the mapped file
+    if (print && kind != ITEM_RANGE) {
+        fprintf(stderr, "--print needs an uncompressed regular file that can be mapped\n");
+        exit(EXIT_ERROR);
+    }
+    if (print)
+        report = stderr;
+
+    // Place the workers: --pin fills CPUs node by node, --numa deals them out
+    // round robin over the nodes so every node gets its share of workers
+    Topology topo = { NULL, 0, 0 };
+    if (pin || numa)
+        topology_load(&topo);
+    size_t num_nodes = numa ? (topo.num_nodes < num_workers ? topo.num_nodes : num_workers) : 1;
+
+    if (build_index) {
+        if (codec != CODEC_NONE)
+            fprintf(stderr, "--index does not support %s input, skipping\n", codec_name(codec));
+        else if (!use_mmap)
+            fprintf(stderr, "--index needs a regular file that can be mapped, skipping\n");
+        else if (map && logindex_update(file_path, map, file_size, 1) == -1)
+            fprintf(stderr, "Could not write the index\n");
+    }
+    if (build_bloom) {
+        if (codec != CODEC_NONE)
+            fprintf(stderr, "--bloom does not support %s input, skipping\n", codec_name(codec));
+        else if (!use_mmap)
+            fprintf(stderr, "--bloom needs a regular file that can be mapped, skipping\n");
+        else if (map && bloom_update(file_path, map, file_size, 1) == -1)
+            fprintf(stderr, "Could not write the Bloom filters\n");
+    }
+
+    // The trigram filters are consulted while they match the mapped file. A
+    // regular expression has no literal every match contains, and printed
+    // context may come from chunks without a match.
+    BloomIndex bloom;
+    BloomQuery bloom_query;
+    int use_bloom = 0;
+    bloom_query_init(&bloom_query);
+    if (kind == ITEM_RANGE && map && !dfa && !(print && (before || after)) &&
+        bloom_open(&bloom, file_path, map, file_size) == 0) {
+        use_bloom = 1;
+        if (ac) {
+            for (size_t p = 0; p < ac->num_patterns; ++p)
+                use_bloom &= bloom_query_add(&bloom_query, ac->patterns[p], ac->lengths[p]) == 0;
+        } else {
+            use_bloom = bloom_query_add(&bloom_query, search_term, strlen(search_term)) == 0;
+        }
+        if (!use_bloom)
+            bloom_close(&bloom);
+    }
+
+    // The chunks of a mapped file are listed up front when only some are
+    // scanned: the lines passing the filter, and the chunks the trigram
+    // filters do not rule out
+    ChunkList list = { NULL, 0, 0, chunk_size };
+    int use_list = kind == ITEM_RANGE && map && line_filter && !print;
+    size_t bloom_chunks = 0;
+    if (use_list)
+        select_chunks(&list, map, file_size, file_path, line_filter);
+    if (use_bloom) {
+        if (!use_list)
+            list.descs = split_chunks(map, 0, file_size, chunk_size, &list.n);
+        use_list = 1;
+        bloom_chunks = list.n;
+        list.n = prune_chunks(list.descs, list.n, &bloom, &bloom_query);
+        bloom_close(&bloom);
+    }
+    bloom_query_free(&bloom_query);
+
+    // Chunks of a mapped file are known up front, so they can be dealt to
+    // per-worker deques instead of going through the buffer. Printing needs
+    // the chunks to reach the workers in file order, so it takes the buffer.
+    int use_steal = steal && !print && kind == ITEM_RANGE && map;
+
+    // Otherwise a plain mapped file is split among the nodes, each with its own buffer
+    size_t num_buffers = !use_steal && !print && numa && kind == ITEM_RANGE && map && !use_list ? num_nodes : 1;
+    Buffer *buffers = xmalloc(sizeof(Buffer) * num_buffers);
+    for (size_t n = 0; n < num_buffers; ++n) {
+        if (lockfree)
+            buffer_init_lockfree(&buffers[n], buffer_size);
+        else
+            buffer_init(&buffers[n], buffer_size);
+        // Never shrink below one item per worker, never grow below the requested size
+        if (adaptive)
+            buffer_set_adaptive(&buffers[n], num_workers,
+                                buffer_size > ADAPTIVE_MAX_SIZE ? buffer_size : ADAPTIVE_MAX_SIZE);
+    }
+    Buffer *buffer = &buffers[0];
+
+    // Allocate memory for worker data and threads
+    worker_data = aligned_alloc(alignof(WorkerData), sizeof(WorkerData) * num_workers);
+    if (!worker_data) {
+        perror("aligned_alloc");
+        exit(EXIT_ERROR);
+    }
+    pthread_t *threads = xmalloc(sizeof(pthread_t) * num_workers);
+
+    // Workers block SIGINT so it always interrupts the producer
+    sigset_t sigint_set, old_set;
+    sigemptyset(&sigint_set);
+    sigaddset(&sigint_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigint_set, &old_set);
+
     for (size_t i = 0; i < num_workers; ++i) {
-        worker_data[i].buf = &buffer;
-        worker_data[i].search = search_term;
-        worker_data[i].match_count = 0;
-        worker_data[i].id = i;
-        if (pthread_create(&threads[i], NULL, worker, &worker_data[i])) {
-            perror("pthread_create");
-            exit(EXIT_FAILURE);
+        worker_data[i].cpu = -1;
+        worker_data[i].node = 0;
+        if (numa) {
+            const NumaNode *node = &topo.nodes[i % num_nodes];
+            worker_data[i].node = i % num_nodes;
+            worker_data[i].cpu = node->cpus[(i / num_nodes) % node->num_cpus];
+        } else if (pin) {
+            worker_data[i].cpu = topology_cpu(&topo, i, &worker_data[i].node);
         }
     }
 
-    // Open the log file and read lines into the buffer
-    FILE *fp = fopen(file_path, "r");
-    if (!fp) {
-        perror("fopen");
-        exit(EXIT_FAILURE);
+    // The writer accepts output from a few batches per worker ahead of the
+    // next chunk in file order, enough that workers rarely wait for each other
+    Writer writer;
+    Writer *out = print && map ? &writer : NULL;
+    if (out) {
+        size_t window = 4 * num_workers * batch_size;
+        writer_start(out, STDOUT_FILENO, window > OUTPUT_WINDOW ? window : OUTPUT_WINDOW, before || after);
     }
 
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t nread;
+    // Deal the chunks before the workers start, stealing prefers the same node
+    Scheduler sched;
+    ChunkDesc **node_chunks = NULL;
+    size_t num_chunk_lists = 0;
+    if (use_steal) {
+        num_chunk_lists = numa ? num_nodes : 1;
+        node_chunks = schedule_chunks(&sched, num_chunk_lists, map, file_size, use_list ? &list : NULL,
+                                      chunk_size);
+        waiting_sched = &sched; // SIGINT is still blocked
+    }
 
-    while (!terminate_flag && (nread = getline(&line, &len, fp)) != -1) {
-        char *copy = strdup(line);
-        if (!copy) {
-            perror("strdup");
-            exit(EXIT_FAILURE);
+    // Create worker threads, the wall time of the run starts here
+    double started = now();
+    profile_calibrate();
+    PROFILE_ATTACH(&producer_prof);
+    for (size_t i = 0; i < num_workers; ++i) {
+        worker_data[i].sched = use_steal ? &sched : NULL;
+        worker_data[i].bytes = 0;
+        worker_data[i].first_item = 0;
+        worker_data[i].last_item = 0;
+        worker_data[i].use_hist = use_hist;
+        worker_data[i].use_agg = use_agg;
+        worker_data[i].sketch = sketch;
+        memset(&worker_data[i].prof, 0, sizeof(Profile));
+        worker_data[i].buf = &buffers[num_buffers > 1 ? worker_data[i].node : 0];
+        worker_data[i].scanner = &scanner;
+        worker_data[i].ac = ac;
+        worker_data[i].dfa = dfa;
+        worker_data[i].kind = kind;
+        worker_data[i].map = map;
+        worker_data[i].map_size = file_size;
+        worker_data[i].batch_size = batch_size;
+        worker_data[i].match_count = 0;
+        worker_data[i].out = out;
+        worker_data[i].filter = out || multi ? line_filter : NULL;
+        worker_data[i].files = inputs.files;
+        worker_data[i].before = before;
+        worker_data[i].after = after;
+        worker_data[i].marks = NULL;
+        worker_data[i].num_marks = 0;
+        worker_data[i].marks_cap = 0;
+        atomic_init(&worker_data[i].live_count, 0);
+        worker_data[i].id = i;
+        if (pthread_create(&threads[i], NULL, worker, &worker_data[i])) {
+            perror("pthread_create");
+            exit(EXIT_ERROR);
         }
-        buffer_push(&buffer, copy);
     }
+    if (num_buffers == 1) // Per-node producers are started below with SIGINT still blocked
+        pthread_sigmask(SIG_SETMASK, &old_set, NULL);
 
-    free(line);
-    fclose(fp);
+    // Feed the workers with chunk descriptors, compressed blocks, text chunks or line copies
+    ChunkDesc *chunks = NULL;
+    if (use_steal) {
+        // The workers already have everything, wait for the last of them or for SIGINT
+        scheduler_wait(&sched);
+        waiting_sched = NULL;
+        if (terminate_flag)
+            scheduler_terminate(&sched);
+    } else if (num_buffers > 1) {
+        node_chunks = produce_per_node(buffers, num_buffers, map, file_size, chunk_size, batch_size);
+        num_chunk_lists = num_buffers;
+        pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    } else if (multi) {
+        produce_files(buffer, inputs.files, inputs.n, chunk_size, batch_size);
+    } else if (follow) {
+        close(fd); // The follower reopens the path itself and again after every rotation
+        fd = -1;
+        Follower follower;
+        if (follower_open(&follower, file_path) == -1)
+            exit(EXIT_ERROR);
+        arena_pool_init(&line_arenas, ARENA_SIZE, ARENA_SPARE);
+        produce_follow(buffer, &line_arenas, &follower, line_filter, batch_size, interval);
+        follower_close(&follower);
+    } else if (kind == ITEM_BLOCK) {
+        produce_blocks(buffer, blocks, num_blocks, batch_size);
+    } else if (kind == ITEM_TEXT && dec) {
+        produce_decoded(buffer, dec, line_filter, chunk_size, batch_size);
+        decoder_close(dec);
+    } else if (kind == ITEM_TEXT) {
+        produce_stream(buffer, &reader, line_filter, batch_size);
+        reader_mode = reader_mode_name(&reader);
+        if (show_stats && !results)
+            fprintf(report, "Reader: %s, %d blocks of %zu bytes in flight\n", reader_mode_name(&reader),
+                    reader.mode == READER_PLAIN ? 1 : READER_DEPTH, chunk_size);
+        reader_close(&reader);
+    } else if (use_list) { // Printing needs the filtered out lines for context, so it never selects them
+        push_chunks(buffer, list.descs, list.n, batch_size);
+        chunks = list.descs;
+    } else if (map) {
+        chunks = produce_chunks(buffer, map, 0, file_size, chunk_size, batch_size);
+    }
 
     // Signal termination to all worker threads
     if (terminate_flag) {
-        printf("SIGINT received, initiating shutdown...\n");
-        pthread_mutex_lock(&buffer.mutex);
-        buffer.terminating = 1;
+        fprintf(results ? stderr : report, "SIGINT received, initiating shutdown...\n");
         // Notify all workers to wake up and check for termination
-        pthread_cond_broadcast(&buffer.items_available); 
-        pthread_cond_broadcast(&buffer.space_available);
-        pthread_mutex_unlock(&buffer.mutex);
-    } else {
-        // Push sentinel values to signal termination to all workers
-        for (size_t i = 0; i < num_workers; ++i) {
-            buffer_push(&buffer, NULL);
+        for (size_t n = 0; n < num_buffers; ++n)
+            buffer_terminate(&buffers[n]);
+        if (out)
+            writer_terminate(out);
+    } else if (!use_steal) {
+        // Push sentinel values to signal termination to all workers, one per worker of each buffer
+        void *sentinels[MAX_BATCH_SIZE] = { NULL };
+        for (size_t b = 0; b < num_buffers; ++b) {
+            size_t consumers = 0;
+            for (size_t i = 0; i < num_workers; ++i)
+                consumers += worker_data[i].buf == &buffers[b];
+            for (size_t i = 0; i < consumers; i += MAX_BATCH_SIZE) {
+                size_t n = consumers - i < MAX_BATCH_SIZE ? consumers - i : MAX_BATCH_SIZE;
+                buffer_push_batch(&buffers[b], sentinels, n);
+            }
         }
     }
 
     // Wait for all worker threads to finish
     for (size_t i = 0; i < num_workers; ++i)
         pthread_join(threads[i], NULL);
+    double elapsed = now() - started;
+    int failed = out && writer_close(out) == -1;
+    if (follow) { // Every worker has released its lines
+        if (show_stats)
+            fprintf(report, "Line arenas: %zu of %zu bytes allocated, reused %zu times\n", line_arenas.allocated,
+                    (size_t)ARENA_SIZE, line_arenas.reused);
+        arena_pool_destroy(&line_arenas);
+    }
+    if (use_bloom && show_stats && !results)
+        fprintf(report, "Bloom filters: skipped %zu of %zu chunks\n", bloom_chunks - list.n, bloom_chunks);
+
+    // Lines spanning two compressed blocks are matched once all blocks are done,
+    // with the first worker's counters
+    size_t boundary_matches = 0;
+    if (blocks && !terminate_flag) {
+        boundary_matches = match_boundaries(&worker_data[0], blocks, num_blocks);
+    } else if (blocks) {
+        for (size_t i = 0; i < num_blocks; ++i) {
+            free(blocks[i].head);
+            free(blocks[i].tail);
+        }
+    }
+    if (results) {
+        result_open(results, report, format);
+        result_begin(results, "run", 0);
+        result_string(results, "search", pattern_file ? pattern_file : search_term);
+        result_string(results, "mode", pattern_file ? "patterns" : use_regex ? "regex" : "literal");
+        result_bool(results, "ignore_case", (scan_flags & SCAN_ICASE) != 0);
+        result_bool(results, "word", (scan_flags & SCAN_WORD) != 0);
+        result_uint(results, "workers", num_workers);
+        result_uint(results, "buffer_size", buffer_size);
+        result_bool(results, "interrupted", terminate_flag != 0);
+        result_end(results, 0);
+        if (reader_mode) {
+            result_begin(results, "reader", 0);
+            result_string(results, "mode", reader_mode);
+            result_uint(results, "depth", strcmp(reader_mode, "read") == 0 ? 1 : READER_DEPTH);
+            result_uint(results, "block_size", chunk_size);
+            result_end(results, 0);
+        }
+        if (use_bloom) {
+            result_begin(results, "bloom", 0);
+            result_uint(results, "chunks", bloom_chunks);
+            result_uint(results, "skipped", bloom_chunks - list.n);
+            result_end(results, 0);
+        }
+    }
+    if (multi)
+        report_files(&inputs);
+    size_t total = report_totals(ac, use_hist, use_agg, top, boundary_matches, elapsed);
+    if (numa)
+        report_nodes(&topo);
+    if (show_stats || results) // The structured report always has the counters
+        report_buffers(buffers, num_buffers, use_steal);
+    if (PROFILE_ENABLED)
+        report_profile();
+
+    int status = total > 0 ? EXIT_MATCH : EXIT_NO_MATCH;
+    if (terminate_flag && !follow) // Stopping --follow with SIGINT is the normal end of the run
+        status = EXIT_INTERRUPTED;
+    if (failed || atomic_load(&input_errors) > 0)
+        status = EXIT_ERROR;
+    if (results) {
+        result_begin(results, "exit", 0);
+        result_uint(results, "status", (size_t)status);
+        result_end(results, 0);
+        if (result_close(results) == -1)
+            status = EXIT_ERROR;
+    }
 
     // Clean up
-    pthread_barrier_destroy(&finish_barrier);
-    buffer_destroy(&buffer);
+    for (size_t n = 0; n < num_buffers; ++n)
+        buffer_destroy(&buffers[n]);
+    free(buffers);
+    topology_destroy(&topo);
 
+    free(chunks);
+    if (node_chunks) {
+        for (size_t n = 0; n < num_chunk_lists; ++n)
+            free(node_chunks[n]);
+        free(node_chunks);
+    }
+    if (use_steal)
+        scheduler_destroy(&sched);
+    free(blocks);
+    if (map)
+        munmap((void *)map, file_size);
+    for (size_t f = 0; f < inputs.n; ++f) { // Files left mapped when SIGINT stopped the workers early
+        if (inputs.files[f].map && atomic_load(&inputs.files[f].parts_left) > 0)
+            munmap((void *)inputs.files[f].map, inputs.files[f].size);
+        free(inputs.files[f].path);
+    }
+    free(inputs.files);
+    if (fd != -1 && fd != STDIN_FILENO)
+        close(fd);
+
+    if (ac) {
+        for (size_t i = 0; i < num_workers; ++i) {
+            ac_counter_destroy(&worker_data[i].ac_counter);
+            if (out)
+                ac_counter_destroy(&worker_data[i].ac_scratch);
+        }
+        ac_destroy(ac);
+    }
+
+    dfa_destroy(dfa);
+
+    if (use_hist)
+        for (size_t i = 0; i < num_workers; ++i)
+            histogram_destroy(&worker_data[i].hist);
+    if (use_agg)
+        for (size_t i = 0; i < num_workers; ++i)
+            aggregate_destroy(&worker_data[i].agg);
+
+    for (size_t i = 0; i < num_workers; ++i)
+        free(worker_data[i].marks);
     free(threads);
     free(worker_data);
 
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
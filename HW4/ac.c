@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ac.h"
+#include "exitcode.h"
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to allocate zeroed memory and handle errors
+static void *xcalloc(size_t n, size_t size) {
+    void *pointer = calloc(n, size);
+    if (!pointer) fatal("calloc");
+    return pointer;
+}
+
+// Function to load one pattern per line from a file, empty lines are skipped
+AcAutomaton *ac_load(const char *path, int flags) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("fopen");
+        return NULL;
+    }
+
+    char **patterns = NULL;
+    size_t count = 0, cap = 0;
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t nread;
+
+    while ((nread = getline(&line, &len, fp)) != -1) {
+        while (nread > 0 && (line[nread - 1] == '\n' || line[nread - 1] == '\r'))
+            line[--nread] = '\0';
+        if (nread == 0)
+            continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            patterns = realloc(patterns, cap * sizeof(char *));
+            if (!patterns) fatal("realloc");
+        }
+        patterns[count] = strdup(line);
+        if (!patterns[count]) fatal("strdup");
+        count++;
+    }
+    free(line);
+    fclose(fp);
+
+    if (count == 0) {
+        fprintf(stderr, "%s: no patterns\n", path);
+        free(patterns);
+        return NULL;
+    }
+    return ac_build(patterns, count, flags);
+}
+
+// Function to build the automaton, takes ownership of the non-empty patterns
+AcAutomaton *ac_build(char **patterns, size_t num_patterns, int flags) {
+    AcAutomaton *ac = xcalloc(1, sizeof(AcAutomaton));
+    ac->patterns = patterns;
+    ac->num_patterns = num_patterns;
+    ac->lengths = xcalloc(num_patterns, sizeof(size_t));
+    ac->flags = flags;
+
+    // Bytes that occur in patterns get their own class, everything else shares
+    // class 0. Ignoring case, both cases of a letter share one class, so the
+    // transition table folds the input without any per-byte work.
+    size_t max_states = 1;
+    ac->num_classes = 1;
+    for (size_t i = 0; i < num_patterns; ++i) {
+        for (const unsigned char *p = (const unsigned char *)patterns[i]; *p; ++p) {
+            if (ac->byte_class[*p] != 0)
+                continue;
+            ac->byte_class[*p] = (uint8_t)ac->num_classes++;
+            if ((flags & SCAN_ICASE) && (unsigned)((*p | 0x20) - 'a') < 26)
+                ac->byte_class[*p ^ 0x20] = ac->byte_class[*p];
+        }
+        ac->lengths[i] = strlen(patterns[i]);
+        max_states += ac->lengths[i];
+    }
+    size_t nc = ac->num_classes;
+
+    ac->delta = xcalloc(max_states * nc, sizeof(int32_t));
+    ac->out = xcalloc(max_states, sizeof(int32_t));
+    ac->out_link = xcalloc(max_states, sizeof(int32_t));
+    ac->out_next = xcalloc(num_patterns, sizeof(int32_t));
+    memset(ac->delta, 0xff, max_states * nc * sizeof(int32_t)); // -1 marks a missing trie edge
+    memset(ac->out, 0xff, max_states * sizeof(int32_t));
+    memset(ac->out_link, 0xff, max_states * sizeof(int32_t));
+
+    // Build the trie
+    size_t states = 1;
+    for (size_t i = 0; i < num_patterns; ++i) {
+        int32_t s = 0;
+        for (const unsigned char *p = (const unsigned char *)patterns[i]; *p; ++p) {
+            int32_t *next = &ac->delta[s * nc + ac->byte_class[*p]];
+            if (*next < 0)
+                *next = (int32_t)states++;
+            s = *next;
+        }
+        ac->out_next[i] = ac->out[s];
+        ac->out[s] = (int32_t)i;
+    }
+    ac->num_states = states;
+
+    // Breadth-first pass computing failure links and completing the DFA
+    int32_t *fail = xcalloc(states, sizeof(int32_t));
+    int32_t *queue = xcalloc(states, sizeof(int32_t));
+    size_t qhead = 0, qtail = 0;
+
+    for (size_t c = 0; c < nc; ++c) {
+        int32_t t = ac->delta[c];
+        if (t < 0) {
+            ac->delta[c] = 0;
+        } else {
+            fail[t] = 0;
+            queue[qtail++] = t;
+        }
+    }
+
+    while (qhead < qtail) {
+        int32_t s = queue[qhead++];
+        int32_t f = fail[s];
+        ac->out_link[s] = ac->out[f] >= 0 ? f : ac->out_link[f];
+
+        for (size_t c = 0; c < nc; ++c) {
+            int32_t t = ac->delta[s * nc + c];
+            if (t < 0) {
+                ac->delta[s * nc + c] = ac->delta[f * nc + c];
+            } else {
+                fail[t] = ac->delta[f * nc + c];
+                queue[qtail++] = t;
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return ac;
+}
+
+// Function to destroy the automaton and its patterns
+void ac_destroy(AcAutomaton *ac) {
+    if (!ac)
+        return;
+    for (size_t i = 0; i < ac->num_patterns; ++i)
+        free(ac->patterns[i]);
+    free(ac->patterns);
+    free(ac->lengths);
+    free(ac->delta);
+    free(ac->out);
+    free(ac->out_next);
+    free(ac->out_link);
+    free(ac);
+}
+
+// Function to initialize a per-worker counter
+void ac_counter_init(AcCounter *c, const AcAutomaton *ac) {
+    c->counts = xcalloc(ac->num_patterns, sizeof(size_t));
+    c->seen = xcalloc(ac->num_patterns, sizeof(uint64_t));
+    c->line = 1;
+}
+
+// Function to destroy a per-worker counter
+void ac_counter_destroy(AcCounter *c) {
+    free(c->counts);
+    free(c->seen);
+}
+
+// Function to run the automaton over a chunk of whole lines. Each pattern is
+// counted at most once per line in c->counts, the return value is the number
+// of lines matching at least one pattern, each also passed to on_match if set.
+// With SCAN_WORD only the pattern hits that are whole words count.
+size_t ac_count_lines(const AcAutomaton *ac, AcCounter *c, const char *data, size_t len, match_fn on_match,
+                      void *ctx) {
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + len;
+    const unsigned char *line = p;
+    const size_t nc = ac->num_classes;
+    size_t matched_lines = 0;
+    int line_matched = 0;
+    int32_t s = 0;
+
+    for (; p < end; ++p) {
+        s = ac->delta[s * nc + ac->byte_class[*p]];
+
+        int32_t t = ac->out[s] >= 0 ? s : ac->out_link[s];
+        while (t >= 0) {
+            for (int32_t i = ac->out[t]; i >= 0; i = ac->out_next[i]) {
+                if ((ac->flags & SCAN_WORD) && !scan_word_bounded((const char *)p + 1 - ac->lengths[i],
+                                                                  ac->lengths[i], (const char *)line, (const char *)end))
+                    continue;
+                if (c->seen[i] != c->line) {
+                    c->seen[i] = c->line;
+                    c->counts[i]++;
+                }
+                line_matched = 1;
+            }
+            t = ac->out_link[t];
+        }
+
+        if (*p == '\n') { // Patterns never span lines
+            if (line_matched && on_match)
+                on_match((const char *)line, p + 1 - line, ctx);
+            line = p + 1;
+            matched_lines += line_matched;
+            line_matched = 0;
+            c->line++;
+            s = 0;
+        }
+    }
+
+    if (len > 0 && end[-1] != '\n') { // Last line without a trailing newline
+        if (line_matched && on_match)
+            on_match((const char *)line, end - line, ctx);
+        matched_lines += line_matched;
+        c->line++;
+    }
+    return matched_lines;
+}
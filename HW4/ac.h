@@ -0,0 +1,39 @@
+#ifndef AC_H
+#define AC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "scan.h"
+
+// Aho-Corasick automaton compiled into a dense DFA over byte classes
+typedef struct {
+    char **patterns; // Pattern strings, owned
+    size_t num_patterns;
+    size_t *lengths; // Pattern lengths, for the whole-word check
+    int flags; // SCAN_ICASE and SCAN_WORD
+    size_t num_states;
+    size_t num_classes; // Number of byte classes, class 0 holds bytes used by no pattern
+    uint8_t byte_class[256]; // Byte to class map
+    int32_t *delta; // num_states x num_classes transition table
+    int32_t *out; // First pattern ending in each state, -1 if none
+    int32_t *out_next; // Next pattern in the same output set, -1 at the end
+    int32_t *out_link; // Nearest suffix state with output, -1 if none
+} AcAutomaton;
+
+// Per-worker match state, patterns are counted once per line
+typedef struct {
+    size_t *counts; // Matching lines per pattern
+    uint64_t *seen; // Line stamp of the last line each pattern was counted on
+    uint64_t line; // Stamp of the current line
+} AcCounter;
+
+// Function prototypes
+AcAutomaton *ac_load(const char *path, int flags);
+AcAutomaton *ac_build(char **patterns, size_t num_patterns, int flags);
+void ac_destroy(AcAutomaton *ac);
+void ac_counter_init(AcCounter *c, const AcAutomaton *ac);
+void ac_counter_destroy(AcCounter *c);
+size_t ac_count_lines(const AcAutomaton *ac, AcCounter *c, const char *data, size_t len, match_fn on_match,
+                      void *ctx);
+
+#endif /* AC_H */
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "aggregate.h"
+#include "exitcode.h"
+
+#define INITIAL_COUNTERS 64 // Initial size of an exact table, doubled when full
+#define NO_COUNTER ((size_t)-1)
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to hash a key with FNV-1a
+static uint64_t hash_key(const char *key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Function to initialize an empty table, exact if capacity is 0
+static void table_init(CountTable *t, size_t capacity) {
+    memset(t, 0, sizeof(CountTable));
+    t->capacity = capacity;
+    t->alloc = capacity ? capacity : INITIAL_COUNTERS;
+    t->num_buckets = 1;
+    while (t->num_buckets < 2 * t->alloc)
+        t->num_buckets *= 2;
+    t->counters = malloc(t->alloc * sizeof(AggCounter));
+    t->next = malloc(t->alloc * sizeof(uint32_t));
+    t->buckets = calloc(t->num_buckets, sizeof(uint32_t));
+    if (!t->counters || !t->next || !t->buckets) fatal("malloc");
+    if (capacity) {
+        t->heap = malloc(capacity * sizeof(uint32_t));
+        t->slot = malloc(capacity * sizeof(uint32_t));
+        if (!t->heap || !t->slot) fatal("malloc");
+    }
+}
+
+// Function to free a table and its keys
+static void table_destroy(CountTable *t) {
+    for (size_t i = 0; i < t->n; ++i)
+        free(t->counters[i].key);
+    free(t->counters);
+    free(t->next);
+    free(t->buckets);
+    free(t->heap);
+    free(t->slot);
+    memset(t, 0, sizeof(CountTable));
+}
+
+// Function to find the counter of a key, NO_COUNTER if it has none
+static size_t table_find(const CountTable *t, const char *key, size_t len, uint64_t hash) {
+    for (uint32_t c = t->buckets[hash & (t->num_buckets - 1)]; c != 0; c = t->next[c - 1]) {
+        const AggCounter *e = &t->counters[c - 1];
+        if (e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0)
+            return c - 1;
+    }
+    return NO_COUNTER;
+}
+
+// Function to put a counter at the head of its hash chain
+static void table_link(CountTable *t, size_t i) {
+    uint32_t *head = &t->buckets[t->counters[i].hash & (t->num_buckets - 1)];
+    t->next[i] = *head;
+    *head = (uint32_t)(i + 1);
+}
+
+// Function to take a counter out of its hash chain
+static void table_unlink(CountTable *t, size_t i) {
+    uint32_t *link = &t->buckets[t->counters[i].hash & (t->num_buckets - 1)];
+    while (*link != i + 1)
+        link = &t->next[*link - 1];
+    *link = t->next[i];
+}
+
+// Function to double an exact table, rehashing its counters
+static void table_grow(CountTable *t) {
+    t->alloc *= 2;
+    t->counters = realloc(t->counters, t->alloc * sizeof(AggCounter));
+    t->next = realloc(t->next, t->alloc * sizeof(uint32_t));
+    free(t->buckets);
+    t->num_buckets *= 2;
+    t->buckets = calloc(t->num_buckets, sizeof(uint32_t));
+    if (!t->counters || !t->next || !t->buckets) fatal("realloc");
+    for (size_t i = 0; i < t->n; ++i)
+        table_link(t, i);
+}
+
+// Function to swap two heap positions
+static void heap_swap(CountTable *t, size_t a, size_t b) {
+    uint32_t x = t->heap[a];
+    t->heap[a] = t->heap[b];
+    t->heap[b] = x;
+    t->slot[t->heap[a]] = (uint32_t)a;
+    t->slot[t->heap[b]] = (uint32_t)b;
+}
+
+// Function to move a heap entry up while its count is below its parent's
+static void heap_up(CountTable *t, size_t pos) {
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (t->counters[t->heap[parent]].count <= t->counters[t->heap[pos]].count)
+            break;
+        heap_swap(t, pos, parent);
+        pos = parent;
+    }
+}
+
+// Function to move a heap entry down while a child has a smaller count
+static void heap_down(CountTable *t, size_t pos) {
+    for (;;) {
+        size_t least = pos, l = 2 * pos + 1, r = l + 1;
+        if (l < t->n && t->counters[t->heap[l]].count < t->counters[t->heap[least]].count)
+            least = l;
+        if (r < t->n && t->counters[t->heap[r]].count < t->counters[t->heap[least]].count)
+            least = r;
+        if (least == pos)
+            return;
+        heap_swap(t, pos, least);
+        pos = least;
+    }
+}
+
+// Function to store a copy of a key in a counter
+static void set_key(AggCounter *e, const char *key, size_t len, uint64_t hash) {
+    char *copy = realloc(e->key, len + 1);
+    if (!copy) fatal("realloc");
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+    e->key = copy;
+    e->len = len;
+    e->hash = hash;
+}
+
+// Function to add count, known to within error, to a key
+static void table_add(CountTable *t, const char *key, size_t len, uint64_t hash, size_t count, size_t error) {
+    size_t i = table_find(t, key, len, hash);
+    if (i != NO_COUNTER) {
+        t->counters[i].count += count;
+        t->counters[i].error += error;
+        if (t->capacity)
+            heap_down(t, t->slot[i]);
+        return;
+    }
+
+    if (t->capacity && t->n == t->capacity) { // Full sketch, evict the smallest count
+        i = t->heap[0];
+        AggCounter *e = &t->counters[i];
+        table_unlink(t, i);
+        set_key(e, key, len, hash);
+        e->error = e->count + error;
+        e->count += count;
+        table_link(t, i);
+        heap_down(t, 0);
+        return;
+    }
+
+    if (t->n == t->alloc)
+        table_grow(t);
+    i = t->n++;
+    AggCounter *e = &t->counters[i];
+    e->key = NULL;
+    set_key(e, key, len, hash);
+    e->count = count;
+    e->error = error + t->absent; // The key may have been dropped by an earlier merged sketch
+    table_link(t, i);
+    if (t->capacity) {
+        t->heap[i] = (uint32_t)i;
+        t->slot[i] = (uint32_t)i;
+        heap_up(t, i);
+    }
+}
+
+// Function to add the counts of src to the exact table dst. A key missing
+// from a full sketch may still have been counted there up to the sketch's
+// smallest count, which widens the error of the keys dst holds without it.
+static void table_merge(CountTable *dst, const CountTable *src) {
+    size_t dropped = src->capacity && src->n == src->capacity ? src->counters[src->heap[0]].count : 0;
+    if (dropped)
+        for (size_t i = 0; i < dst->n; ++i) {
+            const AggCounter *e = &dst->counters[i];
+            if (table_find(src, e->key, e->len, e->hash) == NO_COUNTER)
+                dst->counters[i].error += dropped;
+        }
+    for (size_t i = 0; i < src->n; ++i) {
+        const AggCounter *e = &src->counters[i];
+        table_add(dst, e->key, e->len, e->hash, e->count, e->error);
+    }
+    dst->absent += dropped;
+}
+
+// Function to initialize an empty aggregate, keeping at most capacity
+// counters per table, or every distinct key if capacity is 0
+void aggregate_init(Aggregate *a, size_t capacity) {
+    memset(a->by_level, 0, sizeof(a->by_level));
+    table_init(&a->templates, capacity);
+    table_init(&a->components, capacity);
+}
+
+// Function to free the tables
+void aggregate_destroy(Aggregate *a) {
+    table_destroy(&a->templates);
+    table_destroy(&a->components);
+}
+
+// Function to check whether a byte may be part of a component name
+static int name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '-' || c == '.';
+}
+
+// Function to find the component a message names, either as a leading
+// "[Name]" or as "component: Name", returns its length or 0 if there is none
+static size_t find_component(const char *msg, size_t len, const char **name) {
+    if (len > 2 && msg[0] == '[') {
+        const char *close = memchr(msg + 1, ']', len - 1);
+        if (close && close > msg + 1) {
+            *name = msg + 1;
+            return (size_t)(close - msg - 1);
+        }
+    }
+
+    static const char word[] = "component";
+    size_t wl = sizeof(word) - 1;
+    for (size_t i = 0; i + wl < len; ++i) {
+        if (strncasecmp(msg + i, word, wl) != 0 || (i > 0 && name_char(msg[i - 1])))
+            continue;
+        size_t p = i + wl;
+        if (p < len && (msg[p] == ':' || msg[p] == '='))
+            p++;
+        while (p < len && msg[p] == ' ')
+            p++;
+        size_t q = p;
+        while (q < len && name_char(msg[q]))
+            q++;
+        while (q > p && msg[q - 1] == '.') // Sentence end, not part of the name
+            q--;
+        if (q > p) {
+            *name = msg + p;
+            return q - p;
+        }
+    }
+    return 0;
+}
+
+// Function to count a matching line under its level, its message template
+// and the component it names
+void aggregate_add(Aggregate *a, const char *line, size_t len) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        len--;
+    uint32_t ts;
+    LogLevel level;
+    log_parse_line(line, len, &ts, &level);
+    a->by_level[level]++;
+
+    // The message follows the colon of the level token, unparsed lines are all message
+    const char *msg = line;
+    size_t mlen = len;
+    if (level != LEVEL_UNPARSED) {
+        const char *colon = memchr(line + 22, ':', len - 22);
+        msg = colon + 1;
+        mlen = (size_t)(line + len - msg);
+        while (mlen > 0 && *msg == ' ') {
+            msg++;
+            mlen--;
+        }
+    }
+
+    char key[AGG_MAX_KEY];
+    size_t n = 0;
+    for (size_t i = 0; i < mlen && n < AGG_MAX_KEY; ++i) {
+        if (msg[i] >= '0' && msg[i] <= '9') {
+            while (i + 1 < mlen && msg[i + 1] >= '0' && msg[i + 1] <= '9')
+                i++;
+            key[n++] = '#';
+        } else {
+            key[n++] = msg[i];
+        }
+    }
+    table_add(&a->templates, key, n, hash_key(key, n), 1, 0);
+
+    const char *name;
+    size_t nl = find_component(msg, mlen, &name);
+    if (nl > AGG_MAX_KEY)
+        nl = AGG_MAX_KEY;
+    if (nl > 0)
+        table_add(&a->components, name, nl, hash_key(name, nl), 1, 0);
+}
+
+// Function to add the counts of src to dst, which must be exact
+void aggregate_merge(Aggregate *dst, const Aggregate *src) {
+    for (int l = 0; l < LEVEL_COUNT; ++l)
+        dst->by_level[l] += src->by_level[l];
+    table_merge(&dst->templates, &src->templates);
+    table_merge(&dst->components, &src->components);
+}
+
+// Function to order counters by count, largest first, then by key
+static int compare_counters(const void *a, const void *b) {
+    const AggCounter *x = *(const AggCounter *const *)a, *y = *(const AggCounter *const *)b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return strcmp(x->key, y->key);
+}
+
+// Function to get the k counters with the largest counts, largest first, the caller frees *top
+size_t aggregate_top(const CountTable *t, size_t k, const AggCounter ***top) {
+    *top = malloc((t->n + 1) * sizeof(AggCounter *));
+    if (!*top) fatal("malloc");
+    for (size_t i = 0; i < t->n; ++i)
+        (*top)[i] = &t->counters[i];
+    qsort(*top, t->n, sizeof(AggCounter *), compare_counters);
+    return t->n < k ? t->n : k;
+}
+
+// Function to print the k largest counters of a table
+static void print_top(const CountTable *t, size_t k, const char *what, FILE *out) {
+    const AggCounter **top;
+    size_t n = aggregate_top(t, k, &top);
+    fprintf(out, "Top %zu %s:\n", n, what);
+    for (size_t i = 0; i < n; ++i) {
+        if (top[i]->error)
+            fprintf(out, "  %10zu +-%-8zu %s\n", top[i]->count, top[i]->error, top[i]->key);
+        else
+            fprintf(out, "  %10zu %s\n", top[i]->count, top[i]->key);
+    }
+    free(top);
+}
+
+// Function to print the level counts if asked, then the top k templates and components
+void aggregate_print(const Aggregate *a, size_t k, int levels, FILE *out) {
+    if (levels) {
+        fprintf(out, "Matches by level:\n");
+        for (int l = 0; l < LEVEL_COUNT; ++l)
+            if (a->by_level[l] != 0)
+                fprintf(out, "  %-8s %zu\n", log_level_name((LogLevel)l), a->by_level[l]);
+    }
+    print_top(&a->templates, k, "message templates", out);
+    print_top(&a->components, k, "components", out);
+}
@@ -0,0 +1,61 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "logindex.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define AGG_MAX_KEY 200 // Templates and components are cut to this many bytes
+
+// Count of one template or component. A counter of a sketch may overcount,
+// and merged counts may be off either way, by at most error.
+typedef struct {
+    char *key; // NUL terminated
+    size_t len;
+    uint64_t hash;
+    size_t count;
+    size_t error;
+} AggCounter;
+
+// Counts of distinct keys. Without a capacity every key gets a counter. With
+// one, at most capacity counters are kept by the space-saving algorithm: once
+// all are taken, a new key takes over the counter with the smallest count and
+// inherits that count as its error. Any key seen more than total / capacity
+// times is then sure to hold a counter.
+typedef struct {
+    AggCounter *counters;
+    size_t n;
+    size_t alloc;
+    size_t capacity; // 0 for exact counts
+    uint32_t *buckets; // Head of each hash chain, counter index + 1, 0 if empty
+    uint32_t *next; // Next counter in the same chain, + 1
+    size_t num_buckets; // Power of two
+    uint32_t *heap; // Sketch only: min-heap of counter indices ordered by count
+    uint32_t *slot; // Sketch only: position of each counter in the heap
+    size_t absent; // Merged tables only: bound on the count of a key some merged sketch dropped
+} CountTable;
+
+// Matching lines of one worker grouped by level, message template (the
+// message with digit runs masked as '#') and component. The alignment keeps
+// the counters of different workers on different cache lines.
+typedef struct {
+    alignas(CACHE_LINE_SIZE) size_t by_level[LEVEL_COUNT];
+    CountTable templates;
+    CountTable components;
+} Aggregate;
+
+// Function prototypes
+void aggregate_init(Aggregate *a, size_t capacity);
+void aggregate_destroy(Aggregate *a);
+void aggregate_add(Aggregate *a, const char *line, size_t len);
+void aggregate_merge(Aggregate *dst, const Aggregate *src);
+size_t aggregate_top(const CountTable *t, size_t k, const AggCounter ***top);
+void aggregate_print(const Aggregate *a, size_t k, int levels, FILE *out);
+
+#endif /* AGGREGATE_H */
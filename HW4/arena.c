@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "exitcode.h"
+
+#define SLOT_SPACE ((sizeof(LineSlot) + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t))
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to initialize a pool of arenas of arena_size bytes
+void arena_pool_init(ArenaPool *pool, size_t arena_size, size_t max_free) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->free = NULL;
+    pool->num_free = 0;
+    pool->max_free = max_free;
+    pool->arena_size = arena_size;
+    pool->current = NULL;
+    pool->allocated = 0;
+    pool->reused = 0;
+}
+
+// Function to drop a reference, recycling the arena once no line and no producer holds it
+static void arena_unref(Arena *a) {
+    if (atomic_fetch_sub_explicit(&a->refs, 1, memory_order_acq_rel) != 1)
+        return;
+    ArenaPool *pool = a->pool;
+    pthread_mutex_lock(&pool->lock);
+    if (a->size == pool->arena_size && pool->num_free < pool->max_free) {
+        a->next = pool->free;
+        pool->free = a;
+        pool->num_free++;
+        a = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(a); // Oversized for one long line, or the free list is full
+}
+
+// Function to get an empty arena with room for need bytes, from the free list if one fits
+static Arena *arena_take(ArenaPool *pool, size_t need) {
+    Arena *a = NULL;
+    if (need <= pool->arena_size) {
+        pthread_mutex_lock(&pool->lock);
+        if ((a = pool->free) != NULL) {
+            pool->free = a->next;
+            pool->num_free--;
+            pool->reused++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (!a) {
+        size_t size = need > pool->arena_size ? need : pool->arena_size;
+        a = malloc(sizeof(Arena) + size);
+        if (!a) fatal("malloc");
+        a->pool = pool;
+        a->size = size;
+        pool->allocated++;
+    }
+    a->used = 0;
+    atomic_store_explicit(&a->refs, 1, memory_order_relaxed); // The producer's reference
+    return a;
+}
+
+// Function to copy a line into the current arena, starting a new one when it
+// is full. The slot is valid until it is passed to arena_release.
+LineSlot *arena_add_line(ArenaPool *pool, const char *line, size_t len) {
+    size_t need = SLOT_SPACE + (len + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+    Arena *a = pool->current;
+    if (!a || a->used + need > a->size) {
+        if (a)
+            arena_unref(a);
+        a = pool->current = arena_take(pool, need);
+    }
+
+    char *base = (char *)a->data + a->used;
+    LineSlot *slot = (LineSlot *)base;
+    memcpy(base + SLOT_SPACE, line, len);
+    slot->line = base + SLOT_SPACE;
+    slot->len = len;
+    slot->arena = a;
+    a->used += need;
+    atomic_fetch_add_explicit(&a->refs, 1, memory_order_relaxed); // Published by the buffer push
+    return slot;
+}
+
+// Function to release a consumed line
+void arena_release(LineSlot *slot) {
+    arena_unref(slot->arena);
+}
+
+// Function to free the arenas once every line has been released
+void arena_pool_destroy(ArenaPool *pool) {
+    if (pool->current) {
+        Arena *a = pool->current;
+        pool->current = NULL;
+        arena_unref(a);
+    }
+    while (pool->free) {
+        Arena *a = pool->free;
+        pool->free = a->next;
+        free(a);
+    }
+    pool->num_free = 0;
+    pthread_mutex_destroy(&pool->lock);
+}
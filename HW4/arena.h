@@ -0,0 +1,47 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Block of line storage filled by the producer. Every line in it holds a
+// reference, and so does the producer while it fills it; the last release
+// hands the block back to its pool.
+typedef struct Arena {
+    struct Arena *next; // Free list link
+    struct ArenaPool *pool;
+    atomic_size_t refs;
+    size_t size; // Bytes of data
+    size_t used;
+    max_align_t data[]; // Slots, each followed by its line
+} Arena;
+
+// View of one line stored in an arena, pushed through the buffer in place of
+// a line copy. The line is not NUL terminated.
+typedef struct {
+    const char *line;
+    size_t len;
+    Arena *arena;
+} LineSlot;
+
+// Arenas of one producer. Released arenas wait on the free list, up to
+// max_free of them, so a steady stream of lines reuses the same few blocks.
+typedef struct ArenaPool {
+    pthread_mutex_t lock; // Guards the free list, releases come from the workers
+    Arena *free;
+    size_t num_free;
+    size_t max_free;
+    size_t arena_size;
+    Arena *current; // Arena being filled, producer only
+    size_t allocated; // Arenas malloc'ed
+    size_t reused; // Arenas taken from the free list
+} ArenaPool;
+
+// Function prototypes
+void arena_pool_init(ArenaPool *pool, size_t arena_size, size_t max_free);
+void arena_pool_destroy(ArenaPool *pool);
+LineSlot *arena_add_line(ArenaPool *pool, const char *line, size_t len);
+void arena_release(LineSlot *slot);
+
+#endif /* ARENA_H */
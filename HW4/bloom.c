@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bloom.h"
+#include "exitcode.h"
+#include "logindex.h"
+
+#define BLOOM_MAGIC "LABLM01" // Bumped whenever the on-disk layout or the hashing changes
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to build the sidecar filter path
+static char *bloom_path(const char *log_path) {
+    char *path = malloc(strlen(log_path) + sizeof(BLOOM_SUFFIX));
+    if (!path) fatal("malloc");
+    strcpy(path, log_path);
+    strcat(path, BLOOM_SUFFIX);
+    return path;
+}
+
+// Function to write all bytes at an offset
+static int pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Function to fold an ASCII letter to lower case
+static inline unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Function to get the filter bits of a trigram, three folded bytes packed
+// into 24 bits. One multiplication yields all of them.
+static inline void trigram_bits(uint32_t trigram, uint32_t bits[BLOOM_HASHES]) {
+    uint64_t h = (trigram + 1) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+    for (int k = 0; k < BLOOM_HASHES; ++k)
+        bits[k] = (uint32_t)(h >> (k * 21)) & (BLOOM_FILTER_BITS - 1);
+}
+
+// Function to fill the filter of the lines in [offset, offset + length),
+// trigrams never span a newline
+static void build_block(BloomBlock *block, const char *log_map, size_t offset, size_t length) {
+    const unsigned char *p = (const unsigned char *)log_map + offset;
+    uint32_t window = 0;
+    size_t run = 0; // Bytes of the current line in the window
+
+    memset(block, 0, sizeof(*block));
+    block->offset = offset;
+    block->length = length;
+    for (size_t i = 0; i < length; ++i) {
+        if (p[i] == '\n') {
+            run = 0;
+            continue;
+        }
+        window = ((window << 8) | fold(p[i])) & 0xFFFFFF;
+        if (++run < 3)
+            continue;
+        uint32_t bits[BLOOM_HASHES];
+        trigram_bits(window, bits);
+        for (int k = 0; k < BLOOM_HASHES; ++k)
+            block->bits[bits[k] / 64] |= 1ULL << (bits[k] % 64);
+    }
+}
+
+// Function to check whether a filter file header is consistent with the log and its own size
+static int header_valid(const BloomHeader *hdr, off_t file_size, const char *log_map, size_t log_size) {
+    if (memcmp(hdr->magic, BLOOM_MAGIC, sizeof(BLOOM_MAGIC)) != 0 || hdr->block_size != BLOOM_BLOCK_SIZE ||
+        hdr->filter_bits != BLOOM_FILTER_BITS)
+        return 0;
+    if ((uint64_t)file_size != sizeof(BloomHeader) + hdr->num_blocks * sizeof(BloomBlock))
+        return 0;
+    if (hdr->indexed_size > log_size || (hdr->indexed_size > 0 && log_map[hdr->indexed_size - 1] != '\n'))
+        return 0;
+    return hdr->head_hash == log_head_hash(log_map, hdr->indexed_size);
+}
+
+// Function to copy len bytes at offset from one file to the same offset of another
+static int copy_all(int in_fd, int out_fd, off_t offset, size_t len) {
+    loff_t in_off = offset, out_off = offset;
+    while (len > 0) {
+        ssize_t n = copy_file_range(in_fd, &in_off, out_fd, &out_off, len, 0);
+        if (n <= 0)
+            return -1;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Function to create or extend the sidecar filters of a mapped log. Full
+// blocks are kept, the short block at the end and the lines added since the
+// last run are hashed; a log that was truncated or replaced is hashed from
+// scratch. The filters are written to a temporary file renamed over the old
+// one, so mappings of the old file stay consistent. Returns -1 if the
+// filters cannot be written.
+int bloom_update(const char *log_path, const char *log_map, size_t log_size, int verbose) {
+    // Only complete lines are covered
+    const char *last_nl = log_size ? memrchr(log_map, '\n', log_size) : NULL;
+    size_t indexable = last_nl ? (size_t)(last_nl - log_map) + 1 : 0;
+
+    char *path = bloom_path(log_path);
+    struct stat st;
+    BloomHeader hdr;
+    int old_fd = open(path, O_RDONLY);
+    int valid = old_fd != -1 && fstat(old_fd, &st) == 0 && st.st_size >= (off_t)sizeof(hdr) &&
+                pread(old_fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+                header_valid(&hdr, st.st_size, log_map, indexable);
+    if (valid && hdr.indexed_size == indexable) {
+        close(old_fd);
+        free(path);
+        return 0;
+    }
+    if (!valid) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, BLOOM_MAGIC, sizeof(BLOOM_MAGIC));
+        hdr.block_size = BLOOM_BLOCK_SIZE;
+        hdr.filter_bits = BLOOM_FILTER_BITS;
+    }
+
+    char *tmp_path = malloc(strlen(path) + sizeof(".XXXXXX"));
+    if (!tmp_path) fatal("malloc");
+    strcpy(tmp_path, path);
+    strcat(tmp_path, ".XXXXXX");
+    int fd = mkstemp(tmp_path);
+    if (fd == -1 || fchmod(fd, 0644) == -1) {
+        perror(tmp_path);
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        if (old_fd != -1)
+            close(old_fd);
+        free(tmp_path);
+        free(path);
+        return -1;
+    }
+
+    BloomBlock *block = malloc(sizeof(BloomBlock));
+    if (!block) fatal("malloc");
+    size_t num_blocks = hdr.num_blocks;
+    size_t offset = hdr.indexed_size;
+    if (num_blocks > 0) { // A short last block ended with the log, it is rebuilt with the new lines
+        uint64_t range[2];
+        off_t at = sizeof(BloomHeader) + (num_blocks - 1) * sizeof(BloomBlock);
+        if (pread(old_fd, range, sizeof(range), at) != (ssize_t)sizeof(range)) fatal("pread");
+        if (range[1] < BLOOM_BLOCK_SIZE) {
+            num_blocks--;
+            offset = range[0];
+        }
+    }
+    int failed = num_blocks > 0 && copy_all(old_fd, fd, sizeof(BloomHeader), num_blocks * sizeof(BloomBlock)) == -1;
+    if (old_fd != -1)
+        close(old_fd);
+
+    size_t before = num_blocks;
+    while (offset < indexable && !failed) {
+        size_t cut = offset + BLOOM_BLOCK_SIZE;
+        if (cut >= indexable) {
+            cut = indexable;
+        } else { // Extend the block up to the end of the line it cuts
+            const char *nl = memchr(log_map + cut - 1, '\n', indexable - cut + 1);
+            cut = (size_t)(nl - log_map) + 1;
+        }
+        build_block(block, log_map, offset, cut - offset);
+        failed = pwrite_all(fd, block, sizeof(BloomBlock), sizeof(BloomHeader) + num_blocks * sizeof(BloomBlock)) == -1;
+        num_blocks++;
+        offset = cut;
+    }
+
+    // The complete file replaces the old filters
+    hdr.num_blocks = num_blocks;
+    hdr.indexed_size = indexable;
+    hdr.head_hash = log_head_hash(log_map, indexable);
+    if (failed || pwrite_all(fd, &hdr, sizeof(hdr), 0) == -1 || rename(tmp_path, path) == -1) {
+        perror(tmp_path);
+        unlink(tmp_path);
+        failed = 1;
+    } else if (verbose) {
+        fprintf(stderr, "Bloom filters %s: %s %zu blocks\n", path, before ? "extended by" : "built with",
+                num_blocks - before);
+    }
+
+    free(block);
+    close(fd);
+    free(tmp_path);
+    free(path);
+    return failed ? -1 : 0;
+}
+
+// Function to map the sidecar filters of a log read-only. Returns -1 if
+// there are none or they belong to an earlier version of the file. The
+// header is copied, the mapping only provides the blocks it describes.
+int bloom_open(BloomIndex *bi, const char *log_path, const char *log_map, size_t log_size) {
+    char *path = bloom_path(log_path);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(BloomHeader)) {
+        close(fd);
+        return -1;
+    }
+    bi->map_size = (size_t)st.st_size;
+    bi->map = mmap(NULL, bi->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (bi->map == MAP_FAILED)
+        return -1;
+
+    memcpy(&bi->hdr, bi->map, sizeof(BloomHeader));
+    bi->blocks = (const BloomBlock *)((const BloomHeader *)bi->map + 1);
+    if (!header_valid(&bi->hdr, st.st_size, log_map, log_size)) {
+        munmap(bi->map, bi->map_size);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to unmap the filters
+void bloom_close(BloomIndex *bi) {
+    munmap(bi->map, bi->map_size);
+}
+
+// Function to start an empty query
+void bloom_query_init(BloomQuery *q) {
+    q->probes = NULL;
+    q->ends = NULL;
+    q->num_probes = 0;
+    q->num_terms = 0;
+}
+
+// Function to add a term a matching line contains, any of the terms of a
+// query may match. Returns -1 for a term of fewer than three bytes, which
+// rules no block out.
+int bloom_query_add(BloomQuery *q, const char *term, size_t len) {
+    if (len < 3)
+        return -1;
+    q->probes = realloc(q->probes, (q->num_probes + (len - 2) * BLOOM_HASHES) * sizeof(uint32_t));
+    q->ends = realloc(q->ends, (q->num_terms + 1) * sizeof(size_t));
+    if (!q->probes || !q->ends) fatal("realloc");
+
+    const unsigned char *p = (const unsigned char *)term;
+    for (size_t i = 0; i + 2 < len; ++i) {
+        uint32_t trigram = (uint32_t)fold(p[i]) << 16 | (uint32_t)fold(p[i + 1]) << 8 | fold(p[i + 2]);
+        trigram_bits(trigram, &q->probes[q->num_probes]);
+        q->num_probes += BLOOM_HASHES;
+    }
+    q->ends[q->num_terms++] = q->num_probes;
+    return 0;
+}
+
+// Function to free the probes of a query
+void bloom_query_free(BloomQuery *q) {
+    free(q->probes);
+    free(q->ends);
+    bloom_query_init(q);
+}
+
+// Function to check whether one filter has every bit of some term set
+static int block_may_contain(const BloomBlock *block, const BloomQuery *q) {
+    size_t start = 0;
+    for (size_t t = 0; t < q->num_terms; ++t) {
+        size_t p = start;
+        while (p < q->ends[t] && (block->bits[q->probes[p] / 64] >> (q->probes[p] % 64) & 1))
+            p++;
+        if (p == q->ends[t])
+            return 1;
+        start = q->ends[t];
+    }
+    return 0;
+}
+
+// Function to check whether the line-aligned range [offset, offset + length)
+// of the log may hold a line matching the query. Every line lies within one
+// block, so the range is ruled out only if all blocks it overlaps are; the
+// part of the log past the filters may always match.
+int bloom_may_contain(const BloomIndex *bi, const BloomQuery *q, size_t offset, size_t length) {
+    size_t end = offset + length;
+    if (end > bi->hdr.indexed_size)
+        return 1;
+
+    // First block ending after offset
+    size_t lo = 0, hi = bi->hdr.num_blocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (bi->blocks[mid].offset + bi->blocks[mid].length <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (size_t b = lo; b < bi->hdr.num_blocks && bi->blocks[b].offset < end; ++b)
+        if (block_may_contain(&bi->blocks[b], q))
+            return 1;
+    return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOOM_SUFFIX ".bloom" // Sidecar filter path is the log path plus this suffix
+#define BLOOM_BLOCK_SIZE (1UL << 20) // Log bytes summarized by one filter, extended to the end of a line
+#define BLOOM_FILTER_BITS (1UL << 19) // Bits of one filter, a power of two
+#define BLOOM_HASHES 3 // Bits set per trigram
+
+// Filter file header, followed by num_blocks blocks
+typedef struct {
+    char magic[8];
+    uint64_t indexed_size; // Bytes of the log covered, always ends after a newline
+    uint64_t num_blocks;
+    uint64_t head_hash; // Hash of the first bytes of the log, detects rotation
+    uint32_t block_size;
+    uint32_t filter_bits;
+} BloomHeader;
+
+// Bloom filter of the trigrams of the lines in [offset, offset + length),
+// with ASCII letters folded to lower case. A block shorter than
+// BLOOM_BLOCK_SIZE ended with the log and is rebuilt when the log grows.
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t bits[BLOOM_FILTER_BITS / 64];
+} BloomBlock;
+
+// Read-only view of a mapped filter file
+typedef struct {
+    void *map;
+    size_t map_size;
+    BloomHeader hdr; // Copied when the filters are opened
+    const BloomBlock *blocks;
+} BloomIndex;
+
+// Filter bits every term of a search sets in the filter of a block holding
+// it, a block may hold a match if all bits of at least one term are set
+typedef struct {
+    uint32_t *probes; // BLOOM_HASHES bit positions per trigram, the terms one after another
+    size_t *ends; // End of each term's probes
+    size_t num_probes;
+    size_t num_terms;
+} BloomQuery;
+
+// Function prototypes
+int bloom_update(const char *log_path, const char *log_map, size_t log_size, int verbose);
+int bloom_open(BloomIndex *bi, const char *log_path, const char *log_map, size_t log_size);
+void bloom_close(BloomIndex *bi);
+void bloom_query_init(BloomQuery *q);
+int bloom_query_add(BloomQuery *q, const char *term, size_t len);
+void bloom_query_free(BloomQuery *q);
+int bloom_may_contain(const BloomIndex *bi, const BloomQuery *q, size_t offset, size_t length);
+
+#endif /* BLOOM_H */
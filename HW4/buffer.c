@@ -1,37 +1,160 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "buffer.h"
+#include "exitcode.h"
+
+#define ADAPT_WINDOW 64 // Push and pop calls between adaptive resize decisions
 
 // Function to handle fatal errors
 static void fatal(const char *msg) {
     perror(msg); // Print the error message
-    exit(EXIT_FAILURE); // Exit the program with failure status
+    exit(EXIT_ERROR);
 }
 
 // Function to initialize the buffer
 void buffer_init(Buffer *buf, size_t size) {
-    buf->data = calloc(size, sizeof(char *));
+    buf->data = calloc(size, sizeof(void *));
     if (!buf->data) fatal("calloc");
     buf->size = size;
     buf->head = buf->tail = buf->count = 0;
     buf->terminating = 0;
+    buf->lf = NULL;
+    memset(&buf->stats, 0, sizeof(buf->stats));
+    buf->stats.peak_size = size;
+    buf->window = buf->stats;
+    buf->adaptive = 0;
+    buf->min_size = buf->max_size = size;
     // Initialize mutex and condition variables
     if (pthread_mutex_init(&buf->mutex, NULL)) fatal("pthread_mutex_init");
     if (pthread_cond_init(&buf->space_available, NULL)) fatal("pthread_cond_init");
     if (pthread_cond_init(&buf->items_available, NULL)) fatal("pthread_cond_init");
 }
 
+// Function to initialize the buffer on top of the lock-free SPMC ring.
+// Only one thread may push, any number of threads may pop.
+void buffer_init_lockfree(Buffer *buf, size_t size) {
+    buffer_init(buf, 1); // Keeps mutex based callers such as buffer_terminate valid
+    buf->size = size;
+    buf->stats.peak_size = size;
+    buf->lf = lfring_create(size);
+}
+
+// Function to let the mutex ring grow and shrink between min_size and
+// max_size as the wait counters show. Returns -1 for the lock-free ring,
+// whose slots cannot move while other threads hold positions in them.
+int buffer_set_adaptive(Buffer *buf, size_t min_size, size_t max_size) {
+    if (buf->lf)
+        return -1;
+    pthread_mutex_lock(&buf->mutex);
+    buf->adaptive = 1;
+    buf->min_size = min_size < 1 ? 1 : min_size;
+    buf->max_size = max_size < buf->size ? buf->size : max_size;
+    pthread_mutex_unlock(&buf->mutex);
+    return 0;
+}
+
+// Function to move the items into a ring of a new size, called with the mutex held
+static void resize(Buffer *buf, size_t size) {
+    void **data = malloc(size * sizeof(void *));
+    if (!data) fatal("malloc");
+    for (size_t i = 0; i < buf->count; ++i)
+        data[i] = buf->data[(buf->head + i) % buf->size];
+    free(buf->data);
+    buf->data = data;
+    buf->size = size;
+    buf->head = 0;
+    buf->tail = buf->count % size;
+    if (size > buf->stats.peak_size)
+        buf->stats.peak_size = size;
+}
+
+// Function to resize an adaptive ring from the counters of the last window.
+// When both sides stalled the load is bursty and more slack lets them overlap,
+// so the ring doubles. When the producer never stalled and the ring stayed
+// under a quarter full it is oversized and halves. When only the producer
+// stalls the workers are saturated and a larger ring would only hold more
+// waiting items, so the size is kept. Called with the mutex held.
+static void adapt(Buffer *buf) {
+    BufferStats *s = &buf->stats, *w = &buf->window;
+    size_t producer_waits = s->producer_waits - w->producer_waits;
+    size_t consumer_waits = s->consumer_waits - w->consumer_waits;
+    size_t occupancy = s->occupancy_sum - w->occupancy_sum;
+    size_t capacity = s->size_sum - w->size_sum;
+
+    if (producer_waits > 0 && consumer_waits > 0 && buf->size < buf->max_size) {
+        resize(buf, buf->size * 2 < buf->max_size ? buf->size * 2 : buf->max_size);
+        s->grows++;
+        pthread_cond_broadcast(&buf->space_available);
+    } else if (producer_waits == 0 && occupancy * 4 < capacity && buf->size > buf->min_size) {
+        size_t size = buf->size / 2 > buf->min_size ? buf->size / 2 : buf->min_size;
+        if (size < buf->count)
+            size = buf->count;
+        if (size < buf->size) {
+            resize(buf, size);
+            s->shrinks++;
+        }
+    }
+    *w = *s;
+}
+
+// Function to record the occupancy seen by a push or pop call and let an
+// adaptive ring decide once per window, called with the mutex held
+static void sample(Buffer *buf) {
+    buf->stats.occupancy_sum += buf->count;
+    buf->stats.size_sum += buf->size;
+    buf->stats.samples++;
+    if (buf->adaptive && buf->stats.samples % ADAPT_WINDOW == 0)
+        adapt(buf);
+}
+
+// Function to signal termination and wake up every blocked producer and consumer
+void buffer_terminate(Buffer *buf) {
+    pthread_mutex_lock(&buf->mutex);
+    buf->terminating = 1;
+    pthread_cond_broadcast(&buf->items_available);
+    pthread_cond_broadcast(&buf->space_available);
+    pthread_mutex_unlock(&buf->mutex);
+    if (buf->lf)
+        lfring_terminate(buf->lf);
+}
+
 // Function to destroy the buffer
 void buffer_destroy(Buffer *buf) {
+    if (buf->lf)
+        lfring_destroy(buf->lf);
     free(buf->data);
     pthread_mutex_destroy(&buf->mutex);
     pthread_cond_destroy(&buf->space_available);
     pthread_cond_destroy(&buf->items_available);
 }
 
+// Function to get the counters of the buffer, call once the threads using it are joined
+void buffer_stats(Buffer *buf, BufferStats *stats) {
+    pthread_mutex_lock(&buf->mutex);
+    *stats = buf->stats;
+    pthread_mutex_unlock(&buf->mutex);
+    if (buf->lf) {
+        stats->pushes = buf->lf->pushes;
+        stats->producer_waits = buf->lf->producer_waits;
+        stats->consumer_waits = atomic_load(&buf->lf->consumer_waits);
+        stats->occupancy_sum = buf->lf->occupancy_sum;
+        stats->samples = buf->lf->samples;
+        stats->size_sum = buf->lf->samples * buf->size;
+    }
+}
+
 // Function to push an item onto the buffer
-void buffer_push(Buffer *buf, char *item) {
+void buffer_push(Buffer *buf, void *item) {
+    if (buf->lf) {
+        lfring_push(buf->lf, item);
+        return;
+    }
+
     pthread_mutex_lock(&buf->mutex);
+    sample(buf);
+    if (buf->count == buf->size && !buf->terminating)
+        buf->stats.producer_waits++;
     while (buf->count == buf->size && !buf->terminating) { // Wait until the buffer is not full
         pthread_cond_wait(&buf->space_available, &buf->mutex);
     }
@@ -44,14 +167,23 @@ void buffer_push(Buffer *buf, char *item) {
     buf->data[buf->tail] = item;
     buf->tail = (buf->tail + 1) % buf->size;
     buf->count++;
+    buf->stats.pushes++;
 
     pthread_cond_signal(&buf->items_available);
     pthread_mutex_unlock(&buf->mutex);
 }
 
 // Function to pop an item from the buffer
-char *buffer_pop(Buffer *buf) {
+void *buffer_pop(Buffer *buf) {
+    if (buf->lf) {
+        void *item;
+        return lfring_pop(buf->lf, &item) ? item : NULL;
+    }
+
     pthread_mutex_lock(&buf->mutex);
+    sample(buf);
+    if (buf->count == 0 && !buf->terminating)
+        buf->stats.consumer_waits++;
     while (buf->count == 0 && !buf->terminating) {
         pthread_cond_wait(&buf->items_available, &buf->mutex);
     }
@@ -61,11 +193,93 @@ char *buffer_pop(Buffer *buf) {
         return NULL;
     }
 
-    char *item = buf->data[buf->head];
+    void *item = buf->data[buf->head];
     buf->head = (buf->head + 1) % buf->size;
     buf->count--;
 
     pthread_cond_signal(&buf->space_available);
     pthread_mutex_unlock(&buf->mutex);
     return item;
-}
\ No newline at end of file
+}
+
+// Function to push up to n items, taking the mutex once per run of free slots.
+// Consumers only wait on an empty ring, so they are woken only when the ring
+// leaves the empty state. Returns the number of items pushed, which is less
+// than n only if the buffer is terminating.
+size_t buffer_push_batch(Buffer *buf, void **items, size_t n) {
+    size_t pushed = 0;
+
+    if (buf->lf) {
+        while (pushed < n && lfring_push(buf->lf, items[pushed]) == 0)
+            pushed++;
+        return pushed;
+    }
+
+    pthread_mutex_lock(&buf->mutex);
+    sample(buf);
+    while (pushed < n) {
+        if (buf->count == buf->size && !buf->terminating)
+            buf->stats.producer_waits++;
+        while (buf->count == buf->size && !buf->terminating) { // Wait until the buffer is not full
+            pthread_cond_wait(&buf->space_available, &buf->mutex);
+        }
+
+        if (buf->terminating)
+            break;
+
+        int was_empty = buf->count == 0;
+        while (pushed < n && buf->count < buf->size) {
+            buf->data[buf->tail] = items[pushed++];
+            buf->tail = (buf->tail + 1) % buf->size;
+            buf->count++;
+            buf->stats.pushes++;
+        }
+
+        if (was_empty)
+            pthread_cond_broadcast(&buf->items_available);
+    }
+    pthread_mutex_unlock(&buf->mutex);
+    return pushed;
+}
+
+// Function to pop up to max items with a single lock acquisition.
+// A NULL sentinel ends the batch so every worker still receives its own one.
+// The producer only waits on a full ring, so it is woken only when the ring
+// leaves the full state. Returns 0 once the buffer is terminating and empty.
+size_t buffer_pop_batch(Buffer *buf, void **items, size_t max) {
+    size_t popped = 0;
+
+    if (buf->lf) { // Block for the first item only, then take what is already there
+        if (!lfring_pop(buf->lf, &items[popped]))
+            return 0;
+        if (items[popped++] == NULL)
+            return popped;
+        while (popped < max && lfring_try_pop(buf->lf, &items[popped]))
+            if (items[popped++] == NULL)
+                break;
+        return popped;
+    }
+
+    pthread_mutex_lock(&buf->mutex);
+    sample(buf);
+    if (buf->count == 0 && !buf->terminating)
+        buf->stats.consumer_waits++;
+    while (buf->count == 0 && !buf->terminating) {
+        pthread_cond_wait(&buf->items_available, &buf->mutex);
+    }
+
+    int was_full = buf->count == buf->size;
+    while (popped < max && buf->count > 0) {
+        void *item = buf->data[buf->head];
+        buf->head = (buf->head + 1) % buf->size;
+        buf->count--;
+        items[popped++] = item;
+        if (item == NULL)
+            break;
+    }
+
+    if (was_full && popped > 0)
+        pthread_cond_broadcast(&buf->space_available);
+    pthread_mutex_unlock(&buf->mutex);
+    return popped;
+}
@@ -3,9 +3,26 @@
 
 #include <pthread.h>
 #include <stddef.h>
+#include "lfring.h"
 
+// Counters kept by a buffer, read with buffer_stats once the threads are joined
 typedef struct {
-    char **data; // Pointer to the buffer data
+    size_t pushes; // Items pushed
+    size_t producer_waits; // Times a producer blocked on a full buffer
+    size_t consumer_waits; // Times a consumer blocked on an empty buffer
+    size_t occupancy_sum; // Sum of the item counts seen by the sampled push and pop calls
+    size_t size_sum; // Sum of the ring sizes at the same samples
+    size_t samples; // Number of sampled calls
+    size_t grows; // Adaptive resizes up
+    size_t shrinks; // Adaptive resizes down
+    size_t peak_size; // Largest ring size reached
+} BufferStats;
+
+// Items are opaque pointers: text chunks in streaming mode, arena line
+// slots when following a file, chunk descriptors in mmap mode. NULL is
+// reserved as the termination sentinel.
+typedef struct {
+    void **data; // Pointer to the buffer data
     size_t size; // Size of the buffer
     size_t head; // Index of the head of the buffer
     size_t tail; // Index of the tail of the buffer
@@ -14,12 +31,24 @@ typedef struct {
     pthread_cond_t space_available;  // Condition variable for signaling when buffer has space
     pthread_cond_t items_available;  // Condition variable for signaling when buffer has items
     int terminating; // Flag to signal termination
+    LfRing *lf; // Lock-free ring backing the buffer, NULL for the mutex ring
+    BufferStats stats; // Counters of the mutex ring, updated under the mutex
+    BufferStats window; // Counters at the start of the current adaptive window
+    int adaptive; // Resize the mutex ring between min_size and max_size
+    size_t min_size;
+    size_t max_size;
 } Buffer;
 
 // Function prototypes
 void buffer_init(Buffer *buf, size_t size);
+void buffer_init_lockfree(Buffer *buf, size_t size);
+int buffer_set_adaptive(Buffer *buf, size_t min_size, size_t max_size);
+void buffer_terminate(Buffer *buf);
 void buffer_destroy(Buffer *buf);
-void buffer_push(Buffer *buf, char *item);
-char *buffer_pop(Buffer *buf);
+void buffer_push(Buffer *buf, void *item);
+void *buffer_pop(Buffer *buf);
+size_t buffer_push_batch(Buffer *buf, void **items, size_t n);
+size_t buffer_pop_batch(Buffer *buf, void **items, size_t max);
+void buffer_stats(Buffer *buf, BufferStats *stats);
 
 #endif /* BUFFER_H */
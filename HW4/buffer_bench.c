@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "buffer.h"
+
+// Contention benchmark: one producer, 1 to 64 consumers, mutex vs lock-free buffer
+
+#define DEFAULT_ITEMS 2000000UL
+#define DEFAULT_BUFFER_SIZE 1024UL
+
+typedef struct {
+    Buffer *buf;
+    size_t batch; // Items per pop, 1 uses buffer_pop
+    size_t consumed;
+} ConsumerData;
+
+// Function to get the current monotonic time in seconds
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Consumer thread routine, pops until its sentinel arrives
+static void *consumer(void *arg) {
+    ConsumerData *cd = arg;
+    void *items[64];
+    size_t local = 0;
+
+    for (;;) {
+        if (cd->batch == 1) {
+            if (buffer_pop(cd->buf) == NULL)
+                break;
+            local++;
+            continue;
+        }
+        size_t n = buffer_pop_batch(cd->buf, items, cd->batch);
+        if (n == 0 || items[n - 1] == NULL) {
+            local += n ? n - 1 : 0;
+            break;
+        }
+        local += n;
+    }
+    cd->consumed = local;
+    return NULL;
+}
+
+// Function to run one configuration and return the throughput in items per second
+static double run(int lockfree, size_t workers, size_t items, size_t buffer_size, size_t batch) {
+    Buffer buf;
+    if (lockfree)
+        buffer_init_lockfree(&buf, buffer_size);
+    else
+        buffer_init(&buf, buffer_size);
+
+    pthread_t *threads = malloc(sizeof(pthread_t) * workers);
+    ConsumerData *data = malloc(sizeof(ConsumerData) * workers);
+    if (!threads || !data) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now();
+    for (size_t i = 0; i < workers; ++i) {
+        data[i].buf = &buf;
+        data[i].batch = batch;
+        data[i].consumed = 0;
+        pthread_create(&threads[i], NULL, consumer, &data[i]);
+    }
+
+    void *chunk[64];
+    for (size_t i = 0; i < items;) {
+        size_t n = 0;
+        while (n < batch && i < items)
+            chunk[n++] = (void *)(uintptr_t)(++i);
+        if (batch == 1)
+            buffer_push(&buf, chunk[0]);
+        else
+            buffer_push_batch(&buf, chunk, n);
+    }
+    for (size_t i = 0; i < workers; ++i)
+        buffer_push(&buf, NULL);
+
+    size_t total = 0;
+    for (size_t i = 0; i < workers; ++i) {
+        pthread_join(threads[i], NULL);
+        total += data[i].consumed;
+    }
+    double elapsed = now() - start;
+
+    if (total != items)
+        fprintf(stderr, "lost items: %zu of %zu consumed\n", total, items);
+
+    buffer_destroy(&buf);
+    free(threads);
+    free(data);
+    return items / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    size_t items = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITEMS;
+    size_t buffer_size = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_BUFFER_SIZE;
+    size_t batch = argc > 3 ? strtoul(argv[3], NULL, 10) : 1;
+    if (items == 0 || buffer_size == 0 || batch == 0 || batch > 64) {
+        fprintf(stderr, "Usage: %s [items] [buffer_size] [batch(1-64)]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu items, buffer_size %zu, batch %zu\n", items, buffer_size, batch);
+    printf("%8s %16s %16s %8s\n", "workers", "mutex items/s", "lockfree items/s", "ratio");
+    for (size_t workers = 1; workers <= 64; workers *= 2) {
+        double mutex = run(0, workers, items, buffer_size, batch);
+        double lockfree = run(1, workers, items, buffer_size, batch);
+        printf("%8zu %16.0f %16.0f %7.2fx\n", workers, mutex, lockfree, lockfree / mutex);
+    }
+    return 0;
+}
@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "codec.h"
+#include "exitcode.h"
+
+#define GZIP_MIN_MEMBER 18 // 10 byte header and 8 byte trailer
+#define INFLATE_SLICE (1U << 30) // zlib counts input in unsigned ints, feed it at most this much at once
+#define ZSTD_MAGIC 0xFD2FB528u
+#define ZSTD_SKIPPABLE_MASK 0xFFFFFFF0u
+#define ZSTD_SKIPPABLE_MAGIC 0x184D2A50u
+
+// Sequential decompressor state
+struct Decoder {
+    CodecFormat fmt;
+    const char *data; // Whole compressed input
+    size_t size;
+    size_t pos; // Next compressed byte not yet handed to the library
+    int finished; // Last member or frame fully decoded
+    z_stream zs;
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zds;
+    size_t zstd_hint; // Last ZSTD_decompressStream result, 0 at a frame boundary
+#endif
+};
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to read a little endian 32 bit value
+static uint32_t le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Function to get the total size of the BGZF block at p from its BC extra
+// subfield, 0 if p does not start a well formed BGZF block
+static size_t bgzf_block_size(const unsigned char *p, size_t avail) {
+    if (avail < GZIP_MIN_MEMBER || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4))
+        return 0;
+    size_t xlen = p[10] | (size_t)p[11] << 8;
+    if (12 + xlen > avail)
+        return 0;
+
+    for (size_t i = 12; i + 4 <= 12 + xlen;) {
+        size_t slen = p[i + 2] | (size_t)p[i + 3] << 8;
+        if (p[i] == 'B' && p[i + 1] == 'C' && slen == 2 && i + 6 <= 12 + xlen) {
+            size_t bsize = (p[i + 4] | (size_t)p[i + 5] << 8) + 1;
+            return bsize >= 12 + xlen + 8 && bsize <= avail ? bsize : 0;
+        }
+        i += 4 + slen;
+    }
+    return 0;
+}
+
+// Function to detect the compression format from the magic bytes
+CodecFormat codec_detect(const char *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data;
+    if (size >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+        return bgzf_block_size(p, size) ? CODEC_BGZF : CODEC_GZIP;
+    if (size >= 4 && (le32(p) == ZSTD_MAGIC || (le32(p) & ZSTD_SKIPPABLE_MASK) == ZSTD_SKIPPABLE_MAGIC))
+        return CODEC_ZSTD;
+    return CODEC_NONE;
+}
+
+// Function to get the printable name of a format
+const char *codec_name(CodecFormat fmt) {
+    static const char *names[] = { "plain", "gzip", "bgzf", "zstd" };
+    return names[fmt];
+}
+
+// Function to append a block to a growing array
+static void add_block(CodecBlock **blocks, size_t *n, size_t *cap, size_t offset, size_t length, size_t raw_size) {
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        *blocks = realloc(*blocks, *cap * sizeof(CodecBlock));
+        if (!*blocks) fatal("realloc");
+    }
+    memset(&(*blocks)[*n], 0, sizeof(CodecBlock));
+    (*blocks)[*n].offset = offset;
+    (*blocks)[*n].length = length;
+    (*blocks)[*n].raw_size = raw_size;
+    (*n)++;
+}
+
+// Function to split a BGZF file or multi-frame zstd file into independently
+// decompressible blocks. Returns 0 if the input has to be decoded sequentially.
+size_t codec_blocks(CodecFormat fmt, const char *data, size_t size, CodecBlock **blocks) {
+    const unsigned char *p = (const unsigned char *)data;
+    size_t n = 0, cap = 0;
+    size_t pos = 0;
+    *blocks = NULL;
+
+    if (fmt == CODEC_BGZF) {
+        while (pos < size) {
+            size_t bsize = bgzf_block_size(p + pos, size - pos);
+            if (bsize == 0) { // A plain gzip member follows, fall back to sequential decoding
+                free(*blocks);
+                *blocks = NULL;
+                return 0;
+            }
+            add_block(blocks, &n, &cap, pos, bsize, le32(p + pos + bsize - 4));
+            pos += bsize;
+        }
+        return n;
+    }
+
+#ifdef HAVE_ZSTD
+    if (fmt == CODEC_ZSTD) {
+        while (pos < size) {
+            size_t fsize = ZSTD_findFrameCompressedSize(data + pos, size - pos);
+            if (ZSTD_isError(fsize)) { // Let the sequential decoder report the damage
+                free(*blocks);
+                *blocks = NULL;
+                return 0;
+            }
+            if (size - pos >= 4 && (le32(p + pos) & ZSTD_SKIPPABLE_MASK) != ZSTD_SKIPPABLE_MAGIC) {
+                unsigned long long raw = ZSTD_getFrameContentSize(data + pos, fsize);
+                add_block(blocks, &n, &cap, pos, fsize,
+                          raw == ZSTD_CONTENTSIZE_UNKNOWN || raw == ZSTD_CONTENTSIZE_ERROR ? 0 : (size_t)raw);
+            }
+            pos += fsize;
+        }
+        if (n > 1)
+            return n;
+        free(*blocks); // A single frame gains nothing from splitting, stream it instead
+        *blocks = NULL;
+        return 0;
+    }
+#endif
+
+    return 0;
+}
+
+// Function to make room for at least need bytes in a growing output buffer
+static char *reserve(char *out, size_t *cap, size_t need) {
+    if (need <= *cap)
+        return out;
+    while (*cap < need)
+        *cap = *cap ? *cap * 2 : 65536;
+    out = realloc(out, *cap);
+    if (!out) fatal("realloc");
+    return out;
+}
+
+// Function to inflate one complete gzip member
+static char *inflate_member(const char *src, size_t len, size_t hint, size_t *out_len) {
+    z_stream zs = { 0 };
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+        return NULL;
+
+    size_t cap = 0, have = 0;
+    char *out = reserve(NULL, &cap, hint + 1); // One spare byte so a full block still finds room
+    zs.next_in = (unsigned char *)src;
+    zs.avail_in = (unsigned)len;
+
+    int rc;
+    do {
+        out = reserve(out, &cap, have + 1);
+        size_t room = cap - have > UINT_MAX ? UINT_MAX : cap - have;
+        zs.next_out = (unsigned char *)out + have;
+        zs.avail_out = (unsigned)room;
+        rc = inflate(&zs, Z_NO_FLUSH);
+        have = (size_t)((char *)zs.next_out - out);
+        if (rc == Z_OK && zs.avail_out != 0)
+            rc = Z_DATA_ERROR; // Input ended inside the member
+    } while (rc == Z_OK);
+    inflateEnd(&zs);
+
+    if (rc != Z_STREAM_END) {
+        free(out);
+        return NULL;
+    }
+    *out_len = have;
+    return out;
+}
+
+// Function to decompress one block, returns a heap buffer or NULL if it is corrupt
+char *codec_block_decompress(const char *data, const CodecBlock *block, size_t *len) {
+    const char *src = data + block->offset;
+#ifdef HAVE_ZSTD
+    if (le32((const unsigned char *)src) == ZSTD_MAGIC) {
+        if (block->raw_size > 0) {
+            char *out = malloc(block->raw_size);
+            if (!out) fatal("malloc");
+            size_t rc = ZSTD_decompress(out, block->raw_size, src, block->length);
+            if (ZSTD_isError(rc)) {
+                free(out);
+                return NULL;
+            }
+            *len = rc;
+            return out;
+        }
+
+        // Frame without a content size, grow the output as it streams out
+        ZSTD_DStream *zds = ZSTD_createDStream();
+        if (!zds) fatal("ZSTD_createDStream");
+        size_t cap = 0;
+        char *out = reserve(NULL, &cap, ZSTD_DStreamOutSize());
+        ZSTD_inBuffer in = { src, block->length, 0 };
+        ZSTD_outBuffer o = { out, cap, 0 };
+        size_t rc;
+        do {
+            if (o.pos == o.size) {
+                out = reserve(out, &cap, cap + 1);
+                o.dst = out;
+                o.size = cap;
+            }
+            rc = ZSTD_decompressStream(zds, &o, &in);
+        } while (!ZSTD_isError(rc) && rc != 0 && (in.pos < in.size || o.pos == o.size));
+        ZSTD_freeDStream(zds);
+        if (ZSTD_isError(rc) || rc != 0) {
+            free(out);
+            return NULL;
+        }
+        *len = o.pos;
+        return out;
+    }
+#endif
+    return inflate_member(src, block->length, block->raw_size, len);
+}
+
+// Function to start decoding an input that cannot be split into blocks
+Decoder *decoder_open(CodecFormat fmt, const char *data, size_t size) {
+    Decoder *dec = calloc(1, sizeof(Decoder));
+    if (!dec) fatal("calloc");
+    dec->fmt = fmt;
+    dec->data = data;
+    dec->size = size;
+
+    if (fmt == CODEC_GZIP || fmt == CODEC_BGZF) {
+        if (inflateInit2(&dec->zs, 16 + MAX_WBITS) != Z_OK) {
+            fprintf(stderr, "inflateInit2 failed\n");
+            free(dec);
+            return NULL;
+        }
+        return dec;
+    }
+#ifdef HAVE_ZSTD
+    if (fmt == CODEC_ZSTD) {
+        dec->zds = ZSTD_createDStream();
+        if (!dec->zds) fatal("ZSTD_createDStream");
+        return dec;
+    }
+#endif
+    fprintf(stderr, "%s input is not supported by this build, rebuild with make ZSTD=1\n", codec_name(fmt));
+    free(dec);
+    return NULL;
+}
+
+// Function to inflate the next bytes of a gzip stream, members may be concatenated
+static ssize_t gzip_read(Decoder *dec, char *out, size_t cap) {
+    z_stream *zs = &dec->zs;
+    zs->next_out = (unsigned char *)out;
+    zs->avail_out = (unsigned)(cap > UINT_MAX ? UINT_MAX : cap);
+
+    while (zs->avail_out > 0 && !dec->finished) {
+        if (zs->avail_in == 0) {
+            if (dec->pos == dec->size) { // Input ended inside a member
+                if ((char *)zs->next_out == out)
+                    return -1;
+                break;
+            }
+            size_t n = dec->size - dec->pos < INFLATE_SLICE ? dec->size - dec->pos : INFLATE_SLICE;
+            zs->next_in = (unsigned char *)dec->data + dec->pos;
+            zs->avail_in = (unsigned)n;
+            dec->pos += n;
+        }
+
+        int rc = inflate(zs, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            if (zs->avail_in == 0 && dec->pos == dec->size)
+                dec->finished = 1;
+            else
+                inflateReset(zs); // Another member follows
+        } else if (rc != Z_OK) {
+            return -1;
+        }
+    }
+    return (char *)zs->next_out - out;
+}
+
+#ifdef HAVE_ZSTD
+// Function to decompress the next bytes of a zstd stream
+static ssize_t zstd_read(Decoder *dec, char *out, size_t cap) {
+    ZSTD_inBuffer in = { dec->data, dec->size, dec->pos };
+    ZSTD_outBuffer o = { out, cap, 0 };
+
+    while (o.pos < o.size) {
+        size_t in_before = in.pos, out_before = o.pos;
+        if (in.pos == in.size && dec->zstd_hint == 0)
+            break; // Every frame is complete
+        size_t rc = ZSTD_decompressStream(dec->zds, &o, &in);
+        if (ZSTD_isError(rc))
+            return -1;
+        dec->zstd_hint = rc;
+        if (in.pos == in_before && o.pos == out_before) { // Input ended inside a frame
+            if (o.pos == 0)
+                return -1;
+            break;
+        }
+    }
+    dec->pos = in.pos;
+    return (ssize_t)o.pos;
+}
+#endif
+
+// Function to read up to cap decompressed bytes, returns 0 at the end of the
+// input and -1 if the input is corrupt or truncated
+ssize_t decoder_read(Decoder *dec, char *out, size_t cap) {
+#ifdef HAVE_ZSTD
+    if (dec->fmt == CODEC_ZSTD)
+        return zstd_read(dec, out, cap);
+#endif
+    return gzip_read(dec, out, cap);
+}
+
+// Function to release a decoder
+void decoder_close(Decoder *dec) {
+    if (!dec)
+        return;
+#ifdef HAVE_ZSTD
+    if (dec->zds)
+        ZSTD_freeDStream(dec->zds);
+#endif
+    if (dec->fmt != CODEC_ZSTD)
+        inflateEnd(&dec->zs);
+    free(dec);
+}
@@ -0,0 +1,41 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Compression format of an input file, detected from its magic bytes
+typedef enum {
+    CODEC_NONE,
+    CODEC_GZIP, // gzip, possibly several concatenated members
+    CODEC_BGZF, // gzip made of independent blocks announcing their size, as written by bgzip
+    CODEC_ZSTD // zstd, possibly several frames
+} CodecFormat;
+
+// Independently decompressible block of a BGZF file or zstd frame. The line
+// fragments are filled by whoever decompresses the block, so the lines cut
+// by block boundaries can be stitched together afterwards.
+typedef struct {
+    size_t offset; // Byte offset of the compressed block in the input
+    size_t length; // Compressed length
+    size_t raw_size; // Decompressed size, 0 if the block does not record it
+    int has_newline; // The decompressed block contains a newline
+    char *head; // Bytes before the first newline, the whole block without one
+    size_t head_len;
+    char *tail; // Bytes after the last newline
+    size_t tail_len;
+} CodecBlock;
+
+// Sequential decompressor for inputs that cannot be split into blocks
+typedef struct Decoder Decoder;
+
+// Function prototypes
+CodecFormat codec_detect(const char *data, size_t size);
+const char *codec_name(CodecFormat fmt);
+size_t codec_blocks(CodecFormat fmt, const char *data, size_t size, CodecBlock **blocks);
+char *codec_block_decompress(const char *data, const CodecBlock *block, size_t *len);
+Decoder *decoder_open(CodecFormat fmt, const char *data, size_t size);
+ssize_t decoder_read(Decoder *dec, char *out, size_t cap);
+void decoder_close(Decoder *dec);
+
+#endif /* CODEC_H */
@@ -0,0 +1,851 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "daemon.h"
+#include "exitcode.h"
+#include "buffer.h"
+#include "scan.h"
+#include "ac.h"
+#include "dfa.h"
+#include "codec.h"
+
+#define ALL_FILES ((size_t)-1) // Query target meaning every resident file
+#define FLAG_SETS 4 // Combinations of SCAN_ICASE and SCAN_WORD
+#define TASK_BATCH 64 // Chunk tasks pushed per buffer lock acquisition
+#define POLL_MS 200 // How often the accept loop checks for a stop request
+#define REQUEST_TIMEOUT_MS 2000 // Time a client has from connecting to the end of its request line
+#define MAX_PENDING_REQUESTS 64 // Connections read at once, more wait in the listen backlog
+
+// Line-aligned chunk of a resident file with a zone map of its lines, so
+// filtered queries skip chunks holding no line they could count
+typedef struct {
+    size_t offset;
+    size_t length;
+    uint32_t level_mask; // Bit per LogLevel present
+    uint32_t min_ts;
+    uint32_t max_ts;
+} DaemonChunk;
+
+// Log file kept mapped between queries
+typedef struct {
+    char *path; // Resolved path, queries name the file by it
+    int fd;
+    dev_t dev; // Identity of the mapped file, a rotated path gets reloaded
+    ino_t ino;
+    const char *map; // NULL if the file is empty
+    size_t size;
+    DaemonChunk *chunks;
+    size_t num_chunks;
+} DaemonFile;
+
+// Query of one client, answered once the scan it joined is done
+typedef struct Query {
+    int fd; // Client connection, the reply goes here
+    int flags; // SCAN_ICASE and SCAN_WORD
+    int regex;
+    LogFilter filter;
+    int filtered;
+    char *term;
+    size_t file; // Position of the target file, or ALL_FILES
+    Scanner scanner;
+    Dfa *dfa; // Compiled expression of a regex query
+    size_t *matches; // Matching lines per file
+    struct Query *next;
+} Query;
+
+// How one shared scan matches the queries on one file. Unfiltered literal
+// queries with the same flags are merged into one automaton, so a file is
+// read once however many of them there are; the rest run their own matcher
+// on the same chunk while it is in cache.
+typedef struct {
+    AcAutomaton *ac[FLAG_SETS]; // NULL unless at least two queries share the flags
+    size_t *ac_queries[FLAG_SETS]; // Query of each pattern of the automaton
+    size_t *own; // Queries matched one by one
+    size_t num_own;
+} FilePlan;
+
+struct Job;
+
+// One chunk of a file to match for every query of the job
+typedef struct {
+    struct Job *job;
+    size_t file;
+    size_t chunk;
+} DaemonTask;
+
+// Shared scan answering every query that was pending when it started
+typedef struct Job {
+    Query **queries;
+    size_t num_queries;
+    FilePlan *plans; // Per file, unused files have no queries
+    size_t *counts; // num_workers x num_queries x num_files, each worker adds to its own block
+    AcCounter *counters; // num_workers x num_files x FLAG_SETS
+    atomic_size_t left; // Tasks not finished yet
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} Job;
+
+// Connection whose request line is still arriving
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    long long deadline; // Monotonic time in ms by which the whole line must have arrived
+} PendingRequest;
+
+typedef struct Daemon Daemon;
+
+// Position of a resident worker
+typedef struct {
+    Daemon *daemon;
+    size_t id;
+} DaemonWorker;
+
+// State of the daemon, kept across queries
+struct Daemon {
+    DaemonFile *files;
+    size_t num_files;
+    size_t chunk_size;
+    size_t num_workers;
+    Buffer tasks; // Chunk tasks of the running job
+    DaemonWorker *workers;
+    pthread_t *threads;
+    pthread_mutex_t lock; // Guards the pending queries
+    pthread_cond_t pending_cond;
+    Query *pending;
+    Query **pending_tail;
+    volatile sig_atomic_t *stop;
+    size_t queries_served;
+    size_t scans;
+};
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to allocate zeroed memory and handle errors
+static void *xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) fatal("calloc");
+    return p;
+}
+
+// Function to send a whole reply, a client that went away is ignored
+static void send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+// Function to answer a query with an error and close its connection
+static void reply_error(int fd, const char *msg) {
+    char line[256];
+    int n = snprintf(line, sizeof(line), "error\t%s\n", msg);
+    send_all(fd, line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+    close(fd);
+}
+
+// Function to add a line to the zone map of the chunk holding it
+static void zone_add(DaemonChunk *c, uint32_t ts, unsigned level) {
+    c->level_mask |= 1u << level;
+    if (ts < c->min_ts)
+        c->min_ts = ts;
+    if (ts > c->max_ts)
+        c->max_ts = ts;
+}
+
+// Function to cut a mapped file into line-aligned chunks and build their zone
+// maps, from the sidecar index where it covers the file and by parsing the
+// line headers of the rest
+static void build_chunks(DaemonFile *f, size_t chunk_size) {
+    f->num_chunks = 0;
+    f->chunks = xcalloc(f->size / chunk_size + 1, sizeof(DaemonChunk));
+    for (size_t offset = 0; offset < f->size;) {
+        size_t cut = offset + chunk_size;
+        if (cut >= f->size) {
+            cut = f->size;
+        } else {
+            const char *nl = memchr(f->map + cut - 1, '\n', f->size - cut + 1);
+            cut = nl ? (size_t)(nl - f->map) + 1 : f->size;
+        }
+        f->chunks[f->num_chunks++] = (DaemonChunk){ offset, cut - offset, 0, UINT32_MAX, 0 };
+        offset = cut;
+    }
+
+    size_t parsed = 0, c = 0;
+    LogIndex idx;
+    if (logindex_update(f->path, f->map, f->size, 0) == 0 && logindex_open(&idx, f->path) == 0) {
+        for (uint64_t i = 0; i < idx.hdr.num_entries; ++i) {
+            const IndexEntry *e = &idx.entries[i];
+            while (e->offset >= f->chunks[c].offset + f->chunks[c].length)
+                c++;
+            zone_add(&f->chunks[c], e->ts, e->level);
+        }
+        parsed = idx.hdr.indexed_size;
+        logindex_close(&idx);
+    }
+
+    c = 0;
+    while (parsed < f->size) {
+        const char *line = f->map + parsed;
+        const char *nl = memchr(line, '\n', f->size - parsed);
+        size_t len = nl ? (size_t)(nl - line) + 1 : f->size - parsed;
+        uint32_t ts;
+        LogLevel level;
+        log_parse_line(line, len, &ts, &level);
+        while (parsed >= f->chunks[c].offset + f->chunks[c].length)
+            c++;
+        zone_add(&f->chunks[c], ts, level);
+        parsed += len;
+    }
+}
+
+// Function to map a file and build its chunks, returns -1 if it cannot be served
+static int load_file(DaemonFile *f, size_t chunk_size) {
+    struct stat st;
+    f->fd = open(f->path, O_RDONLY);
+    if (f->fd == -1 || fstat(f->fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        perror(f->path);
+        if (f->fd != -1)
+            close(f->fd);
+        f->fd = -1;
+        return -1;
+    }
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->size = (size_t)st.st_size;
+    f->map = NULL;
+    f->chunks = NULL;
+    f->num_chunks = 0;
+    if (f->size == 0)
+        return 0;
+
+    void *map = mmap(NULL, f->size, PROT_READ, MAP_SHARED, f->fd, 0);
+    if (map == MAP_FAILED) {
+        perror(f->path);
+        close(f->fd);
+        f->fd = -1;
+        return -1;
+    }
+    f->map = map;
+    if (codec_detect(f->map, f->size) != CODEC_NONE) {
+        fprintf(stderr, "%s: compressed logs are not kept resident, skipping\n", f->path);
+        munmap(map, f->size);
+        close(f->fd);
+        f->fd = -1;
+        return -1;
+    }
+    madvise(map, f->size, MADV_WILLNEED);
+    build_chunks(f, chunk_size);
+    return 0;
+}
+
+// Function to release the mapping and chunks of a file
+static void unload_file(DaemonFile *f) {
+    if (f->map)
+        munmap((void *)f->map, f->size);
+    if (f->fd != -1)
+        close(f->fd);
+    free(f->chunks);
+    f->map = NULL;
+    f->fd = -1;
+    f->chunks = NULL;
+    f->num_chunks = 0;
+}
+
+// Function to reload a file that grew, shrank or was rotated since it was mapped
+static void refresh_file(DaemonFile *f, size_t chunk_size) {
+    struct stat st;
+    if (f->fd != -1 && stat(f->path, &st) == 0 && st.st_dev == f->dev && st.st_ino == f->ino &&
+        (size_t)st.st_size == f->size)
+        return;
+    unload_file(f);
+    if (load_file(f, chunk_size) == -1)
+        f->size = 0; // Served as empty until it can be opened again
+}
+
+// Function to check whether a chunk may hold a line passing the filter
+static int chunk_may_pass(const DaemonChunk *c, const LogFilter *filter) {
+    return (c->level_mask & filter->level_mask) && c->max_ts >= filter->since && c->min_ts <= filter->until;
+}
+
+// FilterCount counts the matching lines that pass a query's filter
+typedef struct {
+    const LogFilter *filter;
+    size_t count;
+} FilterCount;
+
+// Function to count a matching line if it passes the filter
+static void count_filtered(const char *line, size_t len, void *ctx) {
+    FilterCount *fc = ctx;
+    if (log_filter_match(fc->filter, line, len))
+        fc->count++;
+}
+
+// Function to count the lines of a chunk a query matches
+static size_t match_query(const Query *q, const char *data, size_t len) {
+    FilterCount fc = { &q->filter, 0 };
+    match_fn on_match = q->filtered ? count_filtered : NULL;
+    size_t count = q->dfa ? dfa_count_lines(q->dfa, data, len, on_match, &fc)
+                          : scan_count_lines(&q->scanner, data, len, on_match, &fc);
+    return q->filtered ? fc.count : count;
+}
+
+// Function to match one chunk for every query of the job that targets its file
+static void run_task(Daemon *d, const DaemonTask *t, size_t worker) {
+    Job *job = t->job;
+    const DaemonFile *f = &d->files[t->file];
+    const DaemonChunk *c = &f->chunks[t->chunk];
+    const char *data = f->map + c->offset;
+    const FilePlan *plan = &job->plans[t->file];
+
+    for (int k = 0; k < FLAG_SETS; ++k)
+        if (plan->ac[k])
+            ac_count_lines(plan->ac[k], &job->counters[(worker * d->num_files + t->file) * FLAG_SETS + k], data,
+                           c->length, NULL, NULL);
+    size_t *counts = job->counts + worker * job->num_queries * d->num_files;
+    for (size_t i = 0; i < plan->num_own; ++i) {
+        size_t qi = plan->own[i];
+        const Query *q = job->queries[qi];
+        if (q->filtered && !chunk_may_pass(c, &q->filter))
+            continue;
+        counts[qi * d->num_files + t->file] += match_query(q, data, c->length);
+    }
+}
+
+// Resident worker thread routine, runs chunk tasks until the buffer terminates
+static void *daemon_worker(void *arg) {
+    DaemonWorker *w = arg;
+    Daemon *d = w->daemon;
+    DaemonTask *t;
+    while ((t = buffer_pop(&d->tasks)) != NULL) {
+        Job *job = t->job;
+        run_task(d, t, w->id);
+        if (atomic_fetch_sub_explicit(&job->left, 1, memory_order_acq_rel) == 1) {
+            pthread_mutex_lock(&job->lock);
+            pthread_cond_signal(&job->done);
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+    return NULL;
+}
+
+// Function to check whether a query searches a file
+static int query_targets(const Query *q, size_t file) {
+    return q->file == ALL_FILES || q->file == file;
+}
+
+// Function to decide which queries of a file share an automaton
+static void plan_file(FilePlan *plan, Query **queries, size_t num_queries, size_t file) {
+    size_t shared[FLAG_SETS] = { 0 };
+    for (size_t i = 0; i < num_queries; ++i) {
+        const Query *q = queries[i];
+        if (query_targets(q, file) && !q->regex && !q->filtered && q->term[0] != '\0')
+            shared[q->flags]++;
+    }
+
+    plan->own = xcalloc(num_queries, sizeof(size_t));
+    char **patterns[FLAG_SETS] = { NULL };
+    size_t filled[FLAG_SETS] = { 0 };
+    for (int k = 0; k < FLAG_SETS; ++k)
+        if (shared[k] >= 2) {
+            patterns[k] = xcalloc(shared[k], sizeof(char *));
+            plan->ac_queries[k] = xcalloc(shared[k], sizeof(size_t));
+        }
+    for (size_t i = 0; i < num_queries; ++i) {
+        const Query *q = queries[i];
+        if (!query_targets(q, file))
+            continue;
+        if (!q->regex && !q->filtered && q->term[0] != '\0' && shared[q->flags] >= 2) {
+            int k = q->flags;
+            patterns[k][filled[k]] = strdup(q->term);
+            if (!patterns[k][filled[k]]) fatal("strdup");
+            plan->ac_queries[k][filled[k]++] = i;
+        } else {
+            plan->own[plan->num_own++] = i;
+        }
+    }
+    for (int k = 0; k < FLAG_SETS; ++k)
+        if (patterns[k])
+            plan->ac[k] = ac_build(patterns[k], shared[k], k); // Takes the patterns
+}
+
+// Function to run one shared scan for a list of queries and answer them
+static void run_batch(Daemon *d, Query *list) {
+    size_t nq = 0;
+    for (Query *q = list; q; q = q->next)
+        nq++;
+    size_t nf = d->num_files;
+    Job job;
+    job.queries = xcalloc(nq, sizeof(Query *));
+    job.num_queries = 0;
+    for (Query *q = list; q; q = q->next)
+        job.queries[job.num_queries++] = q;
+    job.plans = xcalloc(nf, sizeof(FilePlan));
+    job.counts = xcalloc(d->num_workers * nq * nf, sizeof(size_t));
+    job.counters = xcalloc(d->num_workers * nf * FLAG_SETS, sizeof(AcCounter));
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.done, NULL);
+
+    // Only the files some query targets are refreshed and scanned
+    size_t total_tasks = 0;
+    for (size_t f = 0; f < nf; ++f) {
+        size_t targeted = 0;
+        for (size_t i = 0; i < nq; ++i)
+            targeted += query_targets(job.queries[i], f);
+        if (targeted == 0)
+            continue;
+        refresh_file(&d->files[f], d->chunk_size);
+        plan_file(&job.plans[f], job.queries, nq, f);
+        for (int k = 0; k < FLAG_SETS; ++k)
+            if (job.plans[f].ac[k])
+                for (size_t w = 0; w < d->num_workers; ++w)
+                    ac_counter_init(&job.counters[(w * nf + f) * FLAG_SETS + k], job.plans[f].ac[k]);
+        total_tasks += d->files[f].num_chunks;
+    }
+
+    DaemonTask *tasks = xcalloc(total_tasks, sizeof(DaemonTask));
+    size_t n = 0;
+    for (size_t f = 0; f < nf; ++f)
+        if (job.plans[f].own) // Planned, so some query targets it
+            for (size_t c = 0; c < d->files[f].num_chunks; ++c)
+                tasks[n++] = (DaemonTask){ &job, f, c };
+    atomic_store_explicit(&job.left, total_tasks, memory_order_relaxed);
+    void *batch[TASK_BATCH];
+    for (size_t i = 0; i < total_tasks; i += TASK_BATCH) {
+        size_t m = total_tasks - i < TASK_BATCH ? total_tasks - i : TASK_BATCH;
+        for (size_t j = 0; j < m; ++j)
+            batch[j] = &tasks[i + j];
+        buffer_push_batch(&d->tasks, batch, m);
+    }
+    pthread_mutex_lock(&job.lock);
+    while (atomic_load_explicit(&job.left, memory_order_acquire) > 0)
+        pthread_cond_wait(&job.done, &job.lock);
+    pthread_mutex_unlock(&job.lock);
+
+    // Sum the workers' counts and answer every query
+    for (size_t i = 0; i < nq; ++i) {
+        Query *q = job.queries[i];
+        for (size_t f = 0; f < nf; ++f)
+            for (size_t w = 0; w < d->num_workers; ++w)
+                q->matches[f] += job.counts[(w * nq + i) * nf + f];
+    }
+    for (size_t f = 0; f < nf; ++f)
+        for (int k = 0; k < FLAG_SETS; ++k) {
+            const AcAutomaton *ac = job.plans[f].ac[k];
+            for (size_t p = 0; ac && p < ac->num_patterns; ++p)
+                for (size_t w = 0; w < d->num_workers; ++w)
+                    job.queries[job.plans[f].ac_queries[k][p]]->matches[f] +=
+                        job.counters[(w * nf + f) * FLAG_SETS + k].counts[p];
+        }
+    for (size_t i = 0; i < nq; ++i) {
+        Query *q = job.queries[i];
+        char *reply = NULL;
+        size_t reply_len = 0, total = 0;
+        FILE *out = open_memstream(&reply, &reply_len);
+        if (!out) fatal("open_memstream");
+        for (size_t f = 0; f < nf; ++f) {
+            if (!query_targets(q, f))
+                continue;
+            fprintf(out, "file\t%s\t%zu\n", d->files[f].path, q->matches[f]);
+            total += q->matches[f];
+        }
+        fprintf(out, "total\t%zu\n", total);
+        fclose(out);
+        send_all(q->fd, reply, reply_len);
+        free(reply);
+        close(q->fd);
+    }
+
+    for (size_t f = 0; f < nf; ++f) {
+        FilePlan *plan = &job.plans[f];
+        for (int k = 0; k < FLAG_SETS; ++k) {
+            if (!plan->ac[k])
+                continue;
+            for (size_t w = 0; w < d->num_workers; ++w)
+                ac_counter_destroy(&job.counters[(w * nf + f) * FLAG_SETS + k]);
+            ac_destroy(plan->ac[k]);
+            free(plan->ac_queries[k]);
+        }
+        free(plan->own);
+    }
+    for (size_t i = 0; i < nq; ++i) {
+        Query *q = job.queries[i];
+        dfa_destroy(q->dfa);
+        free(q->term);
+        free(q->matches);
+        free(q);
+    }
+    pthread_cond_destroy(&job.done);
+    pthread_mutex_destroy(&job.lock);
+    free(tasks);
+    free(job.counters);
+    free(job.counts);
+    free(job.plans);
+    free(job.queries);
+    d->queries_served += nq;
+    d->scans++;
+}
+
+// Dispatcher thread routine: takes every query pending at once, so queries
+// arriving while a scan runs are answered together by the next one
+static void *dispatcher(void *arg) {
+    Daemon *d = arg;
+    for (;;) {
+        pthread_mutex_lock(&d->lock);
+        while (!d->pending && !*d->stop)
+            pthread_cond_wait(&d->pending_cond, &d->lock);
+        Query *list = d->pending;
+        d->pending = NULL;
+        d->pending_tail = &d->pending;
+        pthread_mutex_unlock(&d->lock);
+        if (!list)
+            return NULL;
+        run_batch(d, list);
+    }
+}
+
+// Function to get the monotonic time in milliseconds
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Function to read what a client has sent so far without blocking, once poll
+// reported it readable. Returns 1 once the request line is complete, 0 if
+// more may follow and -1 if the client hung up or sent too long a line.
+static int read_request(PendingRequest *r) {
+    ssize_t n = read(r->fd, r->buf + r->len, DAEMON_MAX_REQUEST - r->len);
+    if (n == -1 && errno == EINTR)
+        return 0;
+    if (n <= 0)
+        return -1;
+    char *nl = memchr(r->buf + r->len, '\n', (size_t)n);
+    r->len += (size_t)n;
+    if (nl) {
+        *nl = '\0';
+        return 1;
+    }
+    return r->len < DAEMON_MAX_REQUEST ? 0 : -1;
+}
+
+// Function to parse and compile a request, returns an error message if it is invalid
+static const char *parse_request(const Daemon *d, char *line, Query *q) {
+    char *field[7];
+    field[0] = line;
+    for (int i = 1; i < 7; ++i) { // The search term is the rest of the line, tabs included
+        char *tab = strchr(field[i - 1], '\t');
+        if (!tab)
+            return "expected: count <flags> <level_mask> <since> <until> <path> <search_term>";
+        *tab = '\0';
+        field[i] = tab + 1;
+    }
+    if (strcmp(field[0], "count") != 0)
+        return "unknown request";
+
+    q->flags = 0;
+    q->regex = 0;
+    for (const char *f = field[1]; *f; ++f) {
+        if (*f == 'i')
+            q->flags |= SCAN_ICASE;
+        else if (*f == 'w')
+            q->flags |= SCAN_WORD;
+        else if (*f == 'r')
+            q->regex = 1;
+        else if (*f != '-')
+            return "unknown flag";
+    }
+    q->filter.level_mask = (uint32_t)strtoul(field[2], NULL, 10);
+    q->filter.since = (uint32_t)strtoul(field[3], NULL, 10);
+    q->filter.until = (uint32_t)strtoul(field[4], NULL, 10);
+    q->filtered = log_filter_active(&q->filter);
+
+    q->file = ALL_FILES;
+    if (strcmp(field[5], "*") != 0) {
+        for (q->file = 0; q->file < d->num_files && strcmp(field[5], d->files[q->file].path) != 0; ++q->file)
+            ;
+        if (q->file == d->num_files)
+            return "file is not resident";
+    }
+
+    q->term = strdup(field[6]);
+    if (!q->term) fatal("strdup");
+    if (q->regex) {
+        static char err[128]; // Only the accepting thread parses requests
+        if (!(q->dfa = dfa_compile(q->term, q->flags, err, sizeof(err))))
+            return err;
+    } else {
+        scanner_init(&q->scanner, q->term, strlen(q->term), q->flags);
+    }
+    q->matches = xcalloc(d->num_files, sizeof(size_t));
+    return NULL;
+}
+
+// Function to check and queue the request line of a connection
+static void queue_query(Daemon *d, int fd, char *line) {
+    Query *q = xcalloc(1, sizeof(Query));
+    q->fd = fd;
+    const char *err = parse_request(d, line, q);
+    if (err) {
+        reply_error(fd, err);
+        dfa_destroy(q->dfa);
+        free(q->term);
+        free(q);
+        return;
+    }
+
+    pthread_mutex_lock(&d->lock);
+    *d->pending_tail = q;
+    d->pending_tail = &q->next;
+    pthread_cond_signal(&d->pending_cond);
+    pthread_mutex_unlock(&d->lock);
+}
+
+// Function to create the listening socket, replacing a stale socket file
+// but not the socket of a daemon that still answers
+static int listen_socket(const char *socket_path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "%s: a daemon is already listening\n", socket_path);
+        close(fd);
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror(socket_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Function to keep the files mapped and the workers running, answering
+// queries on the socket until stop is set. Returns the exit status.
+int daemon_run(const char *socket_path, char **paths, size_t num_paths, size_t buffer_size, size_t num_workers,
+               size_t chunk_size, volatile sig_atomic_t *stop) {
+    Daemon d = { 0 };
+    d.chunk_size = chunk_size;
+    d.num_workers = num_workers;
+    d.stop = stop;
+    d.pending_tail = &d.pending;
+    d.files = xcalloc(num_paths, sizeof(DaemonFile));
+    for (size_t i = 0; i < num_paths; ++i) {
+        DaemonFile *f = &d.files[d.num_files];
+        char resolved[PATH_MAX];
+        f->path = strdup(realpath(paths[i], resolved) ? resolved : paths[i]);
+        if (!f->path) fatal("strdup");
+        if (load_file(f, chunk_size) == -1) {
+            free(f->path);
+            continue;
+        }
+        d.num_files++;
+    }
+    if (d.num_files == 0) {
+        fprintf(stderr, "No log files to serve\n");
+        free(d.files);
+        return EXIT_ERROR;
+    }
+
+    int listen_fd = listen_socket(socket_path);
+    if (listen_fd == -1) {
+        for (size_t f = 0; f < d.num_files; ++f) {
+            unload_file(&d.files[f]);
+            free(d.files[f].path);
+        }
+        free(d.files);
+        return EXIT_ERROR;
+    }
+
+    buffer_init(&d.tasks, buffer_size);
+    pthread_mutex_init(&d.lock, NULL);
+    pthread_cond_init(&d.pending_cond, NULL);
+    d.workers = xcalloc(num_workers, sizeof(DaemonWorker));
+    d.threads = xcalloc(num_workers, sizeof(pthread_t));
+    for (size_t i = 0; i < num_workers; ++i) {
+        d.workers[i] = (DaemonWorker){ &d, i };
+        if (pthread_create(&d.threads[i], NULL, daemon_worker, &d.workers[i]))
+            fatal("pthread_create");
+    }
+    pthread_t dispatch_thread;
+    if (pthread_create(&dispatch_thread, NULL, dispatcher, &d))
+        fatal("pthread_create");
+
+    size_t bytes = 0;
+    for (size_t f = 0; f < d.num_files; ++f)
+        bytes += d.files[f].size;
+    printf("Daemon serving %zu files (%.1f MB) with %zu workers on %s\n", d.num_files, bytes / 1e6, num_workers,
+           socket_path);
+    fflush(stdout);
+
+    // Request lines are read as they arrive from every connection at once,
+    // so a slow or silent client only holds up itself, and only until its deadline
+    PendingRequest pending[MAX_PENDING_REQUESTS];
+    size_t num_pending = 0;
+    while (!*stop) {
+        struct pollfd p[MAX_PENDING_REQUESTS + 1];
+        long long now = now_ms();
+        int timeout = POLL_MS;
+        for (size_t i = 0; i < num_pending; ++i) {
+            p[i] = (struct pollfd){ pending[i].fd, POLLIN, 0 };
+            long long left = pending[i].deadline - now;
+            if (left < timeout)
+                timeout = left > 0 ? (int)left : 0;
+        }
+        size_t polled = num_pending;
+        p[polled] = (struct pollfd){ num_pending < MAX_PENDING_REQUESTS ? listen_fd : -1, POLLIN, 0 };
+        int ready = poll(p, polled + 1, timeout);
+        if (ready == -1 && errno != EINTR)
+            fatal("poll");
+
+        // Queue complete requests, drop connections that hung up or ran out of time
+        now = now_ms();
+        for (size_t i = polled; i-- > 0;) {
+            PendingRequest *r = &pending[i];
+            int state = ready > 0 && p[i].revents ? read_request(r) : 0;
+            if (state == 0 && now < r->deadline)
+                continue;
+            if (state == 1)
+                queue_query(&d, r->fd, r->buf);
+            else
+                reply_error(r->fd, "no request line");
+            free(r->buf);
+            *r = pending[--num_pending]; // Entries past i were already handled
+        }
+
+        if (ready <= 0 || !(p[polled].revents & POLLIN))
+            continue;
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED)
+                perror("accept");
+            continue;
+        }
+        PendingRequest *r = &pending[num_pending++];
+        r->fd = fd;
+        r->buf = malloc(DAEMON_MAX_REQUEST + 1);
+        if (!r->buf) fatal("malloc");
+        r->len = 0;
+        r->deadline = now + REQUEST_TIMEOUT_MS;
+    }
+    for (size_t i = 0; i < num_pending; ++i) {
+        reply_error(pending[i].fd, "daemon is stopping");
+        free(pending[i].buf);
+    }
+
+    // Answer what is queued, then let the workers drain and exit
+    close(listen_fd);
+    unlink(socket_path);
+    pthread_mutex_lock(&d.lock);
+    pthread_cond_broadcast(&d.pending_cond);
+    pthread_mutex_unlock(&d.lock);
+    pthread_join(dispatch_thread, NULL);
+    buffer_terminate(&d.tasks);
+    for (size_t i = 0; i < num_workers; ++i)
+        pthread_join(d.threads[i], NULL);
+    printf("Daemon answered %zu queries in %zu shared scans\n", d.queries_served, d.scans);
+
+    buffer_destroy(&d.tasks);
+    pthread_cond_destroy(&d.pending_cond);
+    pthread_mutex_destroy(&d.lock);
+    for (size_t f = 0; f < d.num_files; ++f) {
+        unload_file(&d.files[f]);
+        free(d.files[f].path);
+    }
+    free(d.files);
+    free(d.workers);
+    free(d.threads);
+    return 0;
+}
+
+// Function to send one query to a daemon and print its reply like a direct
+// run would. Returns the exit status: 0 if a line matched, 1 if none did, 2 on an error.
+int daemon_query(const char *socket_path, int flags, int regex, const LogFilter *filter, const char *path,
+                 const char *term) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", socket_path);
+        return EXIT_ERROR;
+    }
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror(socket_path);
+        if (fd != -1)
+            close(fd);
+        return EXIT_ERROR;
+    }
+
+    char resolved[PATH_MAX];
+    if (strcmp(path, "*") != 0 && realpath(path, resolved))
+        path = resolved;
+    char *request;
+    int len = asprintf(&request, "count\t%s%s%s%s\t%u\t%u\t%u\t%s\t%s\n", flags || regex ? "" : "-",
+                       flags & SCAN_ICASE ? "i" : "", flags & SCAN_WORD ? "w" : "", regex ? "r" : "",
+                       filter->level_mask, filter->since, filter->until, path, term);
+    if (len == -1) fatal("asprintf");
+    send_all(fd, request, (size_t)len);
+    free(request);
+
+    FILE *in = fdopen(fd, "r");
+    if (!in) fatal("fdopen");
+    char *line = NULL;
+    size_t cap = 0;
+    int status = EXIT_ERROR; // Until the total arrives
+    while (getline(&line, &cap, in) != -1) {
+        line[strcspn(line, "\n")] = '\0';
+        char *value = strchr(line, '\t');
+        if (!value)
+            continue;
+        *value++ = '\0';
+        if (strcmp(line, "error") == 0) {
+            fprintf(stderr, "Daemon: %s\n", value);
+            status = EXIT_ERROR;
+            break;
+        } else if (strcmp(line, "file") == 0 && strcmp(path, "*") == 0) {
+            char *count = strrchr(value, '\t');
+            if (count) {
+                *count++ = '\0';
+                printf("File %s: %s matches\n", value, count);
+            }
+        } else if (strcmp(line, "total") == 0) {
+            printf("Total matches: %s\n", value);
+            status = strtoul(value, NULL, 10) > 0 ? EXIT_MATCH : EXIT_NO_MATCH;
+        }
+    }
+    free(line);
+    fclose(in);
+    return status;
+}
@@ -0,0 +1,24 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <signal.h>
+#include <stddef.h>
+#include "logindex.h"
+
+// Query protocol of the daemon socket: one request line per connection,
+// fields separated by tabs
+//   count <flags> <level_mask> <since> <until> <path> <search_term>
+// flags holds the letters i (ignore case), w (whole words) and r (regular
+// expression), or is - for none. level_mask, since and until are the
+// LogFilter fields in decimal, path is a resident file or * for all of them.
+// The reply is one "file <path> <matches>" line per file searched, then
+// "total <matches>", or a single "error <message>" line.
+#define DAEMON_MAX_REQUEST 8192 // Longest request line accepted
+
+// Function prototypes
+int daemon_run(const char *socket_path, char **paths, size_t num_paths, size_t buffer_size, size_t num_workers,
+               size_t chunk_size, volatile sig_atomic_t *stop);
+int daemon_query(const char *socket_path, int flags, int regex, const LogFilter *filter, const char *path,
+                 const char *term);
+
+#endif /* DAEMON_H */
@@ -0,0 +1,857 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include "dfa.h"
+#include "exitcode.h"
+
+// Thompson NFA state kinds, NFA_EOL only matches at the end of the line
+enum { NFA_SET, NFA_SPLIT, NFA_EPS, NFA_MATCH, NFA_EOL };
+
+typedef struct {
+    uint8_t bits[32];
+} ByteSet;
+
+typedef struct {
+    int type;
+    int set; // Index of the byte set for NFA_SET
+    int out; // Next state, -1 while dangling
+    int out1; // Second branch of NFA_SPLIT
+} NfaState;
+
+// NFA fragment with its dangling exits, encoded as state * 2 + branch
+typedef struct {
+    int start;
+    int *outs;
+    size_t nouts;
+} Frag;
+
+typedef struct {
+    const char *p; // Parse cursor
+    const char *end;
+    NfaState *states;
+    size_t nstates, states_cap;
+    ByteSet *sets;
+    size_t nsets, sets_cap;
+    int depth; // Group nesting depth
+    int failed;
+    int icase; // Letters match both cases
+    char *err;
+    size_t errlen;
+    // Required literal tracking at the top level
+    char *run;
+    size_t run_len;
+    char **runs; // Every literal run of the top level concatenation
+    size_t nruns;
+    int top_alt; // Top level alternation seen, no literal is required
+} Parser;
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to grow an array and handle errors
+static void *xrealloc(void *pointer, size_t size) {
+    pointer = realloc(pointer, size);
+    if (!pointer) fatal("realloc");
+    return pointer;
+}
+
+// Function to record the first parse error
+static void parse_error(Parser *ps, const char *fmt, ...) {
+    if (ps->failed)
+        return;
+    ps->failed = 1;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(ps->err, ps->errlen, fmt, ap);
+    va_end(ap);
+}
+
+static void set_add(ByteSet *set, unsigned char c) { set->bits[c >> 3] |= (uint8_t)(1u << (c & 7)); }
+static int set_has(const ByteSet *set, unsigned char c) { return set->bits[c >> 3] >> (c & 7) & 1; }
+
+// Function to add the other case of every letter in set
+static void fold_set(ByteSet *set) {
+    for (int c = 'a'; c <= 'z'; ++c) {
+        if (set_has(set, (unsigned char)c) || set_has(set, (unsigned char)(c ^ 0x20))) {
+            set_add(set, (unsigned char)c);
+            set_add(set, (unsigned char)(c ^ 0x20));
+        }
+    }
+}
+
+// Function to append a byte set and return its index
+static int new_set(Parser *ps, const ByteSet *set) {
+    if (ps->nsets == ps->sets_cap) {
+        ps->sets_cap = ps->sets_cap ? ps->sets_cap * 2 : 16;
+        ps->sets = xrealloc(ps->sets, ps->sets_cap * sizeof(ByteSet));
+    }
+    ps->sets[ps->nsets] = *set;
+    return (int)ps->nsets++;
+}
+
+// Function to append an NFA state and return its index
+static int new_state(Parser *ps, int type, int set, int out, int out1) {
+    if (ps->nstates == ps->states_cap) {
+        ps->states_cap = ps->states_cap ? ps->states_cap * 2 : 64;
+        ps->states = xrealloc(ps->states, ps->states_cap * sizeof(NfaState));
+    }
+    ps->states[ps->nstates] = (NfaState){ type, set, out, out1 };
+    return (int)ps->nstates++;
+}
+
+// Function to build a fragment with a single dangling exit
+static Frag frag1(int start, int exit_code) {
+    Frag f = { start, malloc(sizeof(int)), 1 };
+    if (!f.outs) fatal("malloc");
+    f.outs[0] = exit_code;
+    return f;
+}
+
+// Function to connect the dangling exits of f to state
+static void patch(Parser *ps, Frag *f, int state) {
+    for (size_t i = 0; i < f->nouts; ++i) {
+        NfaState *s = &ps->states[f->outs[i] >> 1];
+        if (f->outs[i] & 1)
+            s->out1 = state;
+        else
+            s->out = state;
+    }
+    free(f->outs);
+    f->outs = NULL;
+    f->nouts = 0;
+}
+
+// Function to concatenate the exit lists of two fragments
+static void append_outs(Frag *f, Frag *g) {
+    f->outs = xrealloc(f->outs, (f->nouts + g->nouts) * sizeof(int));
+    memcpy(f->outs + f->nouts, g->outs, g->nouts * sizeof(int));
+    f->nouts += g->nouts;
+    free(g->outs);
+}
+
+// Function to build a fragment matching one byte of set
+static Frag frag_set(Parser *ps, const ByteSet *set) {
+    ByteSet folded = *set;
+    if (ps->icase)
+        fold_set(&folded);
+    int s = new_state(ps, NFA_SET, new_set(ps, &folded), -1, -1);
+    return frag1(s, s << 1);
+}
+
+// Function to fill set from a \d \w \s style class escape, returns 0 if c is not one
+static int class_escape(ByteSet *set, char c) {
+    ByteSet tmp = { { 0 } };
+    switch (c | 0x20) {
+    case 'd':
+        for (int b = '0'; b <= '9'; ++b) set_add(&tmp, (unsigned char)b);
+        break;
+    case 'w':
+        for (int b = 0; b < 256; ++b)
+            if ((b >= '0' && b <= '9') || (b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z') || b == '_')
+                set_add(&tmp, (unsigned char)b);
+        break;
+    case 's':
+        for (const char *w = " \t\r\f\v"; *w; ++w) set_add(&tmp, (unsigned char)*w);
+        break;
+    default:
+        return 0;
+    }
+    if (c >= 'A' && c <= 'Z') { // Upper case escapes are negated, never matching newline
+        for (int i = 0; i < 32; ++i) tmp.bits[i] = (uint8_t)~tmp.bits[i];
+        tmp.bits['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+    }
+    for (int i = 0; i < 32; ++i) set->bits[i] |= tmp.bits[i];
+    return 1;
+}
+
+// Function to translate a single character escape
+static unsigned char char_escape(char c) {
+    switch (c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    default: return (unsigned char)c;
+    }
+}
+
+// POSIX character classes usable inside bracket expressions
+static const struct {
+    const char *name;
+    int (*test)(int);
+} posix_classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+    { "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+    { "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+// Function to parse a [:name:] class at the cursor, returns 0 if it is not one
+static int posix_class(Parser *ps, ByteSet *set) {
+    const char *name = ps->p + 2;
+    const char *close = name;
+    while (close + 1 < ps->end && !(close[0] == ':' && close[1] == ']'))
+        close++;
+    if (close + 1 >= ps->end)
+        return 0;
+
+    for (size_t i = 0; i < sizeof(posix_classes) / sizeof(posix_classes[0]); ++i) {
+        if (strlen(posix_classes[i].name) == (size_t)(close - name) &&
+            strncmp(posix_classes[i].name, name, close - name) == 0) {
+            for (int b = 0; b < 128; ++b)
+                if (posix_classes[i].test(b) && b != '\n')
+                    set_add(set, (unsigned char)b);
+            ps->p = close + 2;
+            return 1;
+        }
+    }
+    parse_error(ps, "unknown character class [:%.*s:]", (int)(close - name), name);
+    return 0;
+}
+
+// Function to parse a bracket expression, the cursor is past the '['
+static Frag parse_class(Parser *ps) {
+    ByteSet set = { { 0 } };
+    int negate = 0;
+
+    if (ps->p < ps->end && *ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+
+    int first = 1;
+    while (ps->p < ps->end && (*ps->p != ']' || first)) {
+        first = 0;
+        if (*ps->p == '[' && ps->p + 1 < ps->end && ps->p[1] == ':') {
+            if (posix_class(ps, &set))
+                continue;
+        }
+        unsigned char lo = (unsigned char)*ps->p++;
+        if (lo == '\\' && ps->p < ps->end) {
+            char e = *ps->p++;
+            if (class_escape(&set, e))
+                continue;
+            lo = char_escape(e);
+        }
+
+        unsigned char hi = lo;
+        if (ps->p + 1 < ps->end && *ps->p == '-' && ps->p[1] != ']') {
+            ps->p++;
+            hi = (unsigned char)*ps->p++;
+            if (hi == '\\' && ps->p < ps->end)
+                hi = char_escape(*ps->p++);
+            if (hi < lo) {
+                parse_error(ps, "invalid range in bracket expression");
+                break;
+            }
+        }
+        for (int b = lo; b <= hi; ++b)
+            set_add(&set, (unsigned char)b);
+    }
+
+    if (ps->p >= ps->end) {
+        parse_error(ps, "unterminated bracket expression");
+    } else {
+        ps->p++; // Skip ']'
+    }
+
+    if (ps->icase) // Before negating, so [^a] rejects A as well
+        fold_set(&set);
+    if (negate) {
+        for (int i = 0; i < 32; ++i) set.bits[i] = (uint8_t)~set.bits[i];
+        set.bits['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+    }
+    return frag_set(ps, &set);
+}
+
+static Frag parse_alt(Parser *ps);
+
+// Function to parse an atom, *literal is set to its byte if it is a plain literal, -1 otherwise
+static Frag parse_atom(Parser *ps, int *literal) {
+    ByteSet set = { { 0 } };
+    *literal = -1;
+    char c = *ps->p++;
+
+    switch (c) {
+    case '(': {
+        ps->depth++;
+        Frag f = parse_alt(ps);
+        ps->depth--;
+        if (ps->p >= ps->end || *ps->p != ')')
+            parse_error(ps, "missing )");
+        else
+            ps->p++;
+        return f;
+    }
+    case '[':
+        return parse_class(ps);
+    case '.':
+        for (int b = 0; b < 256; ++b)
+            if (b != '\n') set_add(&set, (unsigned char)b);
+        return frag_set(ps, &set);
+    case '*':
+    case '+':
+    case '?':
+        parse_error(ps, "nothing to repeat before '%c'", c);
+        return frag_set(ps, &set);
+    case '^':
+    case '$':
+        parse_error(ps, "'%c' is only supported at the %s of the expression", c, c == '^' ? "start" : "end");
+        return frag_set(ps, &set);
+    case '\\':
+        if (ps->p >= ps->end) {
+            parse_error(ps, "trailing backslash");
+            return frag_set(ps, &set);
+        }
+        c = *ps->p++;
+        if (class_escape(&set, c))
+            return frag_set(ps, &set);
+        c = (char)char_escape(c);
+        break;
+    default:
+        break;
+    }
+
+    *literal = (unsigned char)c;
+    set_add(&set, (unsigned char)c);
+    return frag_set(ps, &set);
+}
+
+// Function to apply a *, + or ? operator to a fragment
+static Frag apply_op(Parser *ps, Frag f, char op) {
+    int s = new_state(ps, NFA_SPLIT, -1, f.start, -1);
+    if (op == '*') {
+        patch(ps, &f, s);
+        return frag1(s, s << 1 | 1);
+    }
+    if (op == '+') {
+        int start = f.start;
+        patch(ps, &f, s);
+        return frag1(start, s << 1 | 1);
+    }
+    Frag g = frag1(s, s << 1 | 1);
+    append_outs(&g, &f);
+    return g;
+}
+
+// Function to append g to the fragment f, which may still be empty
+static void concat(Parser *ps, Frag *f, Frag g) {
+    if (f->start < 0) {
+        *f = g;
+        return;
+    }
+    patch(ps, f, g.start);
+    f->outs = g.outs;
+    f->nouts = g.nouts;
+}
+
+// Function to copy the unpatched fragment f, whose states are [first, last)
+static Frag clone_frag(Parser *ps, const Frag *f, int first, int last) {
+    int offset = (int)ps->nstates - first;
+    for (int i = first; i < last; ++i) {
+        NfaState st = ps->states[i];
+        new_state(ps, st.type, st.set, st.out >= 0 ? st.out + offset : -1, st.out1 >= 0 ? st.out1 + offset : -1);
+    }
+
+    Frag c = { f->start + offset, malloc(f->nouts * sizeof(int) + sizeof(int)), f->nouts };
+    if (!c.outs) fatal("malloc");
+    for (size_t i = 0; i < f->nouts; ++i)
+        c.outs[i] = f->outs[i] + offset * 2;
+    return c;
+}
+
+// Function to parse a {m}, {m,} or {m,n} interval, returns 0 and consumes
+// nothing if the brace does not start one (it is then a literal)
+static int parse_interval(Parser *ps, int *min, int *max) {
+    const char *q = ps->p + 1;
+    char *endp;
+
+    if (q >= ps->end || *q < '0' || *q > '9')
+        return 0;
+    long lo = strtol(q, &endp, 10);
+    long hi = lo;
+    q = endp;
+    if (q < ps->end && *q == ',') {
+        q++;
+        hi = -1;
+        if (q < ps->end && *q >= '0' && *q <= '9') {
+            hi = strtol(q, &endp, 10);
+            q = endp;
+        }
+    }
+    if (q >= ps->end || *q != '}')
+        return 0;
+
+    if (lo > DFA_MAX_REPEAT || hi > DFA_MAX_REPEAT || (hi >= 0 && hi < lo)) {
+        parse_error(ps, "invalid interval {%ld,%ld}", lo, hi);
+        return 0;
+    }
+    ps->p = q + 1;
+    *min = (int)lo;
+    *max = (int)hi;
+    return 1;
+}
+
+// Function to expand an interval into copies of the fragment whose states are [first, nstates)
+static Frag apply_interval(Parser *ps, Frag f, int first, int min, int max) {
+    int last = (int)ps->nstates;
+    int copies = max < 0 ? (min > 0 ? min : 1) : max;
+    Frag result = { -1, NULL, 0 };
+
+    if (copies == 0) { // x{0} matches the empty string
+        free(f.outs);
+        int s = new_state(ps, NFA_EPS, -1, -1, -1);
+        return frag1(s, s << 1);
+    }
+
+    // Clone every copy before anything is patched
+    Frag *parts = malloc(copies * sizeof(Frag));
+    if (!parts) fatal("malloc");
+    parts[0] = f;
+    for (int i = 1; i < copies; ++i)
+        parts[i] = clone_frag(ps, &f, first, last);
+
+    for (int i = 0; i < copies; ++i) {
+        Frag part = parts[i];
+        if (max < 0 && i == copies - 1)
+            part = apply_op(ps, part, min > 0 ? '+' : '*');
+        else if (i >= min)
+            part = apply_op(ps, part, '?');
+        concat(ps, &result, part);
+    }
+    free(parts);
+    return result;
+}
+
+// Function to parse an atom followed by any number of *, +, ? and intervals
+static Frag parse_repeat(Parser *ps, int *literal) {
+    int first = (int)ps->nstates;
+    Frag f = parse_atom(ps, literal);
+
+    while (ps->p < ps->end && !ps->failed) {
+        char op = *ps->p;
+        int min, max;
+        if (op == '*' || op == '+' || op == '?') {
+            ps->p++;
+            f = apply_op(ps, f, op);
+        } else if (op == '{' && parse_interval(ps, &min, &max)) {
+            f = apply_interval(ps, f, first, min, max);
+        } else {
+            break;
+        }
+        *literal = -1;
+    }
+    return f;
+}
+
+// Function to close the current top level literal run and record it
+static void end_literal_run(Parser *ps) {
+    if (ps->run_len == 0)
+        return;
+    ps->runs = xrealloc(ps->runs, (ps->nruns + 1) * sizeof(char *));
+    ps->runs[ps->nruns] = strndup(ps->run, ps->run_len);
+    if (!ps->runs[ps->nruns]) fatal("strndup");
+    ps->nruns++;
+    ps->run_len = 0;
+}
+
+// Function to parse a concatenation of repeats
+static Frag parse_concat(Parser *ps) {
+    Frag f = { -1, NULL, 0 };
+
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')' && !ps->failed) {
+        int literal;
+        Frag g = parse_repeat(ps, &literal);
+
+        if (ps->depth == 0) {
+            if (literal >= 0)
+                ps->run[ps->run_len++] = (char)literal;
+            else
+                end_literal_run(ps);
+        }
+
+        concat(ps, &f, g);
+    }
+    if (ps->depth == 0)
+        end_literal_run(ps);
+
+    if (f.start < 0) { // Empty expression matches the empty string
+        int s = new_state(ps, NFA_EPS, -1, -1, -1);
+        f = frag1(s, s << 1);
+    }
+    return f;
+}
+
+// Function to parse alternatives separated by |
+static Frag parse_alt(Parser *ps) {
+    Frag f = parse_concat(ps);
+
+    while (ps->p < ps->end && *ps->p == '|' && !ps->failed) {
+        ps->p++;
+        if (ps->depth == 0)
+            ps->top_alt = 1;
+        Frag g = parse_concat(ps);
+        int s = new_state(ps, NFA_SPLIT, -1, f.start, g.start);
+        f.start = s;
+        append_outs(&f, &g);
+    }
+    return f;
+}
+
+// Work state of the subset construction
+typedef struct {
+    const Parser *ps;
+    int *stack;
+    uint32_t *mark; // Generation stamp per NFA state
+    uint32_t gen;
+    int *sets; // Concatenated NFA state sets of all DFA states
+    size_t sets_len, sets_cap;
+    size_t *set_off; // Offset and size of each DFA state's set
+    size_t *set_size;
+    int32_t *hash; // Open addressing table of DFA state ids
+    size_t hash_cap;
+} Builder;
+
+// Function to add the epsilon closure of state to the list
+static void closure(Builder *b, int state, int *list, size_t *n) {
+    size_t top = 0;
+    b->stack[top++] = state;
+    while (top > 0) {
+        int s = b->stack[--top];
+        if (s < 0 || b->mark[s] == b->gen)
+            continue;
+        b->mark[s] = b->gen;
+        const NfaState *ns = &b->ps->states[s];
+        if (ns->type == NFA_SPLIT) {
+            b->stack[top++] = ns->out1;
+            b->stack[top++] = ns->out;
+        } else if (ns->type == NFA_EPS) {
+            b->stack[top++] = ns->out;
+        } else {
+            list[(*n)++] = s;
+        }
+    }
+}
+
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to hash an NFA state set
+static size_t hash_set(const int *set, size_t n) {
+    size_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i)
+        h = (h ^ (size_t)set[i]) * 1099511628211ULL;
+    return h;
+}
+
+// Function to find or add the DFA state for a sorted set, returns -1 past the state limit
+static int32_t intern(Builder *b, Dfa *dfa, const int *set, size_t n) {
+    size_t h = hash_set(set, n) & (b->hash_cap - 1);
+    while (b->hash[h] >= 0) {
+        int32_t id = b->hash[h];
+        if (b->set_size[id] == n && memcmp(b->sets + b->set_off[id], set, n * sizeof(int)) == 0)
+            return id;
+        h = (h + 1) & (b->hash_cap - 1);
+    }
+    if (dfa->num_states == DFA_MAX_STATES)
+        return -1;
+
+    int32_t id = (int32_t)dfa->num_states++;
+    if (b->sets_len + n > b->sets_cap) {
+        b->sets_cap = (b->sets_len + n) * 2;
+        b->sets = xrealloc(b->sets, b->sets_cap * sizeof(int));
+    }
+    memcpy(b->sets + b->sets_len, set, n * sizeof(int));
+    b->set_off[id] = b->sets_len;
+    b->set_size[id] = n;
+    b->sets_len += n;
+    b->hash[h] = id;
+    return id;
+}
+
+// Function to compile the expression, returns NULL and fills err on failure
+Dfa *dfa_compile(const char *expr, int flags, char *err, size_t errlen) {
+    Parser ps = { 0 };
+    ps.icase = (flags & SCAN_ICASE) != 0;
+    ps.err = err;
+    ps.errlen = errlen;
+    ps.p = expr;
+    ps.end = expr + strlen(expr);
+
+    Dfa *dfa = calloc(1, sizeof(Dfa));
+    if (!dfa) fatal("calloc");
+    dfa->dead = -1;
+    dfa->flags = flags;
+
+    // ^ and $ are only supported as anchors of the whole expression, which
+    // must not be a top-level alternation
+    if (ps.p < ps.end && *ps.p == '^') {
+        dfa->anchored_start = 1;
+        ps.p++;
+    }
+    if (ps.end > ps.p && ps.end[-1] == '$') {
+        size_t backslashes = 0;
+        for (const char *q = ps.end - 2; q >= ps.p && *q == '\\'; --q)
+            backslashes++;
+        if (backslashes % 2 == 0) {
+            dfa->anchored_end = 1;
+            ps.end--;
+        }
+    }
+
+    size_t expr_len = (size_t)(ps.end - ps.p);
+    ps.run = malloc(expr_len + 1);
+    if (!ps.run) fatal("malloc");
+
+    Frag f = parse_alt(&ps);
+    if (!ps.failed && ps.p < ps.end)
+        parse_error(&ps, "unmatched )");
+    if (ps.top_alt && (dfa->anchored_start || dfa->anchored_end)) // It would anchor every alternative
+        parse_error(&ps, "'%c' cannot anchor a top-level '|', group the alternatives in ( )",
+                    dfa->anchored_start ? '^' : '$');
+    int match = new_state(&ps, NFA_MATCH, -1, -1, -1);
+    int nfa_start = f.start;
+    int restart = f.start; // Where a match may begin past the first byte of the line
+    if (flags & SCAN_WORD) {
+        // A whole word starts the line or follows a non-word byte, and ends
+        // the line or is followed by one
+        ByteSet nonword = { { 0 } };
+        class_escape(&nonword, 'W');
+        restart = new_state(&ps, NFA_SET, new_set(&ps, &nonword), f.start, -1);
+        if (!dfa->anchored_start)
+            nfa_start = new_state(&ps, NFA_SPLIT, -1, f.start, restart);
+        if (!dfa->anchored_end) {
+            int next = new_state(&ps, NFA_SET, new_set(&ps, &nonword), match, -1);
+            int eol = new_state(&ps, NFA_EOL, -1, -1, -1);
+            match = new_state(&ps, NFA_SPLIT, -1, next, eol);
+        }
+    }
+    patch(&ps, &f, match);
+
+    free(ps.run);
+    if (ps.failed || ps.top_alt) {
+        for (size_t i = 0; i < ps.nruns; ++i)
+            free(ps.runs[i]);
+        free(ps.runs);
+        ps.runs = NULL;
+        ps.nruns = 0;
+    }
+    if (ps.failed) {
+        free(ps.states);
+        free(ps.sets);
+        free(dfa);
+        return NULL;
+    }
+
+    // The longest literal drives the prefilter, the others reject candidate lines cheaply
+    if (ps.nruns > 0) {
+        size_t best = 0;
+        for (size_t i = 1; i < ps.nruns; ++i)
+            if (strlen(ps.runs[i]) > strlen(ps.runs[best]))
+                best = i;
+        dfa->literal = ps.runs[best];
+        ps.runs[best] = ps.runs[--ps.nruns];
+        scanner_init(&dfa->prefilter, dfa->literal, strlen(dfa->literal), flags & SCAN_ICASE);
+    }
+    dfa->required = ps.runs;
+    dfa->num_required = ps.nruns;
+
+    // Split the bytes into classes no byte set distinguishes
+    size_t nc = 1;
+    for (size_t i = 0; i < ps.nsets; ++i) {
+        int remap[512];
+        memset(remap, -1, sizeof(remap));
+        size_t n = 0;
+        for (int c = 0; c < 256; ++c) {
+            int key = dfa->byte_class[c] * 2 + set_has(&ps.sets[i], (unsigned char)c);
+            if (remap[key] < 0)
+                remap[key] = (int)n++;
+            dfa->byte_class[c] = (uint8_t)remap[key];
+        }
+        nc = n;
+    }
+    dfa->num_classes = nc;
+    int class_rep[256];
+    for (int c = 255; c >= 0; --c)
+        class_rep[dfa->byte_class[c]] = c;
+
+    // Subset construction, every state is expanded once in creation order
+    Builder b = { 0 };
+    b.ps = &ps;
+    b.stack = malloc(ps.nstates * 2 * sizeof(int) + sizeof(int));
+    b.mark = calloc(ps.nstates, sizeof(uint32_t));
+    b.set_off = malloc(DFA_MAX_STATES * sizeof(size_t));
+    b.set_size = malloc(DFA_MAX_STATES * sizeof(size_t));
+    b.hash_cap = DFA_MAX_STATES * 2;
+    b.hash = malloc(b.hash_cap * sizeof(int32_t));
+    int *list = malloc(ps.nstates * sizeof(int) + sizeof(int));
+    dfa->delta = malloc(DFA_MAX_STATES * nc * sizeof(int32_t));
+    dfa->accept = calloc(DFA_MAX_STATES, 1);
+    if (!b.stack || !b.mark || !b.set_off || !b.set_size || !b.hash || !list || !dfa->delta || !dfa->accept)
+        fatal("malloc");
+    memset(b.hash, -1, b.hash_cap * sizeof(int32_t));
+
+    size_t n = 0;
+    b.gen++;
+    closure(&b, nfa_start, list, &n);
+    qsort(list, n, sizeof(int), cmp_int);
+    dfa->start = intern(&b, dfa, list, n);
+
+    int too_big = 0;
+    for (size_t d = 0; d < dfa->num_states && !too_big; ++d) {
+        const int *set = b.sets + b.set_off[d];
+        size_t size = b.set_size[d];
+        for (size_t i = 0; i < size; ++i) {
+            if (ps.states[set[i]].type == NFA_MATCH)
+                dfa->accept[d] |= dfa->anchored_end ? DFA_ACCEPT_EOL : DFA_ACCEPT;
+            else if (ps.states[set[i]].type == NFA_EOL)
+                dfa->accept[d] |= DFA_ACCEPT_EOL;
+        }
+        if (size == 0)
+            dfa->dead = (int32_t)d;
+
+        // Once accepting, the rest of the line is irrelevant
+        if (dfa->accept[d] & DFA_ACCEPT) {
+            for (size_t c = 0; c < nc; ++c)
+                dfa->delta[d * nc + c] = (int32_t)d;
+            continue;
+        }
+
+        for (size_t c = 0; c < nc; ++c) {
+            n = 0;
+            b.gen++;
+            set = b.sets + b.set_off[d]; // intern() may have moved the sets
+            for (size_t i = 0; i < size; ++i) {
+                const NfaState *ns = &ps.states[set[i]];
+                if (ns->type == NFA_SET && set_has(&ps.sets[ns->set], (unsigned char)class_rep[c]))
+                    closure(&b, ns->out, list, &n);
+            }
+            if (!dfa->anchored_start) // A match may start at any position of the line
+                closure(&b, restart, list, &n);
+            qsort(list, n, sizeof(int), cmp_int);
+
+            int32_t next = intern(&b, dfa, list, n);
+            if (next < 0) {
+                too_big = 1;
+                break;
+            }
+            dfa->delta[d * nc + c] = next;
+        }
+    }
+
+    free(b.stack);
+    free(b.mark);
+    free(b.sets);
+    free(b.set_off);
+    free(b.set_size);
+    free(b.hash);
+    free(list);
+    free(ps.states);
+    free(ps.sets);
+
+    if (too_big) {
+        snprintf(err, errlen, "expression needs more than %d DFA states", DFA_MAX_STATES);
+        dfa_destroy(dfa);
+        return NULL;
+    }
+    return dfa;
+}
+
+// Function to destroy a compiled DFA
+void dfa_destroy(Dfa *dfa) {
+    if (!dfa)
+        return;
+    free(dfa->delta);
+    free(dfa->accept);
+    free(dfa->literal);
+    for (size_t i = 0; i < dfa->num_required; ++i)
+        free(dfa->required[i]);
+    free(dfa->required);
+    free(dfa);
+}
+
+// Function to run the DFA from p over one line. Stops at the newline, at the
+// end of data, on the first accepting state or in the dead state, and returns
+// where it stopped. *matched tells whether the line matches.
+static const char *run_line(const Dfa *dfa, const char *p, const char *end, int *matched) {
+    const size_t nc = dfa->num_classes;
+    int32_t s = dfa->start;
+
+    if (dfa->accept[s] & DFA_ACCEPT) {
+        *matched = 1;
+        return p;
+    }
+    for (; p < end && *p != '\n'; ++p) {
+        s = dfa->delta[s * nc + dfa->byte_class[(unsigned char)*p]];
+        if (s == dfa->dead) {
+            *matched = 0;
+            return p;
+        }
+        if (dfa->accept[s] & DFA_ACCEPT) {
+            *matched = 1;
+            return p;
+        }
+    }
+    *matched = (dfa->accept[s] & DFA_ACCEPT_EOL) != 0;
+    return p;
+}
+
+// Function to check that the line starting at line holds every other required literal
+static int has_required(const Dfa *dfa, const char *line, const char *end, const char **line_end) {
+    const char *nl = memchr(line, '\n', end - line);
+    *line_end = nl ? nl : end;
+    for (size_t i = 0; i < dfa->num_required; ++i) {
+        Scanner sc;
+        scanner_init(&sc, dfa->required[i], strlen(dfa->required[i]), dfa->flags & SCAN_ICASE);
+        if (!scan_find(&sc, line, *line_end - line))
+            return 0;
+    }
+    return 1;
+}
+
+// Function to count the lines of a chunk the expression matches. With
+// required literals only the lines containing all of them go through the DFA.
+// Each matching line is passed to on_match if set.
+size_t dfa_count_lines(const Dfa *dfa, const char *data, size_t len, match_fn on_match, void *ctx) {
+    const char *p = data;
+    const char *end = data + len;
+    size_t count = 0;
+    int matched;
+
+    while (p < end) {
+        const char *line = p;
+        if (dfa->literal) {
+            const char *hit = scan_find(&dfa->prefilter, p, end - p);
+            if (!hit)
+                break;
+            line = memrchr(p, '\n', hit - p);
+            line = line ? line + 1 : p;
+
+            const char *line_end;
+            if (!has_required(dfa, line, end, &line_end)) {
+                if (line_end == end)
+                    break;
+                p = line_end + 1;
+                continue;
+            }
+        }
+
+        const char *stop = run_line(dfa, line, end, &matched);
+        count += matched;
+        const char *nl = memchr(stop, '\n', end - stop);
+        if (matched && on_match)
+            on_match(line, (nl ? nl + 1 : end) - line, ctx);
+        if (!nl)
+            break;
+        p = nl + 1;
+    }
+    return count;
+}
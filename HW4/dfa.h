@@ -0,0 +1,43 @@
+#ifndef DFA_H
+#define DFA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "scan.h"
+
+#define DFA_MAX_STATES 8192 // Upper bound on DFA states before compilation gives up
+#define DFA_MAX_REPEAT 255 // Upper bound on the counts of a {m,n} interval
+
+#define DFA_ACCEPT 0x1 // The line matches once this state is reached
+#define DFA_ACCEPT_EOL 0x2 // The line matches if it ends in this state
+
+// Regular expression compiled into a table-driven DFA that matches within a line.
+// Supported syntax: literals, ., [...], [^...], [:class:], \d \w \s \D \W \S,
+// escapes, grouping, |, *, +, ?, {m,n}, and ^ / $ at the start / end of the
+// expression; with a top-level | the anchored alternatives must be grouped,
+// as in ^(a|b). A { that does not start an interval is a literal. With
+// SCAN_ICASE letters match both cases, with SCAN_WORD a match must not be
+// preceded or followed by a letter, digit or underscore.
+typedef struct {
+    int32_t *delta; // num_states x num_classes transition table
+    uint8_t *accept; // DFA_ACCEPT_* flags per state
+    size_t num_states;
+    size_t num_classes;
+    uint8_t byte_class[256]; // Byte to class map
+    int32_t start; // Start state at the beginning of a line
+    int32_t dead; // State that can never reach an accepting state, -1 if none
+    int anchored_start; // Expression starts with ^
+    int anchored_end; // Expression ends with $
+    int flags; // SCAN_ICASE and SCAN_WORD
+    char *literal; // Longest literal every match contains, NULL if none was found
+    Scanner prefilter; // Search kernel for literal
+    char **required; // Other literals every match contains
+    size_t num_required;
+} Dfa;
+
+// Function prototypes
+Dfa *dfa_compile(const char *expr, int flags, char *err, size_t errlen);
+void dfa_destroy(Dfa *dfa);
+size_t dfa_count_lines(const Dfa *dfa, const char *data, size_t len, match_fn on_match, void *ctx);
+
+#endif /* DFA_H */
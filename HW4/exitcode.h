@@ -0,0 +1,11 @@
+#ifndef EXITCODE_H
+#define EXITCODE_H
+
+// Exit status, as grep: some line matched, no line matched, or an error
+// occurred. A run stopped by SIGINT exits with 128 + SIGINT like a shell.
+#define EXIT_MATCH 0
+#define EXIT_NO_MATCH 1
+#define EXIT_ERROR 2
+#define EXIT_INTERRUPTED 130
+
+#endif /* EXITCODE_H */
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "follow.h"
+#include "exitcode.h"
+
+#define READ_CHUNK (64 * 1024) // Bytes read per pread while catching up
+#define FILE_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to open the followed path and watch it, returns -1 if it does not exist
+static int attach(Follower *f) {
+    f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+    if (f->fd == -1)
+        return -1;
+    f->offset = 0;
+    f->file_wd = inotify_add_watch(f->inotify_fd, f->path, FILE_EVENTS);
+    if (f->file_wd == -1)
+        fatal("inotify_add_watch");
+    return 0;
+}
+
+// Function to stop following the current file
+static void detach(Follower *f) {
+    if (f->file_wd != -1)
+        inotify_rm_watch(f->inotify_fd, f->file_wd); // Fails harmlessly if the kernel already dropped it
+    f->file_wd = -1;
+    if (f->fd != -1)
+        close(f->fd);
+    f->fd = -1;
+}
+
+// Function to open a file for following, the existing content is read as new lines
+int follower_open(Follower *f, const char *path) {
+    memset(f, 0, sizeof(*f));
+    f->fd = -1;
+    f->file_wd = -1;
+    f->path = strdup(path);
+    f->dir = strdup(path);
+    if (!f->path || !f->dir)
+        fatal("strdup");
+
+    char *slash = strrchr(f->dir, '/');
+    if (!slash) {
+        f->base = f->path;
+        strcpy(f->dir, ".");
+    } else {
+        f->base = f->path + (slash - f->dir) + 1;
+        if (slash == f->dir)
+            slash[1] = '\0'; // File in the root directory
+        else
+            slash[0] = '\0';
+    }
+
+    f->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (f->inotify_fd == -1)
+        fatal("inotify_init1");
+    f->dir_wd = inotify_add_watch(f->inotify_fd, f->dir, DIR_EVENTS);
+    if (f->dir_wd == -1)
+        fatal("inotify_add_watch");
+
+    if (attach(f) == -1) {
+        perror(path);
+        follower_close(f);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to wait up to timeout_ms for changes, returns 1 on events, 0 on
+// timeout and -1 if a signal interrupted the wait
+int follower_wait(Follower *f, int timeout_ms) {
+    struct pollfd pfd = { f->inotify_fd, POLLIN, 0 };
+    int rc = poll(&pfd, 1, timeout_ms);
+    if (rc == -1) {
+        if (errno == EINTR)
+            return -1;
+        fatal("poll");
+    }
+    if (rc == 0)
+        return 0;
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(f->inotify_fd, events, sizeof(events))) > 0) {
+        for (char *p = events; p < events + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->wd == f->file_wd && (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF)))
+                f->rotated = 1;
+            if (ev->wd == f->dir_wd && ev->len > 0 && strcmp(ev->name, f->base) == 0)
+                f->rotated = 1; // A file was created or moved into the followed path
+            if (ev->wd == f->file_wd && (ev->mask & IN_IGNORED))
+                f->file_wd = -1;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    if (n == -1 && errno != EAGAIN && errno != EINTR)
+        fatal("read");
+    return 1;
+}
+
+// Function to emit the complete lines held in pending and keep the partial tail
+static void emit_lines(Follower *f, line_fn emit, void *ctx) {
+    size_t start = 0;
+    const char *nl;
+    while ((nl = memchr(f->pending + start, '\n', f->pending_len - start))) {
+        size_t end = (size_t)(nl - f->pending) + 1;
+        emit(f->pending + start, end - start, ctx);
+        start = end;
+    }
+    memmove(f->pending, f->pending + start, f->pending_len - start);
+    f->pending_len -= start;
+}
+
+// Function to read everything appended since the last call from the open file
+static void drain(Follower *f, line_fn emit, void *ctx) {
+    struct stat st;
+    if (fstat(f->fd, &st) == -1)
+        fatal("fstat");
+    if (st.st_size < f->offset) { // Truncated in place, start over from the top
+        fprintf(stderr, "%s: file truncated\n", f->path);
+        f->offset = 0;
+        f->pending_len = 0;
+        f->rotations++;
+    }
+
+    for (;;) {
+        if (f->pending_cap - f->pending_len < READ_CHUNK) {
+            f->pending_cap = f->pending_len + READ_CHUNK;
+            f->pending = realloc(f->pending, f->pending_cap);
+            if (!f->pending)
+                fatal("realloc");
+        }
+        ssize_t n = pread(f->fd, f->pending + f->pending_len, READ_CHUNK, f->offset);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            fatal("pread");
+        }
+        if (n == 0)
+            break;
+        f->offset += n;
+        f->pending_len += (size_t)n;
+        emit_lines(f, emit, ctx);
+    }
+}
+
+// Function to push the lines appended since the last call, following the path
+// to a new file once the old one has been rotated away and fully read
+void follower_read(Follower *f, line_fn emit, void *ctx) {
+    for (;;) {
+        if (f->fd != -1)
+            drain(f, emit, ctx);
+        if (!f->rotated)
+            return;
+
+        struct stat cur, st;
+        if (stat(f->path, &st) == -1)
+            return; // Not recreated yet, the directory watch reports when it is
+        if (f->fd != -1 && fstat(f->fd, &cur) == 0 && cur.st_dev == st.st_dev && cur.st_ino == st.st_ino) {
+            f->rotated = 0; // Still the same file
+            return;
+        }
+
+        // The old file is complete, its unterminated last line counts too
+        if (f->pending_len > 0) {
+            emit(f->pending, f->pending_len, ctx);
+            f->pending_len = 0;
+        }
+        detach(f);
+        f->rotated = 0;
+        if (attach(f) == -1)
+            return;
+        f->rotations++;
+        fprintf(stderr, "%s: file rotated, following the new file\n", f->path);
+    }
+}
+
+// Function to release the watches, the file and the buffers
+void follower_close(Follower *f) {
+    detach(f);
+    if (f->inotify_fd != -1)
+        close(f->inotify_fd);
+    free(f->pending);
+    free(f->path);
+    free(f->dir);
+    f->pending = NULL;
+    f->path = NULL;
+    f->dir = NULL;
+}
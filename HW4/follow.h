@@ -0,0 +1,33 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Callback receiving each complete line read from the followed file
+typedef void (*line_fn)(const char *line, size_t len, void *ctx);
+
+// Follows a log file through appends, truncation and rename-based rotation
+typedef struct {
+    char *path; // Path of the followed file
+    char *dir; // Directory holding it, watched for the file being recreated
+    const char *base; // File name inside dir
+    int fd; // Currently open file, -1 while the path is missing
+    int inotify_fd;
+    int file_wd; // Watch on the open file
+    int dir_wd; // Watch on the directory
+    off_t offset; // Bytes of the open file consumed so far
+    int rotated; // File was moved or deleted, switch to the new one after draining
+    char *pending; // Partial last line waiting for its newline
+    size_t pending_len;
+    size_t pending_cap;
+    size_t rotations; // Number of rotations and truncations seen
+} Follower;
+
+// Function prototypes
+int follower_open(Follower *f, const char *path);
+int follower_wait(Follower *f, int timeout_ms);
+void follower_read(Follower *f, line_fn emit, void *ctx);
+void follower_close(Follower *f);
+
+#endif /* FOLLOW_H */
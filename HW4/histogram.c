@@ -0,0 +1,123 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "histogram.h"
+#include "exitcode.h"
+
+#define INITIAL_MINUTES 64 // Initial minute table size, doubled at half load
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to initialize an empty histogram
+void histogram_init(Histogram *h) {
+    memset(h->by_level, 0, sizeof(h->by_level));
+    h->cap = INITIAL_MINUTES;
+    h->used = 0;
+    h->minutes = calloc(h->cap, sizeof(MinuteBucket));
+    if (!h->minutes) fatal("calloc");
+}
+
+// Function to free the minute table
+void histogram_destroy(Histogram *h) {
+    free(h->minutes);
+    h->minutes = NULL;
+}
+
+// Function to find the bucket of a minute, or the empty bucket it belongs in
+static MinuteBucket *find_bucket(MinuteBucket *table, size_t cap, uint32_t minute) {
+    size_t i = (minute * 2654435761u) & (cap - 1);
+    while (table[i].count != 0 && table[i].minute != minute)
+        i = (i + 1) & (cap - 1);
+    return &table[i];
+}
+
+// Function to add count matches to a minute, growing the table at half load
+static void add_minute(Histogram *h, uint32_t minute, size_t count) {
+    if ((h->used + 1) * 2 > h->cap) {
+        size_t cap = h->cap * 2;
+        MinuteBucket *table = calloc(cap, sizeof(MinuteBucket));
+        if (!table) fatal("calloc");
+        for (size_t i = 0; i < h->cap; ++i)
+            if (h->minutes[i].count != 0)
+                *find_bucket(table, cap, h->minutes[i].minute) = h->minutes[i];
+        free(h->minutes);
+        h->minutes = table;
+        h->cap = cap;
+    }
+
+    MinuteBucket *b = find_bucket(h->minutes, h->cap, minute);
+    if (b->count == 0) {
+        b->minute = minute;
+        h->used++;
+    }
+    b->count += count;
+}
+
+// Function to count a matching line under its level and minute
+void histogram_add(Histogram *h, const char *line, size_t len) {
+    uint32_t ts;
+    LogLevel level;
+    log_parse_line(line, len, &ts, &level);
+    h->by_level[level]++;
+    if (level != LEVEL_UNPARSED) // Unparsed lines have no time
+        add_minute(h, ts / 60, 1);
+}
+
+// Function to add the counts of src to dst
+void histogram_merge(Histogram *dst, const Histogram *src) {
+    for (int l = 0; l < LEVEL_COUNT; ++l)
+        dst->by_level[l] += src->by_level[l];
+    for (size_t i = 0; i < src->cap; ++i)
+        if (src->minutes[i].count != 0)
+            add_minute(dst, src->minutes[i].minute, src->minutes[i].count);
+}
+
+// Function to order minute buckets by time
+static int compare_minutes(const void *a, const void *b) {
+    uint32_t x = ((const MinuteBucket *)a)->minute, y = ((const MinuteBucket *)b)->minute;
+    return (x > y) - (x < y);
+}
+
+// Function to get the non-empty minute buckets in time order, the caller frees *sorted
+size_t histogram_minutes(const Histogram *h, MinuteBucket **sorted) {
+    *sorted = malloc((h->used + 1) * sizeof(MinuteBucket));
+    if (!*sorted) fatal("malloc");
+    size_t n = 0;
+    for (size_t i = 0; i < h->cap; ++i)
+        if (h->minutes[i].count != 0)
+            (*sorted)[n++] = h->minutes[i];
+    qsort(*sorted, n, sizeof(MinuteBucket), compare_minutes);
+    return n;
+}
+
+// Function to format a minute as YYYY-MM-DD HH:MM
+void histogram_minute_name(uint32_t minute, char *buf, size_t len) {
+    time_t t = (time_t)minute * 60;
+    struct tm tm;
+    gmtime_r(&t, &tm); // Log times are parsed as UTC
+    strftime(buf, len, "%Y-%m-%d %H:%M", &tm);
+}
+
+// Function to print the non-zero level counts and the minutes in time order
+void histogram_print(const Histogram *h, FILE *out) {
+    fprintf(out, "Matches by level:\n");
+    for (int l = 0; l < LEVEL_COUNT; ++l)
+        if (h->by_level[l] != 0)
+            fprintf(out, "  %-8s %zu\n", log_level_name((LogLevel)l), h->by_level[l]);
+
+    MinuteBucket *sorted;
+    size_t n = histogram_minutes(h, &sorted);
+    fprintf(out, "Matches by minute:\n");
+    for (size_t i = 0; i < n; ++i) {
+        char when[32];
+        histogram_minute_name(sorted[i].minute, when, sizeof(when));
+        fprintf(out, "  %s %zu\n", when, sorted[i].count);
+    }
+    free(sorted);
+}
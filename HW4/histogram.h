@@ -0,0 +1,38 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "logindex.h"
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Matches within one minute, a bucket with count 0 is empty
+typedef struct {
+    uint32_t minute; // Minutes since the epoch
+    size_t count;
+} MinuteBucket;
+
+// Match counts of one worker by level and by minute. The alignment keeps the
+// histograms of different workers on different cache lines.
+typedef struct {
+    alignas(CACHE_LINE_SIZE) size_t by_level[LEVEL_COUNT];
+    MinuteBucket *minutes; // Open addressing table keyed by minute
+    size_t cap; // Power of two
+    size_t used;
+} Histogram;
+
+// Function prototypes
+void histogram_init(Histogram *h);
+void histogram_destroy(Histogram *h);
+void histogram_add(Histogram *h, const char *line, size_t len);
+void histogram_merge(Histogram *dst, const Histogram *src);
+size_t histogram_minutes(const Histogram *h, MinuteBucket **sorted);
+void histogram_minute_name(uint32_t minute, char *buf, size_t len);
+void histogram_print(const Histogram *h, FILE *out);
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "lfring.h"
+#include "exitcode.h"
+
+#define SPIN_LIMIT 256 // Spins before a waiter starts yielding
+#define YIELD_LIMIT 4 // Yields before a waiter parks on its futex
+#define OCCUPANCY_STRIDE 16 // Pushes between occupancy samples, reading head pulls in the consumers' cache line
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to relax the CPU inside a spin loop
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Function to park the calling thread while *word still holds val
+static void futex_wait(atomic_uint *word, unsigned val) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+// Function to wake up to n threads parked on word
+static void futex_wake(atomic_uint *word, int n) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+// Function to wake parked waiters after the other side made progress
+static void wake_waiters(atomic_uint *word, atomic_uint *waiters, int n) {
+    // Pairs with the increment of waiters in park() so a parking thread either
+    // sees the progress on its re-check or is counted here
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiters, memory_order_relaxed) > 0) {
+        atomic_fetch_add_explicit(word, 1, memory_order_release);
+        futex_wake(word, n);
+    }
+}
+
+// Function to block until ready(ring, pos) holds or the ring is terminating,
+// spinning first, then yielding and finally parking on the futex
+static void park(LfRing *ring, atomic_uint *word, atomic_uint *waiters,
+                 int (*ready)(LfRing *, size_t), size_t pos) {
+    for (int spin = 0; spin < ring->spin_limit; ++spin) {
+        if (ready(ring, pos) || atomic_load_explicit(&ring->terminating, memory_order_acquire))
+            return;
+        cpu_relax();
+    }
+    for (int yield = 0; yield < YIELD_LIMIT; ++yield) { // Let the other side run before sleeping
+        if (ready(ring, pos) || atomic_load_explicit(&ring->terminating, memory_order_acquire))
+            return;
+        sched_yield();
+    }
+
+    atomic_fetch_add_explicit(waiters, 1, memory_order_seq_cst);
+    unsigned val = atomic_load_explicit(word, memory_order_acquire);
+    if (!ready(ring, pos) && !atomic_load_explicit(&ring->terminating, memory_order_acquire))
+        futex_wait(word, val);
+    atomic_fetch_sub_explicit(waiters, 1, memory_order_relaxed);
+}
+
+// Function to check whether the slot for producer position pos is free
+static int slot_free(LfRing *ring, size_t pos) {
+    LfSlot *slot = &ring->slots[pos % ring->size];
+    return atomic_load_explicit(&slot->seq, memory_order_acquire) == pos;
+}
+
+// Function to check whether the slot at the current head holds an item
+static int slot_filled(LfRing *ring, size_t pos) {
+    (void)pos;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    LfSlot *slot = &ring->slots[head % ring->size];
+    return atomic_load_explicit(&slot->seq, memory_order_acquire) == head + 1;
+}
+
+// Function to create a ring with the given number of slots
+LfRing *lfring_create(size_t size) {
+    LfRing *ring = aligned_alloc(CACHE_LINE_SIZE, (sizeof(LfRing) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+    if (!ring) fatal("aligned_alloc");
+    ring->slots = calloc(size, sizeof(LfSlot));
+    if (!ring->slots) fatal("calloc");
+    ring->size = size;
+    // Spinning only pays off if the other side can run at the same time
+    ring->spin_limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+    for (size_t i = 0; i < size; ++i)
+        atomic_init(&ring->slots[i].seq, i);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->pushes = ring->producer_waits = ring->occupancy_sum = ring->samples = 0;
+    atomic_init(&ring->consumer_waits, 0);
+    atomic_init(&ring->items_futex, 0);
+    atomic_init(&ring->items_waiters, 0);
+    atomic_init(&ring->space_futex, 0);
+    atomic_init(&ring->space_waiters, 0);
+    atomic_init(&ring->terminating, 0);
+    return ring;
+}
+
+// Function to destroy the ring
+void lfring_destroy(LfRing *ring) {
+    free(ring->slots);
+    free(ring);
+}
+
+// Function to push an item, only one thread may push.
+// Returns -1 without storing the item if the ring is terminating.
+int lfring_push(LfRing *ring, void *item) {
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    LfSlot *slot = &ring->slots[pos % ring->size];
+
+    if (pos % OCCUPANCY_STRIDE == 0) {
+        ring->occupancy_sum += pos - atomic_load_explicit(&ring->head, memory_order_relaxed);
+        ring->samples++;
+    }
+    if (!slot_free(ring, pos))
+        ring->producer_waits++;
+    while (!slot_free(ring, pos)) { // Wait until the slot has been consumed
+        if (atomic_load_explicit(&ring->terminating, memory_order_acquire))
+            return -1;
+        park(ring, &ring->space_futex, &ring->space_waiters, slot_free, pos);
+    }
+    if (atomic_load_explicit(&ring->terminating, memory_order_acquire))
+        return -1;
+
+    slot->item = item;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    atomic_store_explicit(&ring->tail, pos + 1, memory_order_relaxed);
+    ring->pushes++;
+
+    wake_waiters(&ring->items_futex, &ring->items_waiters, 1);
+    return 0;
+}
+
+// Function to pop an item without blocking, returns 0 if the ring is empty
+int lfring_try_pop(LfRing *ring, void **item) {
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;) {
+        LfSlot *slot = &ring->slots[pos % ring->size];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (dif < 0) // Slot not filled yet, the ring is empty
+            return 0;
+        if (dif > 0) { // Another consumer took this position
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            *item = slot->item;
+            // Hand the slot back to the producer for position pos + size
+            atomic_store_explicit(&slot->seq, pos + ring->size, memory_order_release);
+            wake_waiters(&ring->space_futex, &ring->space_waiters, 1);
+            return 1;
+        }
+    }
+}
+
+// Function to pop an item, blocking while the ring is empty.
+// Returns 0 once the ring is terminating and empty, 1 if an item was popped.
+int lfring_pop(LfRing *ring, void **item) {
+    for (int waited = 0;; waited = 1) {
+        if (lfring_try_pop(ring, item))
+            return 1;
+        if (atomic_load_explicit(&ring->terminating, memory_order_acquire)) {
+            // Drain items published before termination, like the mutex buffer
+            return lfring_try_pop(ring, item);
+        }
+        if (!waited)
+            atomic_fetch_add_explicit(&ring->consumer_waits, 1, memory_order_relaxed);
+        park(ring, &ring->items_futex, &ring->items_waiters, slot_filled, 0);
+    }
+}
+
+// Function to signal termination and wake every parked thread
+void lfring_terminate(LfRing *ring) {
+    atomic_store_explicit(&ring->terminating, 1, memory_order_release);
+    atomic_fetch_add_explicit(&ring->items_futex, 1, memory_order_release);
+    atomic_fetch_add_explicit(&ring->space_futex, 1, memory_order_release);
+    futex_wake(&ring->items_futex, INT_MAX);
+    futex_wake(&ring->space_futex, INT_MAX);
+}
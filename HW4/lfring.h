@@ -0,0 +1,44 @@
+#ifndef LFRING_H
+#define LFRING_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_LINE_SIZE 64
+
+// A ring slot, seq tells whether the slot is free or holds the item of a given position
+typedef struct {
+    atomic_size_t seq; // pos when free for the producer, pos + 1 when filled
+    void *item; // Item stored in the slot
+} LfSlot;
+
+// Lock-free single-producer/multi-consumer ring, each hot field on its own cache line
+typedef struct {
+    alignas(CACHE_LINE_SIZE) atomic_size_t head; // Next position consumers claim
+    alignas(CACHE_LINE_SIZE) atomic_size_t tail; // Next position the producer fills
+    size_t pushes; // Statistics written by the producer only
+    size_t producer_waits; // Pushes that found their slot still in use
+    size_t occupancy_sum; // Items in the ring summed over the sampled pushes
+    size_t samples;
+    alignas(CACHE_LINE_SIZE) atomic_uint items_futex; // Bumped when items are published to parked consumers
+    atomic_uint items_waiters; // Number of consumers parked on items_futex
+    atomic_size_t consumer_waits; // Pops that found the ring empty and had to wait
+    alignas(CACHE_LINE_SIZE) atomic_uint space_futex; // Bumped when slots are freed for a parked producer
+    atomic_uint space_waiters; // Number of producers parked on space_futex
+    alignas(CACHE_LINE_SIZE) atomic_int terminating; // Flag to signal termination
+    LfSlot *slots; // Slot array
+    size_t size; // Number of slots
+    int spin_limit; // Spins before parking, 0 on single CPU machines
+} LfRing;
+
+// Function prototypes
+LfRing *lfring_create(size_t size);
+void lfring_destroy(LfRing *ring);
+int lfring_push(LfRing *ring, void *item);
+int lfring_pop(LfRing *ring, void **item);
+int lfring_try_pop(LfRing *ring, void **item);
+void lfring_terminate(LfRing *ring);
+
+#endif /* LFRING_H */
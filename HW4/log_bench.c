@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "buffer.h"
+#include "scan.h"
+
+// Pipeline benchmark: the LogAnalyzer producer/worker pipeline over mmap'ed
+// chunks, swept over buffer sizes, worker counts and input files of varying
+// match density. Reports lines/s, MB/s and the p99 time items wait in the buffer.
+
+#define DEFAULT_CHUNK_SIZE (64UL << 10)
+#define BATCH_SIZE 32
+#define MAX_LIST 16
+
+// Chunk of the mapped file stamped with the time it was pushed
+typedef struct {
+    size_t offset;
+    size_t length;
+    uint64_t pushed_ns;
+} BenchItem;
+
+typedef struct {
+    Buffer *buf;
+    const Scanner *scanner;
+    const char *map;
+    uint64_t *latencies; // Queue wait of every popped item in nanoseconds
+    size_t num_latencies;
+    size_t matches;
+} BenchWorker;
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+// Function to get the current monotonic time in nanoseconds
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Worker thread routine, records how long each item sat in the buffer
+static void *bench_worker(void *arg) {
+    BenchWorker *bw = arg;
+    void *items[BATCH_SIZE];
+
+    for (;;) {
+        size_t n = buffer_pop_batch(bw->buf, items, BATCH_SIZE);
+        if (n == 0)
+            break;
+        uint64_t popped = now_ns();
+        int done = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (!items[i]) {
+                done = 1;
+                break;
+            }
+            const BenchItem *item = items[i];
+            bw->latencies[bw->num_latencies++] = popped - item->pushed_ns;
+            bw->matches += scan_count_lines(bw->scanner, bw->map + item->offset, item->length, NULL, NULL);
+        }
+        if (done)
+            break;
+    }
+    return NULL;
+}
+
+// Function to order latencies
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to run the pipeline once, returns the elapsed seconds
+static double run(const char *map, BenchItem *items, size_t num_items, const Scanner *scanner, size_t buffer_size,
+                  size_t workers, size_t *matches, double *p99_us) {
+    Buffer buf;
+    buffer_init(&buf, buffer_size);
+    pthread_t *threads = malloc(sizeof(pthread_t) * workers);
+    BenchWorker *data = calloc(workers, sizeof(BenchWorker));
+    if (!threads || !data) fatal("malloc");
+
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < workers; ++i) {
+        data[i].buf = &buf;
+        data[i].scanner = scanner;
+        data[i].map = map;
+        data[i].latencies = malloc(sizeof(uint64_t) * (num_items + 1));
+        if (!data[i].latencies) fatal("malloc");
+        pthread_create(&threads[i], NULL, bench_worker, &data[i]);
+    }
+
+    void *batch[BATCH_SIZE];
+    for (size_t i = 0; i < num_items; i += BATCH_SIZE) {
+        size_t n = num_items - i < BATCH_SIZE ? num_items - i : BATCH_SIZE;
+        uint64_t stamp = now_ns();
+        for (size_t j = 0; j < n; ++j) {
+            items[i + j].pushed_ns = stamp;
+            batch[j] = &items[i + j];
+        }
+        buffer_push_batch(&buf, batch, n);
+    }
+    for (size_t i = 0; i < workers; ++i)
+        buffer_push(&buf, NULL);
+
+    size_t total_latencies = 0;
+    *matches = 0;
+    for (size_t i = 0; i < workers; ++i) {
+        pthread_join(threads[i], NULL);
+        *matches += data[i].matches;
+        total_latencies += data[i].num_latencies;
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    uint64_t *all = malloc(sizeof(uint64_t) * (total_latencies + 1));
+    if (!all) fatal("malloc");
+    size_t k = 0;
+    for (size_t i = 0; i < workers; ++i) {
+        memcpy(all + k, data[i].latencies, data[i].num_latencies * sizeof(uint64_t));
+        k += data[i].num_latencies;
+        free(data[i].latencies);
+    }
+    qsort(all, k, sizeof(uint64_t), compare_u64);
+    *p99_us = k ? all[(k - 1) * 99 / 100] / 1e3 : 0;
+
+    free(all);
+    buffer_destroy(&buf);
+    free(threads);
+    free(data);
+    return elapsed;
+}
+
+// Function to parse a comma separated list of positive numbers
+static size_t parse_list(const char *text, size_t *out) {
+    size_t n = 0;
+    char *end;
+    while (*text && n < MAX_LIST) {
+        out[n] = strtoul(text, &end, 10);
+        if (end == text || out[n] == 0)
+            return 0;
+        n++;
+        text = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+            return 0;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    size_t buffers[MAX_LIST] = { 4, 16, 64, 256 };
+    size_t num_buffers = 4;
+    size_t workers[MAX_LIST] = { 1, 2, 4, 8 };
+    size_t num_workers = 4;
+    size_t chunk_size = DEFAULT_CHUNK_SIZE;
+    const char *search = "ERROR";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:w:c:t:")) != -1) {
+        switch (opt) {
+        case 'b':
+            num_buffers = parse_list(optarg, buffers);
+            break;
+        case 'w':
+            num_workers = parse_list(optarg, workers);
+            break;
+        case 'c':
+            chunk_size = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            search = optarg;
+            break;
+        default:
+            num_buffers = 0;
+        }
+    }
+    if (optind == argc || num_buffers == 0 || num_workers == 0 || chunk_size == 0) {
+        fprintf(stderr, "Usage: %s [-b SIZES] [-w WORKERS] [-c CHUNK_BYTES] [-t TERM] log_file...\n"
+                        "  SIZES and WORKERS are comma separated lists (default 4,16,64,256 and 1,2,4,8)\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Scanner scanner;
+    scanner_init(&scanner, search, strlen(search), 0);
+
+    printf("%-28s %8s %8s %8s %14s %10s %12s\n", "file", "density", "buffer", "workers", "lines/s", "MB/s",
+           "p99 wait us");
+    for (int f = optind; f < argc; ++f) {
+        int fd = open(argv[f], O_RDONLY);
+        if (fd == -1) fatal(argv[f]);
+        struct stat st;
+        if (fstat(fd, &st) == -1) fatal("fstat");
+        size_t size = (size_t)st.st_size;
+        if (size == 0) {
+            close(fd);
+            continue;
+        }
+        const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) fatal("mmap");
+
+        // Split into line-aligned chunks and count lines once
+        BenchItem *items = malloc(sizeof(BenchItem) * (size / chunk_size + 1));
+        if (!items) fatal("malloc");
+        size_t num_items = 0, lines = 0;
+        for (size_t offset = 0; offset < size;) {
+            size_t end = offset + chunk_size;
+            if (end >= size) {
+                end = size;
+            } else {
+                const char *nl = memchr(map + end - 1, '\n', size - end + 1);
+                end = nl ? (size_t)(nl - map) + 1 : size;
+            }
+            for (const char *p = map + offset; (p = memchr(p, '\n', map + end - p)); ++p)
+                lines++;
+            items[num_items].offset = offset;
+            items[num_items].length = end - offset;
+            num_items++;
+            offset = end;
+        }
+
+        for (size_t b = 0; b < num_buffers; ++b) {
+            for (size_t w = 0; w < num_workers; ++w) {
+                size_t matches;
+                double p99_us;
+                double elapsed = run(map, items, num_items, &scanner, buffers[b], workers[w], &matches, &p99_us);
+                printf("%-28s %8.4f %8zu %8zu %14.0f %10.1f %12.1f\n", argv[f], lines ? (double)matches / lines : 0,
+                       buffers[b], workers[w], lines / elapsed, size / elapsed / 1e6, p99_us);
+                fflush(stdout);
+            }
+        }
+
+        free(items);
+        munmap((void *)map, size);
+        close(fd);
+    }
+    return 0;
+}
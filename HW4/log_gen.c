@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+// Synthetic log generator: `[YYYY-MM-DD HH:MM:SS] LEVEL: message` lines where a
+// tunable fraction of the lines are ERROR lines, the only ones containing "ERROR"
+
+#define MIN_SIZE (1ULL << 20) // 1 MiB
+#define MAX_SIZE (50ULL << 30) // 50 GiB
+#define DEFAULT_SIZE (64ULL << 20)
+#define DEFAULT_DENSITY 0.01
+#define DEFAULT_START 1747044000 // 2025-05-12 10:00:00 UTC
+#define WRITE_BUFFER (1 << 20)
+
+static const char *debug_msgs[] = {
+    "Initializing component: CacheManager.",
+    "Database query executed: SELECT * FROM users WHERE id=%u",
+    "Cache cleared for user session %u.",
+    "Backup file size: %uMB",
+    "Worker %u picked up job from queue.",
+};
+static const char *info_msgs[] = {
+    "Request GET /api/items/%u from 10.0.%u.%u.",
+    "Connection received from 10.0.2.%u.",
+    "Backup completed successfully.",
+    "User %u logged in.",
+    "Scheduled task finished in %u ms.",
+};
+static const char *warn_msgs[] = {
+    "Disk space nearing capacity on /var.",
+    "High memory usage detected: %u%%",
+    "Slow query took %u ms.",
+    "Retrying request to upstream service, attempt %u.",
+};
+static const char *error_msgs[] = {
+    "Could not write to log file: /tmp/error.txt.",
+    "Failed to authenticate user %u.",
+    "Connection to database lost after %u ms.",
+    "Cannot establish secure connection to LDAP server.",
+    "Request /api/orders/%u failed with status 500.",
+};
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+// Function to draw the next value of a xorshift64* generator
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+// Function to parse a size such as 512K, 64M or 2G, returns 0 if invalid
+static unsigned long long parse_size(const char *text) {
+    char *end;
+    unsigned long long size = strtoull(text, &end, 10);
+    switch (*end) {
+    case 'G': case 'g': size <<= 10; // fall through
+    case 'M': case 'm': size <<= 10; // fall through
+    case 'K': case 'k': size <<= 10; end++; break;
+    case '\0': break;
+    default: return 0;
+    }
+    return *end == '\0' ? size : 0;
+}
+
+// Function to print usage information
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s SIZE] [-d DENSITY] [-S SEED] [-o FILE]\n"
+                    "  -s SIZE     Approximate output size, 1M to 50G (default 64M)\n"
+                    "  -d DENSITY  Fraction of ERROR lines, 0 to 1 (default %g)\n"
+                    "  -S SEED     Random seed (default 1)\n"
+                    "  -o FILE     Output file (default stdout)\n", prog, DEFAULT_DENSITY);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long long size = DEFAULT_SIZE;
+    double density = DEFAULT_DENSITY;
+    uint64_t seed = 1;
+    const char *out_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:S:o:")) != -1) {
+        switch (opt) {
+        case 's':
+            size = parse_size(optarg);
+            break;
+        case 'd':
+            density = strtod(optarg, NULL);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || size < MIN_SIZE || size > MAX_SIZE || density < 0 || density > 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) fatal("fopen");
+    if (setvbuf(out, NULL, _IOFBF, WRITE_BUFFER) != 0) fatal("setvbuf");
+
+    uint64_t state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    uint64_t threshold = (uint64_t)(density * (double)UINT64_MAX);
+    if (density >= 1)
+        threshold = UINT64_MAX;
+    time_t ts = DEFAULT_START;
+    unsigned long long written = 0;
+    unsigned long long lines = 0, errors = 0;
+    char stamp[32];
+    time_t stamp_ts = -1;
+    char msg[128];
+
+    while (written < size) {
+        uint64_t r = next_random(&state);
+        const char *level;
+        const char *fmt;
+        if (r < threshold || threshold == UINT64_MAX) {
+            level = "ERROR";
+            fmt = error_msgs[next_random(&state) % COUNT(error_msgs)];
+            errors++;
+        } else {
+            unsigned pick = (unsigned)(next_random(&state) % 10);
+            if (pick < 4) {
+                level = "DEBUG";
+                fmt = debug_msgs[next_random(&state) % COUNT(debug_msgs)];
+            } else if (pick < 8) {
+                level = "INFO";
+                fmt = info_msgs[next_random(&state) % COUNT(info_msgs)];
+            } else {
+                level = "WARN";
+                fmt = warn_msgs[next_random(&state) % COUNT(warn_msgs)];
+            }
+        }
+
+        // Roughly ten lines per second, formatting the stamp only when it changes
+        if (next_random(&state) % 10 == 0)
+            ts++;
+        if (ts != stamp_ts) {
+            struct tm tm;
+            gmtime_r(&ts, &tm);
+            strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+            stamp_ts = ts;
+        }
+
+        uint64_t v = next_random(&state);
+        snprintf(msg, sizeof(msg), fmt, (unsigned)(v % 100000), (unsigned)(v >> 20) % 256, (unsigned)(v >> 40) % 256);
+        int n = fprintf(out, "[%s] %s: %s\n", stamp, level, msg);
+        if (n < 0) fatal("fprintf");
+        written += (unsigned long long)n;
+        lines++;
+    }
+
+    if (fclose(out) != 0) fatal("fclose");
+    fprintf(stderr, "Generated %llu bytes, %llu lines, %llu ERROR lines (%.4f)\n", written, lines, errors,
+            lines ? (double)errors / lines : 0.0);
+    return 0;
+}
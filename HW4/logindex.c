@@ -0,0 +1,466 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logindex.h"
+#include "exitcode.h"
+
+#define INDEX_MAGIC "LAIDX01" // Bumped whenever the on-disk layout changes
+#define HEAD_HASH_BYTES 4096 // Log prefix hashed to detect a replaced file
+#define WRITE_BATCH 65536 // Entries buffered per pwrite while indexing
+
+static const char *level_names[LEVEL_COUNT] = { "UNPARSED", "DEBUG", "INFO", "WARN", "ERROR", "FAIL", "OTHER" };
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to convert a civil date to days since 1970-01-01
+static int64_t days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Function to convert broken down time to seconds, returns -1 if out of range
+static int to_seconds(int y, int mo, int d, int h, int mi, int s, uint32_t *ts) {
+    if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || s > 60)
+        return -1;
+    int64_t t = days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+    if (t < 0 || t > UINT32_MAX)
+        return -1;
+    *ts = (uint32_t)t;
+    return 0;
+}
+
+// Function to parse n digits, returns -1 on a non digit
+static int digits(const char *p, int n) {
+    int v = 0;
+    for (int i = 0; i < n; ++i) {
+        if (p[i] < '0' || p[i] > '9')
+            return -1;
+        v = v * 10 + (p[i] - '0');
+    }
+    return v;
+}
+
+// Function to parse the `[YYYY-MM-DD HH:MM:SS] LEVEL:` prefix of a line.
+// Returns 0 and sets LEVEL_UNPARSED with ts 0 if the line has another format.
+int log_parse_line(const char *line, size_t len, uint32_t *ts, LogLevel *level) {
+    *ts = 0;
+    *level = LEVEL_UNPARSED;
+    if (len < 24 || line[0] != '[' || line[5] != '-' || line[8] != '-' || line[11] != ' ' ||
+        line[14] != ':' || line[17] != ':' || line[20] != ']' || line[21] != ' ')
+        return 0;
+
+    int y = digits(line + 1, 4), mo = digits(line + 6, 2), d = digits(line + 9, 2);
+    int h = digits(line + 12, 2), mi = digits(line + 15, 2), s = digits(line + 18, 2);
+    if (y < 0 || mo < 0 || d < 0 || h < 0 || mi < 0 || s < 0 || to_seconds(y, mo, d, h, mi, s, ts) == -1) {
+        *ts = 0;
+        return 0;
+    }
+
+    // Level token runs up to the colon
+    const char *tok = line + 22;
+    const char *colon = memchr(tok, ':', len - 22 < 16 ? len - 22 : 16);
+    if (!colon || colon == tok) {
+        *ts = 0;
+        return 0;
+    }
+
+    size_t n = (size_t)(colon - tok);
+    *level = LEVEL_OTHER;
+    for (int l = LEVEL_DEBUG; l < LEVEL_OTHER; ++l) {
+        if (strlen(level_names[l]) == n && memcmp(level_names[l], tok, n) == 0) {
+            *level = (LogLevel)l;
+            break;
+        }
+    }
+    if (n == 7 && memcmp(tok, "WARNING", 7) == 0)
+        *level = LEVEL_WARN;
+    return 1;
+}
+
+// Function to parse a --since/--until value: YYYY-MM-DD[( |T)HH:MM[:SS]].
+// A bare date means the start of the day, or its last second if end_of_day is set.
+int log_parse_time(const char *text, int end_of_day, uint32_t *ts) {
+    int y, mo, d, h = 0, mi = 0, s = 0, n = 0;
+    char sep;
+
+    if (sscanf(text, "%4d-%2d-%2d%n", &y, &mo, &d, &n) != 3)
+        return -1;
+    if (text[n] == '\0') {
+        if (end_of_day) {
+            h = 23;
+            mi = 59;
+            s = 59;
+        }
+    } else {
+        int m = 0;
+        if (sscanf(text + n, "%c%2d:%2d%n", &sep, &h, &mi, &m) != 3 || (sep != ' ' && sep != 'T'))
+            return -1;
+        n += m;
+        if (text[n] == ':') {
+            if (sscanf(text + n, ":%2d%n", &s, &m) != 1)
+                return -1;
+            n += m;
+        } else if (end_of_day) {
+            s = 59;
+        }
+        if (text[n] != '\0')
+            return -1;
+    }
+    return to_seconds(y, mo, d, h, mi, s, ts);
+}
+
+// Function to parse a comma separated level list such as ERROR,FAIL into a mask
+int log_parse_levels(const char *list, uint32_t *mask) {
+    char *copy = strdup(list);
+    if (!copy) fatal("strdup");
+
+    *mask = 0;
+    int rc = 0;
+    for (char *save, *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        int found = -1;
+        for (int l = 0; l < LEVEL_COUNT; ++l)
+            if (strcasecmp(tok, level_names[l]) == 0)
+                found = l;
+        if (strcasecmp(tok, "WARNING") == 0)
+            found = LEVEL_WARN;
+        if (found < 0) {
+            fprintf(stderr, "Unknown level: %s\n", tok);
+            rc = -1;
+            break;
+        }
+        *mask |= 1u << found;
+    }
+    free(copy);
+    return *mask == 0 ? -1 : rc;
+}
+
+// Function to get the name of a level as it appears in the log
+const char *log_level_name(LogLevel level) {
+    return level_names[level];
+}
+
+// Function to initialize a filter that passes every line
+void log_filter_init(LogFilter *filter) {
+    filter->level_mask = (1u << LEVEL_COUNT) - 1;
+    filter->since = 0;
+    filter->until = UINT32_MAX;
+}
+
+// Function to check whether the filter rejects any line at all
+int log_filter_active(const LogFilter *filter) {
+    return filter->level_mask != (1u << LEVEL_COUNT) - 1 || filter->since != 0 || filter->until != UINT32_MAX;
+}
+
+// Function to check a parsed line against the filter
+static int filter_pass(const LogFilter *filter, uint32_t ts, unsigned level) {
+    return (filter->level_mask >> level & 1) && ts >= filter->since && ts <= filter->until;
+}
+
+// Function to check whether a line passes the filter
+int log_filter_match(const LogFilter *filter, const char *line, size_t len) {
+    uint32_t ts;
+    LogLevel level;
+    log_parse_line(line, len, &ts, &level);
+    return filter_pass(filter, ts, level);
+}
+
+// Function to hash the first bytes of the log
+uint64_t log_head_hash(const char *data, size_t size) {
+    uint64_t h = 1469598103934665603ULL;
+    size_t n = size < HEAD_HASH_BYTES ? size : HEAD_HASH_BYTES;
+    for (size_t i = 0; i < n; ++i)
+        h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+    return h;
+}
+
+// Function to build the sidecar index path
+static char *index_path(const char *log_path) {
+    char *path = malloc(strlen(log_path) + sizeof(INDEX_SUFFIX));
+    if (!path) fatal("malloc");
+    strcpy(path, log_path);
+    strcat(path, INDEX_SUFFIX);
+    return path;
+}
+
+// Function to write all bytes at an offset
+static int pwrite_all(int fd, const void *buf, size_t len, off_t offset) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+// Function to fold an entry into a zone map
+static void zone_add(IndexZone *zone, const IndexEntry *e, size_t *count) {
+    if ((*count)++ == 0) {
+        zone->min_ts = zone->max_ts = e->ts;
+        zone->level_mask = 0;
+        zone->reserved = 0;
+    }
+    if (e->ts < zone->min_ts) zone->min_ts = e->ts;
+    if (e->ts > zone->max_ts) zone->max_ts = e->ts;
+    zone->level_mask |= 1u << e->level;
+}
+
+// Function to check whether an index file header is consistent with the log and its own size
+static int header_valid(const IndexHeader *hdr, off_t file_size, const char *log_map, size_t indexable) {
+    if (memcmp(hdr->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || hdr->block_lines != INDEX_BLOCK_LINES)
+        return 0;
+    if ((uint64_t)file_size != sizeof(IndexHeader) + hdr->num_entries * sizeof(IndexEntry) +
+                               hdr->num_zones * sizeof(IndexZone))
+        return 0;
+    if (hdr->num_zones != (hdr->num_entries + INDEX_BLOCK_LINES - 1) / INDEX_BLOCK_LINES)
+        return 0;
+    if (hdr->indexed_size > indexable || (hdr->indexed_size > 0 && log_map[hdr->indexed_size - 1] != '\n'))
+        return 0;
+    return hdr->head_hash == log_head_hash(log_map, hdr->indexed_size);
+}
+
+// Function to copy len bytes at offset from one file to the same offset of another
+static int copy_all(int in_fd, int out_fd, off_t offset, size_t len) {
+    loff_t in_off = offset, out_off = offset;
+    while (len > 0) {
+        ssize_t n = copy_file_range(in_fd, &in_off, out_fd, &out_off, len, 0);
+        if (n <= 0)
+            return -1;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Function to create or extend the sidecar index of a mapped log. Only lines
+// added since the last run are parsed; a log that was truncated or replaced
+// is indexed from scratch. The new index is written to a temporary file and
+// renamed over the old one, so a process that has the old one mapped keeps
+// a consistent view. Returns -1 if the index cannot be written.
+int logindex_update(const char *log_path, const char *log_map, size_t log_size, int verbose) {
+    // Only complete lines are indexed
+    const char *last_nl = log_size ? memrchr(log_map, '\n', log_size) : NULL;
+    size_t indexable = last_nl ? (size_t)(last_nl - log_map) + 1 : 0;
+
+    char *path = index_path(log_path);
+    struct stat st;
+    IndexHeader hdr;
+    int old_fd = open(path, O_RDONLY);
+    int valid = old_fd != -1 && fstat(old_fd, &st) == 0 && st.st_size >= (off_t)sizeof(hdr) &&
+                pread(old_fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+                header_valid(&hdr, st.st_size, log_map, indexable);
+    if (valid && hdr.indexed_size == indexable) {
+        close(old_fd);
+        free(path);
+        return 0;
+    }
+    if (!valid) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        hdr.block_lines = INDEX_BLOCK_LINES;
+    }
+
+    char *tmp_path = malloc(strlen(path) + sizeof(".XXXXXX"));
+    if (!tmp_path) fatal("malloc");
+    strcpy(tmp_path, path);
+    strcat(tmp_path, ".XXXXXX");
+    int fd = mkstemp(tmp_path);
+    if (fd == -1 || fchmod(fd, 0644) == -1) {
+        perror(tmp_path);
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        if (old_fd != -1)
+            close(old_fd);
+        free(tmp_path);
+        free(path);
+        return -1;
+    }
+
+    // Keep the entries and the zone maps of full blocks, the last partial block is recomputed
+    size_t full_blocks = hdr.num_entries / INDEX_BLOCK_LINES;
+    size_t zones_cap = full_blocks + 1024;
+    IndexZone *zones = malloc(zones_cap * sizeof(IndexZone));
+    IndexEntry *batch = malloc(WRITE_BATCH * sizeof(IndexEntry));
+    if (!zones || !batch) fatal("malloc");
+    off_t entries_end = sizeof(IndexHeader) + hdr.num_entries * sizeof(IndexEntry);
+    if (full_blocks && pread(old_fd, zones, full_blocks * sizeof(IndexZone), entries_end) != (ssize_t)(full_blocks * sizeof(IndexZone)))
+        fatal("pread");
+    int failed = hdr.num_entries && copy_all(old_fd, fd, sizeof(IndexHeader), hdr.num_entries * sizeof(IndexEntry)) == -1;
+
+    IndexZone cur = { 0 };
+    size_t cur_count = 0;
+    size_t partial = hdr.num_entries - full_blocks * INDEX_BLOCK_LINES;
+    if (partial) {
+        off_t at = sizeof(IndexHeader) + full_blocks * INDEX_BLOCK_LINES * sizeof(IndexEntry);
+        if (pread(old_fd, batch, partial * sizeof(IndexEntry), at) != (ssize_t)(partial * sizeof(IndexEntry)))
+            fatal("pread");
+        for (size_t i = 0; i < partial; ++i)
+            zone_add(&cur, &batch[i], &cur_count);
+    }
+    if (old_fd != -1)
+        close(old_fd);
+    size_t num_zones = full_blocks;
+
+    // Parse the lines that are not indexed yet, entries go straight to disk
+    size_t offset = hdr.indexed_size;
+    size_t before = hdr.num_entries;
+    size_t batched = 0;
+    while (offset < indexable && !failed) {
+        const char *line = log_map + offset;
+        const char *nl = memchr(line, '\n', indexable - offset);
+        size_t len = (size_t)(nl - line) + 1;
+
+        IndexEntry *e = &batch[batched++];
+        LogLevel level;
+        memset(e, 0, sizeof(*e));
+        e->offset = offset;
+        log_parse_line(line, len, &e->ts, &level);
+        e->level = (uint8_t)level;
+
+        zone_add(&cur, e, &cur_count);
+        if (cur_count == INDEX_BLOCK_LINES) {
+            if (num_zones == zones_cap) {
+                zones_cap *= 2;
+                zones = realloc(zones, zones_cap * sizeof(IndexZone));
+                if (!zones) fatal("realloc");
+            }
+            zones[num_zones++] = cur;
+            cur_count = 0;
+        }
+
+        if (batched == WRITE_BATCH) {
+            failed = pwrite_all(fd, batch, batched * sizeof(IndexEntry), entries_end) == -1;
+            entries_end += batched * sizeof(IndexEntry);
+            hdr.num_entries += batched;
+            batched = 0;
+        }
+        offset += len;
+    }
+    if (batched && !failed)
+        failed = pwrite_all(fd, batch, batched * sizeof(IndexEntry), entries_end) == -1;
+    entries_end += batched * sizeof(IndexEntry);
+    hdr.num_entries += batched;
+
+    if (cur_count) {
+        if (num_zones == zones_cap) {
+            zones = realloc(zones, (zones_cap + 1) * sizeof(IndexZone));
+            if (!zones) fatal("realloc");
+        }
+        zones[num_zones++] = cur;
+    }
+
+    // Zones follow the entries, the complete file replaces the old index
+    hdr.num_zones = num_zones;
+    hdr.indexed_size = indexable;
+    hdr.head_hash = log_head_hash(log_map, indexable);
+    if (failed || pwrite_all(fd, zones, num_zones * sizeof(IndexZone), entries_end) == -1 ||
+        pwrite_all(fd, &hdr, sizeof(hdr), 0) == -1 || rename(tmp_path, path) == -1) {
+        perror(tmp_path);
+        unlink(tmp_path);
+        failed = 1;
+    } else if (verbose) {
+        fprintf(stderr, "Index %s: %s %zu lines\n", path, before ? "extended by" : "built with",
+                (size_t)(hdr.num_entries - before));
+    }
+
+    free(zones);
+    free(batch);
+    close(fd);
+    free(tmp_path);
+    free(path);
+    return failed ? -1 : 0;
+}
+
+// Function to map the sidecar index of a log read-only. The header is
+// copied, the mapping only provides the entries and zones it describes.
+int logindex_open(LogIndex *idx, const char *log_path) {
+    char *path = index_path(log_path);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(IndexHeader)) {
+        close(fd);
+        return -1;
+    }
+    idx->map_size = (size_t)st.st_size;
+    idx->map = mmap(NULL, idx->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (idx->map == MAP_FAILED)
+        return -1;
+
+    memcpy(&idx->hdr, idx->map, sizeof(IndexHeader));
+    idx->entries = (const IndexEntry *)((const IndexHeader *)idx->map + 1);
+    idx->zones = (const IndexZone *)(idx->entries + idx->hdr.num_entries);
+    if (memcmp(idx->hdr.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        idx->map_size != sizeof(IndexHeader) + idx->hdr.num_entries * sizeof(IndexEntry) +
+                         idx->hdr.num_zones * sizeof(IndexZone)) {
+        munmap(idx->map, idx->map_size);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to unmap an index
+void logindex_close(LogIndex *idx) {
+    munmap(idx->map, idx->map_size);
+}
+
+// Function to emit the lines of data[offset, size) that pass the filter by parsing them
+void log_scan_select(const LogFilter *filter, const char *data, size_t offset, size_t size, range_fn emit, void *ctx) {
+    while (offset < size) {
+        const char *line = data + offset;
+        const char *nl = memchr(line, '\n', size - offset);
+        size_t len = nl ? (size_t)(nl - line) + 1 : size - offset;
+        if (log_filter_match(filter, line, len))
+            emit(offset, len, ctx);
+        offset += len;
+    }
+}
+
+// Function to emit the lines that pass the filter using the index. Blocks
+// whose zone map rules them out are skipped without touching their entries,
+// lines past the indexed part of the log are parsed directly.
+void logindex_select(const LogIndex *idx, const LogFilter *filter, const char *log_map, size_t log_size,
+                     range_fn emit, void *ctx) {
+    const IndexHeader *hdr = &idx->hdr;
+
+    for (size_t z = 0; z < hdr->num_zones; ++z) {
+        const IndexZone *zone = &idx->zones[z];
+        if (!(zone->level_mask & filter->level_mask) || zone->max_ts < filter->since || zone->min_ts > filter->until)
+            continue;
+
+        size_t first = z * INDEX_BLOCK_LINES;
+        size_t last = first + INDEX_BLOCK_LINES < hdr->num_entries ? first + INDEX_BLOCK_LINES : hdr->num_entries;
+        for (size_t i = first; i < last; ++i) {
+            const IndexEntry *e = &idx->entries[i];
+            if (!filter_pass(filter, e->ts, e->level))
+                continue;
+            size_t end = i + 1 < hdr->num_entries ? idx->entries[i + 1].offset : hdr->indexed_size;
+            emit(e->offset, end - e->offset, ctx);
+        }
+    }
+
+    if (log_size > hdr->indexed_size)
+        log_scan_select(filter, log_map, hdr->indexed_size, log_size, emit, ctx);
+}
@@ -0,0 +1,84 @@
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INDEX_SUFFIX ".idx" // Sidecar index path is the log path plus this suffix
+#define INDEX_BLOCK_LINES 1024 // Lines summarized by one zone map entry
+
+// Level of a `[YYYY-MM-DD HH:MM:SS] LEVEL: message` line
+typedef enum {
+    LEVEL_UNPARSED, // Line does not follow the bracketed format
+    LEVEL_DEBUG,
+    LEVEL_INFO,
+    LEVEL_WARN,
+    LEVEL_ERROR,
+    LEVEL_FAIL,
+    LEVEL_OTHER, // Any other token, e.g. 404
+    LEVEL_COUNT
+} LogLevel;
+
+// Index file header, followed by num_entries entries and num_zones zones
+typedef struct {
+    char magic[8];
+    uint64_t indexed_size; // Bytes of the log covered, always ends after a newline
+    uint64_t num_entries;
+    uint64_t num_zones;
+    uint64_t head_hash; // Hash of the first bytes of the log, detects rotation
+    uint32_t block_lines;
+    uint32_t reserved;
+} IndexHeader;
+
+// One entry per line
+typedef struct {
+    uint64_t offset; // Byte offset of the line in the log
+    uint32_t ts; // Seconds since the epoch, 0 if unparsed
+    uint8_t level; // LogLevel
+    uint8_t reserved[3];
+} IndexEntry;
+
+// Zone map of INDEX_BLOCK_LINES consecutive entries
+typedef struct {
+    uint32_t min_ts;
+    uint32_t max_ts;
+    uint32_t level_mask; // Bit per LogLevel present in the block
+    uint32_t reserved;
+} IndexZone;
+
+// Line filter, a line passes if its level is in level_mask and since <= ts <= until
+typedef struct {
+    uint32_t level_mask;
+    uint32_t since;
+    uint32_t until;
+} LogFilter;
+
+// Read-only view of a mapped index
+typedef struct {
+    void *map;
+    size_t map_size;
+    IndexHeader hdr; // Copied when the index is opened
+    const IndexEntry *entries;
+    const IndexZone *zones;
+} LogIndex;
+
+// Callback receiving the byte ranges of selected lines in file order
+typedef void (*range_fn)(size_t offset, size_t length, void *ctx);
+
+// Function prototypes
+int log_parse_line(const char *line, size_t len, uint32_t *ts, LogLevel *level);
+int log_parse_time(const char *text, int end_of_day, uint32_t *ts);
+int log_parse_levels(const char *list, uint32_t *mask);
+const char *log_level_name(LogLevel level);
+void log_filter_init(LogFilter *filter);
+int log_filter_active(const LogFilter *filter);
+int log_filter_match(const LogFilter *filter, const char *line, size_t len);
+uint64_t log_head_hash(const char *data, size_t size);
+int logindex_update(const char *log_path, const char *log_map, size_t log_size, int verbose);
+int logindex_open(LogIndex *idx, const char *log_path);
+void logindex_close(LogIndex *idx);
+void logindex_select(const LogIndex *idx, const LogFilter *filter, const char *log_map, size_t log_size,
+                     range_fn emit, void *ctx);
+void log_scan_select(const LogFilter *filter, const char *data, size_t offset, size_t size, range_fn emit, void *ctx);
+
+#endif /* LOGINDEX_H */
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include "output.h"
+#include "exitcode.h"
+
+#define WRITER_RUN 64 // Most batches taken from the window per writev round
+
+static char separator[] = "--\n";
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to create an empty batch for the item at position seq
+OutBatch *out_batch_new(size_t seq) {
+    OutBatch *b = malloc(sizeof(OutBatch));
+    if (!b) fatal("malloc");
+    b->seq = seq;
+    b->first = b->end = 0;
+    b->iov = NULL;
+    b->n = b->cap = 0;
+    return b;
+}
+
+// Function to append a byte range, extending the last one when they touch
+void out_batch_add(OutBatch *b, const char *data, size_t len) {
+    if (b->n > 0) {
+        struct iovec *last = &b->iov[b->n - 1];
+        if ((char *)last->iov_base + last->iov_len == data) {
+            last->iov_len += len;
+            return;
+        }
+    }
+    if (b->n == b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 8;
+        b->iov = realloc(b->iov, b->cap * sizeof(struct iovec));
+        if (!b->iov) fatal("realloc");
+    }
+    b->iov[b->n].iov_base = (void *)data;
+    b->iov[b->n].iov_len = len;
+    b->n++;
+}
+
+// Function to free a batch
+void out_batch_free(OutBatch *b) {
+    free(b->iov);
+    free(b);
+}
+
+// Function to write every range, continuing after partial writes.
+// Returns -1 on a write error.
+static int write_all(int fd, struct iovec *iov, size_t n) {
+    while (n > 0) {
+        ssize_t written = writev(fd, iov, n < IOV_MAX ? (int)n : IOV_MAX);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (n > 0 && (size_t)written >= iov->iov_len) { // Skip the ranges written in full
+            written -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// Function to write a run of consecutive batches with as few writev calls as
+// possible, putting a separator between output that is not contiguous in the file
+static void write_run(Writer *w, OutBatch **run, size_t n, struct iovec **iov, size_t *cap) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        OutBatch *b = run[i];
+        if (b->n == 0)
+            continue;
+        if (count + b->n + 1 > *cap) {
+            *cap = (count + b->n + 1) * 2;
+            *iov = realloc(*iov, *cap * sizeof(struct iovec));
+            if (!*iov) fatal("realloc");
+        }
+        if (w->separate && w->printed && b->first != w->last_end) {
+            (*iov)[count].iov_base = separator;
+            (*iov)[count++].iov_len = sizeof(separator) - 1;
+        }
+        for (size_t k = 0; k < b->n; ++k)
+            (*iov)[count++] = b->iov[k];
+        w->last_end = b->end;
+        w->printed = 1;
+    }
+
+    if (!w->failed && write_all(w->fd, *iov, count) == -1) {
+        perror("writev");
+        w->failed = 1;
+    }
+    for (size_t i = 0; i < n; ++i)
+        out_batch_free(run[i]);
+}
+
+// Writer thread routine, takes the batches in seq order as they become ready
+static void *writer_thread(void *arg) {
+    Writer *w = arg;
+    OutBatch *run[WRITER_RUN];
+    struct iovec *iov = NULL;
+    size_t cap = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&w->mutex);
+        while (!w->slots[w->next % w->window] && !w->closed)
+            pthread_cond_wait(&w->ready, &w->mutex);
+
+        size_t n = 0;
+        OutBatch **slot;
+        while (n < WRITER_RUN && *(slot = &w->slots[w->next % w->window])) {
+            run[n++] = *slot;
+            *slot = NULL;
+            w->next++;
+        }
+        if (n > 0)
+            pthread_cond_broadcast(&w->space);
+        pthread_mutex_unlock(&w->mutex);
+
+        if (n == 0) // Closed and the next batch never came
+            break;
+        write_run(w, run, n, &iov, &cap);
+    }
+    free(iov);
+    return NULL;
+}
+
+// Function to start the writer thread on fd with room for window pending batches
+void writer_start(Writer *w, int fd, size_t window, int separate) {
+    w->fd = fd;
+    w->separate = separate;
+    w->window = window;
+    w->slots = calloc(window, sizeof(OutBatch *));
+    if (!w->slots) fatal("calloc");
+    w->next = 0;
+    w->last_end = 0;
+    w->printed = 0;
+    w->terminating = 0;
+    w->closed = 0;
+    w->failed = 0;
+    if (pthread_mutex_init(&w->mutex, NULL)) fatal("pthread_mutex_init");
+    if (pthread_cond_init(&w->ready, NULL)) fatal("pthread_cond_init");
+    if (pthread_cond_init(&w->space, NULL)) fatal("pthread_cond_init");
+    if (pthread_create(&w->thread, NULL, writer_thread, w)) fatal("pthread_create");
+}
+
+// Function to hand a batch to the writer, which frees it. Waits while the
+// batch is more than a window ahead of the next one to write, so the worker
+// holding the next batch must never be the one waiting here.
+void writer_submit(Writer *w, OutBatch *b) {
+    pthread_mutex_lock(&w->mutex);
+    while (b->seq >= w->next + w->window && !w->terminating)
+        pthread_cond_wait(&w->space, &w->mutex);
+    if (w->terminating) {
+        pthread_mutex_unlock(&w->mutex);
+        out_batch_free(b);
+        return;
+    }
+    w->slots[b->seq % w->window] = b;
+    if (b->seq == w->next)
+        pthread_cond_signal(&w->ready);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+// Function to release the workers waiting for room, later batches are dropped
+void writer_terminate(Writer *w) {
+    pthread_mutex_lock(&w->mutex);
+    w->terminating = 1;
+    pthread_cond_broadcast(&w->space);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+// Function to write what is ready, stop the writer thread and free the
+// batches left behind a gap. Returns -1 if a write failed.
+int writer_close(Writer *w) {
+    pthread_mutex_lock(&w->mutex);
+    w->closed = 1;
+    pthread_cond_signal(&w->ready);
+    pthread_mutex_unlock(&w->mutex);
+    pthread_join(w->thread, NULL);
+
+    for (size_t i = 0; i < w->window; ++i)
+        if (w->slots[i])
+            out_batch_free(w->slots[i]);
+    free(w->slots);
+    pthread_mutex_destroy(&w->mutex);
+    pthread_cond_destroy(&w->ready);
+    pthread_cond_destroy(&w->space);
+    return w->failed ? -1 : 0;
+}
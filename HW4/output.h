@@ -0,0 +1,50 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Output of one item: byte ranges written back to back, usually pointing
+// straight into the mapped file. first and end are the file offsets of the
+// first and one past the last line, so the writer can tell whether the
+// output of consecutive items is contiguous.
+typedef struct {
+    size_t seq; // Position of the item in file order
+    size_t first;
+    size_t end;
+    struct iovec *iov;
+    size_t n;
+    size_t cap;
+} OutBatch;
+
+// Writer thread putting the batches of the workers back into file order.
+// Only batches within window positions of the next one to write are
+// accepted, so a worker running ahead waits instead of growing the backlog.
+typedef struct {
+    int fd;
+    int separate; // Print "--" between non-contiguous groups, as grep does with context
+    OutBatch **slots; // Pending batches indexed by seq % window
+    size_t window;
+    size_t next; // Next seq to write
+    size_t last_end; // File offset after the last byte written
+    int printed; // Anything written yet
+    int terminating; // Drop batches instead of waiting for earlier ones
+    int closed; // No more batches will be submitted
+    int failed; // A write failed, later batches are discarded
+    pthread_mutex_t mutex;
+    pthread_cond_t ready; // Signaled when the next batch arrives or the writer is closed
+    pthread_cond_t space; // Signaled when the window moves
+    pthread_t thread;
+} Writer;
+
+// Function prototypes
+OutBatch *out_batch_new(size_t seq);
+void out_batch_add(OutBatch *b, const char *data, size_t len);
+void out_batch_free(OutBatch *b);
+void writer_start(Writer *w, int fd, size_t window, int separate);
+void writer_submit(Writer *w, OutBatch *b);
+void writer_terminate(Writer *w);
+int writer_close(Writer *w);
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <time.h>
+#include "profile.h"
+
+#ifdef LOG_PROFILE
+_Thread_local Profile *profile_self = NULL;
+static uint64_t base_ticks; // Clock readings when the run started, for the tick rate
+#endif
+static double base_seconds;
+
+// Function to get the current monotonic time in seconds
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to note the start of the run, the tick rate is measured against it
+void profile_calibrate(void) {
+#ifdef LOG_PROFILE
+    base_ticks = profile_ticks();
+#endif
+    base_seconds = now();
+}
+
+// Function to convert ticks to seconds at the rate the clock ran since profile_calibrate
+double profile_seconds(uint64_t ticks) {
+#ifdef LOG_PROFILE
+    double elapsed = now() - base_seconds;
+    uint64_t spent = profile_ticks() - base_ticks;
+    return elapsed > 0 && spent > 0 ? ticks * (elapsed / spent) : 0.0;
+#else
+    (void)ticks;
+    return 0.0;
+#endif
+}
+
+// Function to add the times of src to dst
+void profile_merge(Profile *dst, const Profile *src) {
+    for (int p = 0; p < PROF_PHASES; ++p) {
+        dst->ticks[p] += src->ticks[p];
+        dst->calls[p] += src->calls[p];
+    }
+}
+
+// Function to get the name of a phase
+const char *profile_phase_name(ProfPhase phase) {
+    static const char *names[PROF_PHASES] = { "wait", "scan", "output", "read", "push" };
+    return names[phase];
+}
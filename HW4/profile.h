@@ -0,0 +1,70 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#if defined(LOG_PROFILE) && defined(__x86_64__)
+#include <x86intrin.h>
+#elif defined(LOG_PROFILE)
+#include <time.h>
+#endif
+
+// Where a thread spends its time, each phase is timed once per batch or block
+typedef enum {
+    PROF_WAIT, // Worker blocked popping a batch or stealing a chunk
+    PROF_SCAN, // Worker matching a batch, including freeing its items
+    PROF_OUTPUT, // Worker blocked handing printed lines to the writer
+    PROF_READ, // Producer reading, decompressing or mapping input
+    PROF_PUSH, // Producer blocked pushing a batch
+    PROF_PHASES
+} ProfPhase;
+
+// Time in ticks and number of timed calls per phase of one thread
+typedef struct {
+    uint64_t ticks[PROF_PHASES];
+    uint64_t calls[PROF_PHASES];
+} Profile;
+
+// The timers only exist in builds with -DLOG_PROFILE (make PROFILE=1),
+// otherwise every PROFILE_ macro expands to nothing.
+#ifdef LOG_PROFILE
+#define PROFILE_ENABLED 1
+
+extern _Thread_local Profile *profile_self; // Profile of the calling thread, NULL if it keeps none
+
+// Function to read the cheapest clock: the TSC on x86-64, else the monotonic clock in ns
+static inline uint64_t profile_ticks(void) {
+#ifdef __x86_64__
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Function to charge the ticks since start to a phase of the calling thread
+static inline void profile_add(ProfPhase phase, uint64_t start) {
+    Profile *p = profile_self;
+    if (p) {
+        p->ticks[phase] += profile_ticks() - start;
+        p->calls[phase]++;
+    }
+}
+
+#define PROFILE_ATTACH(p) (profile_self = (p))
+#define PROFILE_BEGIN(t) uint64_t t = profile_ticks()
+#define PROFILE_END(phase, t) profile_add(phase, t)
+#else
+#define PROFILE_ENABLED 0
+#define PROFILE_ATTACH(p) ((void)(p))
+#define PROFILE_BEGIN(t) ((void)0)
+#define PROFILE_END(phase, t) ((void)0)
+#endif
+
+// Function prototypes
+void profile_calibrate(void);
+double profile_seconds(uint64_t ticks);
+void profile_merge(Profile *dst, const Profile *src);
+const char *profile_phase_name(ProfPhase phase);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "reader.h"
+#include "exitcode.h"
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to set up the io_uring, returns -1 if the kernel does not allow it
+static int uring_setup(Reader *r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)r->depth, &p);
+    if (ring_fd == -1)
+        return -1;
+
+    r->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) { // Both rings share one mapping
+        if (r->cq_map_size > r->sq_map_size)
+            r->sq_map_size = r->cq_map_size;
+        r->cq_map_size = 0;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                     IORING_OFF_SQ_RING);
+    r->cq_map = r->cq_map_size == 0 ? r->sq_map
+                                    : mmap(NULL, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                           ring_fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+        if (r->sq_map != MAP_FAILED)
+            munmap(r->sq_map, r->sq_map_size);
+        if (r->cq_map_size > 0 && r->cq_map != MAP_FAILED)
+            munmap(r->cq_map, r->cq_map_size);
+        if (r->sqes != MAP_FAILED)
+            munmap(r->sqes, r->sqes_size);
+        close(ring_fd);
+        return -1;
+    }
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = cq + p.cq_off.cqes;
+    r->ring_fd = ring_fd;
+    return 0;
+}
+
+// Function to queue a read of the rest of a slot's block, the kernel sees it at the next uring_enter
+static void uring_queue(Reader *r, size_t index) {
+    ReaderSlot *s = &r->slots[index];
+    s->iov.iov_base = s->buf + r->header + s->len;
+    s->iov.iov_len = s->want - s->len;
+
+    unsigned tail = *r->sq_tail; // Only this thread moves the tail
+    unsigned i = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)r->sqes + i;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = r->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&s->iov;
+    sqe->len = 1;
+    sqe->off = (uint64_t)(s->offset + (off_t)s->len);
+    sqe->user_data = index;
+    r->sq_array[i] = i;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    r->in_kernel++;
+}
+
+// Function to submit the queued reads and wait for at least min_complete completions
+static void uring_enter(Reader *r, unsigned min_complete) {
+    for (;;) {
+        int ret = (int)syscall(__NR_io_uring_enter, r->ring_fd, r->to_submit, min_complete,
+                               min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret >= 0) {
+            r->to_submit -= (unsigned)ret;
+            return;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            fatal("io_uring_enter");
+    }
+}
+
+// Function to consume the completions, requeueing short and interrupted reads
+static void uring_reap(Reader *r) {
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe *cqe = (const struct io_uring_cqe *)r->cqes + (head & *r->cq_mask);
+        size_t index = (size_t)cqe->user_data;
+        ReaderSlot *s = &r->slots[index];
+        r->in_kernel--;
+
+        if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+            uring_queue(r, index);
+        } else if (cqe->res < 0) {
+            s->err = -cqe->res;
+            s->done = 1;
+        } else if (cqe->res == 0) { // The file shrank, deliver what was read
+            s->want = s->len;
+            s->done = 1;
+        } else {
+            s->len += (size_t)cqe->res;
+            if (s->len < s->want)
+                uring_queue(r, index);
+            else
+                s->done = 1;
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Function to pick the read mode and request the first blocks. Regular files
+// are read at offsets, with io_uring if the kernel allows it; other input is
+// read in order with read().
+void reader_open(Reader *r, int fd, size_t block_size, size_t depth, size_t header) {
+    memset(r, 0, sizeof(Reader));
+    r->fd = fd;
+    r->block_size = block_size;
+    r->header = header;
+    r->depth = depth;
+    r->ring_fd = -1;
+    r->slots = calloc(depth, sizeof(ReaderSlot));
+    if (!r->slots) fatal("calloc");
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        r->mode = READER_PLAIN;
+        return;
+    }
+    r->size = st.st_size;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (uring_setup(r) == 0) {
+        r->mode = READER_URING;
+    } else {
+        r->mode = READER_READAHEAD;
+        readahead(fd, 0, block_size * depth);
+    }
+}
+
+// Function to hand back the first bytes of unseekable input, read by the
+// caller to look at them, so they start the first block
+void reader_unread(Reader *r, const char *data, size_t len) {
+    if (r->mode != READER_PLAIN || len > READER_PENDING - r->pending_len || len > r->block_size) {
+        fprintf(stderr, "reader_unread: cannot hand back %zu bytes\n", len);
+        exit(EXIT_ERROR);
+    }
+    memcpy(r->pending + r->pending_len, data, len);
+    r->pending_len += len;
+}
+
+// Function to read the next block of unseekable input, filling the buffer unless the input ends
+static ssize_t next_plain(Reader *r, char **buf) {
+    char *b = malloc(r->header + r->block_size);
+    if (!b) fatal("malloc");
+    size_t len = r->pending_len;
+    memcpy(b + r->header, r->pending, len);
+    r->pending_len = 0;
+
+    while (len < r->block_size) {
+        ssize_t n = read(r->fd, b + r->header + len, r->block_size - len);
+        if (n == 0)
+            break;
+        if (n == -1) {
+            if (len > 0 && errno == EINTR) // Hand over what was read, the caller checks why
+                break;
+            int err = errno;
+            free(b);
+            errno = err;
+            return -1;
+        }
+        len += (size_t)n;
+    }
+    if (len == 0) {
+        free(b);
+        return 0;
+    }
+    *buf = b;
+    return (ssize_t)len;
+}
+
+// Function to read the next block with pread, asking the kernel to load the
+// block depth - 1 ahead so the device stays busy while the block is scanned
+static ssize_t next_readahead(Reader *r, char **buf) {
+    if (r->next_offset >= r->size)
+        return 0;
+    size_t want = (size_t)(r->size - r->next_offset) < r->block_size ? (size_t)(r->size - r->next_offset)
+                                                                       : r->block_size;
+    readahead(r->fd, r->next_offset + (off_t)(r->block_size * (r->depth - 1)), r->block_size);
+
+    char *b = malloc(r->header + want);
+    if (!b) fatal("malloc");
+    size_t len = 0;
+    while (len < want) {
+        ssize_t n = pread(r->fd, b + r->header + len, want - len, r->next_offset + (off_t)len);
+        if (n == 0)
+            break;
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            int err = errno;
+            free(b);
+            errno = err;
+            return -1;
+        }
+        len += (size_t)n;
+    }
+    r->next_offset += (off_t)want;
+    if (len == 0) {
+        free(b);
+        return 0;
+    }
+    *buf = b;
+    return (ssize_t)len;
+}
+
+// Function to deliver the next block read through io_uring, keeping depth blocks requested
+static ssize_t next_uring(Reader *r, char **buf) {
+    while (r->requested < r->depth && r->next_offset < r->size) {
+        size_t index = (r->head + r->requested) % r->depth;
+        ReaderSlot *s = &r->slots[index];
+        s->want = (size_t)(r->size - r->next_offset) < r->block_size ? (size_t)(r->size - r->next_offset)
+                                                                       : r->block_size;
+        s->buf = malloc(r->header + s->want);
+        if (!s->buf) fatal("malloc");
+        s->offset = r->next_offset;
+        s->len = 0;
+        s->done = 0;
+        s->err = 0;
+        uring_queue(r, index);
+        r->next_offset += (off_t)s->want;
+        r->requested++;
+    }
+    if (r->requested == 0)
+        return 0;
+
+    ReaderSlot *s = &r->slots[r->head % r->depth];
+    uring_enter(r, 0);
+    uring_reap(r);
+    while (!s->done) {
+        uring_enter(r, 1);
+        uring_reap(r);
+    }
+
+    r->head++;
+    r->requested--;
+    if (s->err) {
+        free(s->buf);
+        s->buf = NULL;
+        errno = s->err;
+        return -1;
+    }
+    *buf = s->buf;
+    s->buf = NULL;
+    if (s->len == 0) {
+        free(*buf);
+        return 0;
+    }
+    return (ssize_t)s->len;
+}
+
+// Function to get the next block of the file in order. On success *buf is a
+// malloc'ed buffer the caller frees, holding the header bytes and then the
+// returned number of data bytes. Returns 0 at the end of the input and -1 on
+// an error, with errno set; EINTR means a signal interrupted a plain read.
+ssize_t reader_next(Reader *r, char **buf) {
+    switch (r->mode) {
+    case READER_URING:
+        return next_uring(r, buf);
+    case READER_READAHEAD:
+        return next_readahead(r, buf);
+    default:
+        return next_plain(r, buf);
+    }
+}
+
+// Function to wait for the reads still in flight and release the reader
+void reader_close(Reader *r) {
+    if (r->mode == READER_URING) {
+        while (r->in_kernel > 0) { // The kernel may still write into the buffers
+            uring_enter(r, 1);
+            uring_reap(r);
+        }
+        munmap(r->sqes, r->sqes_size);
+        if (r->cq_map_size > 0)
+            munmap(r->cq_map, r->cq_map_size);
+        munmap(r->sq_map, r->sq_map_size);
+        close(r->ring_fd);
+    }
+    for (size_t i = 0; i < r->depth; ++i)
+        free(r->slots[i].buf);
+    free(r->slots);
+    r->slots = NULL;
+}
+
+// Function to get the name of the read mode
+const char *reader_mode_name(const Reader *r) {
+    switch (r->mode) {
+    case READER_URING:
+        return "io_uring";
+    case READER_READAHEAD:
+        return "readahead";
+    default:
+        return "read";
+    }
+}
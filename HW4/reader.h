@@ -0,0 +1,61 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define READER_PENDING 8 // Most bytes the caller may hand back before the first block
+
+// How the reader gets the blocks
+typedef enum {
+    READER_URING, // io_uring with several block reads in flight
+    READER_READAHEAD, // pread, with readahead loading the next blocks into the page cache
+    READER_PLAIN // read, for pipes and other input that cannot be read at an offset
+} ReaderMode;
+
+// One block being read, its buffer is handed over once the block is delivered
+typedef struct {
+    char *buf; // header bytes for the caller, then the data
+    struct iovec iov; // Part of the block still to read
+    size_t len; // Bytes read so far
+    size_t want; // Size of the block
+    off_t offset; // File offset of the block
+    int done; // Read in full, or failed with err
+    int err;
+} ReaderSlot;
+
+// Reader delivering the blocks of a file in order. Every buffer starts with
+// header bytes the caller may use, so a block can be passed on without copying.
+typedef struct {
+    int fd; // Not owned
+    ReaderMode mode;
+    size_t block_size;
+    size_t header;
+    size_t depth; // Blocks requested ahead of the one delivered next
+    off_t size; // Size of a regular file when opened
+    off_t next_offset; // Offset of the next block to request
+    ReaderSlot *slots; // Ring of depth slots in file order
+    size_t head; // Next block to deliver
+    size_t requested; // Blocks requested and not delivered yet
+    char pending[READER_PENDING]; // Bytes the caller already read from unseekable input, delivered first
+    size_t pending_len;
+    // io_uring state, the rings are shared with the kernel
+    int ring_fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    void *sqes, *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size, sqes_size;
+    unsigned to_submit; // Queued submissions the kernel has not seen yet
+    size_t in_kernel; // Submitted reads without a completion
+} Reader;
+
+// Function prototypes
+void reader_open(Reader *r, int fd, size_t block_size, size_t depth, size_t header);
+void reader_unread(Reader *r, const char *data, size_t len);
+ssize_t reader_next(Reader *r, char **buf);
+void reader_close(Reader *r);
+const char *reader_mode_name(const Reader *r);
+
+#endif /* READER_H */
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "result.h"
+#include "exitcode.h"
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    fprintf(stderr, "%s\n", msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to parse a --format argument, returns -1 if it names no format
+int result_parse_format(const char *name, ResultFormat *format) {
+    if (strcmp(name, "text") == 0)
+        *format = FORMAT_TEXT;
+    else if (strcmp(name, "json") == 0)
+        *format = FORMAT_JSON;
+    else if (strcmp(name, "csv") == 0)
+        *format = FORMAT_CSV;
+    else
+        return -1;
+    return 0;
+}
+
+// Function to write a JSON string literal
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)s; *p; ++p) {
+        if (*p == '"' || *p == '\\')
+            fprintf(out, "\\%c", *p);
+        else if (*p == '\n')
+            fputs("\\n", out);
+        else if (*p == '\t')
+            fputs("\\t", out);
+        else if (*p < 0x20)
+            fprintf(out, "\\u%04x", *p);
+        else
+            fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+// Function to write a CSV field, quoted if it holds a separator, quote or line break
+static void csv_field(FILE *out, const char *s) {
+    if (!strpbrk(s, ",\"\r\n")) {
+        fputs(s, out);
+        return;
+    }
+    fputc('"', out);
+    for (const char *p = s; *p; ++p) {
+        if (*p == '"')
+            fputc('"', out);
+        fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+// Function to start a member of the current JSON level: the separator, the
+// line break of levels written a member per line, and the key if there is one
+static void json_member(ResultWriter *w, const char *key) {
+    int d = w->depth;
+    if (w->members[d]++ > 0)
+        fputc(',', w->out);
+    if (w->lines[d])
+        fprintf(w->out, "\n%*s", 2 * (d + 1), "");
+    else if (w->members[d] > 1)
+        fputc(' ', w->out);
+    if (key) {
+        json_string(w->out, key);
+        fputs(": ", w->out);
+    }
+}
+
+// Function to start a CSV row for a field, the caller writes the value
+static void csv_row(ResultWriter *w, const char *field) {
+    csv_field(w->out, w->sections[w->depth]);
+    fputc(',', w->out);
+    csv_field(w->out, w->name);
+    fputc(',', w->out);
+    csv_field(w->out, field);
+    fputc(',', w->out);
+}
+
+// Function to enter a nesting level
+static void push_level(ResultWriter *w, int lines, const char *section) {
+    if (w->depth + 1 >= RESULT_MAX_DEPTH)
+        fatal("result: nesting too deep");
+    w->depth++;
+    w->members[w->depth] = 0;
+    w->lines[w->depth] = lines;
+    w->sections[w->depth] = section;
+}
+
+// Function to start writing a report to out
+void result_open(ResultWriter *w, FILE *out, ResultFormat format) {
+    w->out = out;
+    w->format = format;
+    w->depth = 0;
+    w->members[0] = 0;
+    w->lines[0] = 1;
+    w->sections[0] = "";
+    w->name = "";
+    if (format == FORMAT_JSON)
+        fputc('{', out);
+    else
+        fputs("section,name,field,value\n", out);
+}
+
+// Function to open a section, a list of records or an object of values
+void result_begin(ResultWriter *w, const char *section, int list) {
+    if (w->format == FORMAT_JSON) {
+        json_member(w, section);
+        fputc(list ? '[' : '{', w->out);
+    }
+    push_level(w, list, section);
+}
+
+// Function to close the innermost section
+void result_end(ResultWriter *w, int list) {
+    int d = w->depth--;
+    if (w->format != FORMAT_JSON)
+        return;
+    if (w->lines[d] && w->members[d] > 0)
+        fprintf(w->out, "\n%*s", 2 * d, "");
+    fputc(list ? ']' : '}', w->out);
+}
+
+// Function to start a record of the open list, name keys its CSV rows
+void result_record(ResultWriter *w, const char *name) {
+    if (w->format == FORMAT_JSON) {
+        json_member(w, NULL);
+        fputc('{', w->out);
+    }
+    push_level(w, 0, w->sections[w->depth]);
+    w->name = name;
+}
+
+// Function to close the open record
+void result_record_end(ResultWriter *w) {
+    w->depth--;
+    w->name = "";
+    if (w->format == FORMAT_JSON)
+        fputc('}', w->out);
+}
+
+// Function to add an unsigned value
+void result_uint(ResultWriter *w, const char *field, size_t value) {
+    if (w->format == FORMAT_JSON)
+        json_member(w, field);
+    else
+        csv_row(w, field);
+    fprintf(w->out, w->format == FORMAT_JSON ? "%zu" : "%zu\n", value);
+}
+
+// Function to add a real value
+void result_double(ResultWriter *w, const char *field, double value) {
+    if (w->format == FORMAT_JSON)
+        json_member(w, field);
+    else
+        csv_row(w, field);
+    fprintf(w->out, w->format == FORMAT_JSON ? "%.6f" : "%.6f\n", value);
+}
+
+// Function to add a string value
+void result_string(ResultWriter *w, const char *field, const char *value) {
+    if (w->format == FORMAT_JSON) {
+        json_member(w, field);
+        json_string(w->out, value);
+    } else {
+        csv_row(w, field);
+        csv_field(w->out, value);
+        fputc('\n', w->out);
+    }
+}
+
+// Function to add a boolean value, written as 0 or 1 in CSV
+void result_bool(ResultWriter *w, const char *field, int value) {
+    if (w->format == FORMAT_JSON) {
+        json_member(w, field);
+        fputs(value ? "true" : "false", w->out);
+    } else {
+        csv_row(w, field);
+        fputs(value ? "1\n" : "0\n", w->out);
+    }
+}
+
+// Function to finish the report, returns -1 if writing it failed
+int result_close(ResultWriter *w) {
+    if (w->format == FORMAT_JSON)
+        fputs("\n}\n", w->out);
+    return fflush(w->out) == 0 && !ferror(w->out) ? 0 : -1;
+}
@@ -0,0 +1,43 @@
+#ifndef RESULT_H
+#define RESULT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define RESULT_MAX_DEPTH 8 // Deepest nesting of sections and items
+
+// Format of the final report
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV
+} ResultFormat;
+
+// Streaming writer of a structured report. Every value is written as soon
+// as it is added, so nothing is kept in memory however many records there
+// are. JSON is one object of sections holding records; CSV has one row
+// "section,name,field,value" per value, name being the record's key.
+typedef struct {
+    FILE *out;
+    ResultFormat format;
+    int depth; // 0 is the top level object
+    size_t members[RESULT_MAX_DEPTH]; // Values written at each level, for the JSON separators
+    int lines[RESULT_MAX_DEPTH]; // JSON: put every member of the level on a line of its own
+    const char *sections[RESULT_MAX_DEPTH]; // CSV: section open at each level
+    const char *name; // CSV: name of the open record, "" outside records
+} ResultWriter;
+
+// Function prototypes
+int result_parse_format(const char *name, ResultFormat *format);
+void result_open(ResultWriter *w, FILE *out, ResultFormat format);
+void result_begin(ResultWriter *w, const char *section, int list);
+void result_end(ResultWriter *w, int list);
+void result_record(ResultWriter *w, const char *name);
+void result_record_end(ResultWriter *w);
+void result_uint(ResultWriter *w, const char *field, size_t value);
+void result_double(ResultWriter *w, const char *field, double value);
+void result_string(ResultWriter *w, const char *field, const char *value);
+void result_bool(ResultWriter *w, const char *field, int value);
+int result_close(ResultWriter *w);
+
+#endif /* RESULT_H */
@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char *(*find_fn)(const char *data, size_t len, const char *needle, size_t nlen);
+
+static find_fn active_find = NULL;
+static find_fn active_find_icase = NULL;
+static const char *active_name = "none";
+
+// Function to fold an ASCII upper case letter to lower case
+static unsigned char fold(unsigned char c) {
+    return (unsigned)(c - 'A') < 26 ? c | 0x20 : c;
+}
+
+// Function to check whether c is a letter, digit or underscore
+static int is_word(unsigned char c) {
+    return c == '_' || (unsigned)(c - '0') < 10 || (unsigned)((c | 0x20) - 'a') < 26;
+}
+
+// Function to compare n bytes ignoring ASCII case
+static int equal_icase(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        if (fold((unsigned char)a[i]) != fold((unsigned char)b[i]))
+            return 0;
+    return 1;
+}
+
+// Scalar kernel: memchr on the first byte, then compare the rest
+static const char *find_scalar(const char *data, size_t len, const char *needle, size_t nlen) {
+    const char *p = data;
+    const char *end = data + len;
+
+    while ((size_t)(end - p) >= nlen) {
+        p = memchr(p, needle[0], end - p - nlen + 1);
+        if (!p)
+            return NULL;
+        if (memcmp(p + 1, needle + 1, nlen - 1) == 0)
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
+// Scalar case-insensitive kernel: test the folded first and last byte, then the rest
+static const char *find_icase_scalar(const char *data, size_t len, const char *needle, size_t nlen) {
+    const unsigned char first = fold((unsigned char)needle[0]);
+    const unsigned char last = fold((unsigned char)needle[nlen - 1]);
+
+    for (size_t i = 0; i + nlen <= len; ++i) {
+        if (fold((unsigned char)data[i]) == first && fold((unsigned char)data[i + nlen - 1]) == last &&
+            equal_icase(data + i + 1, needle + 1, nlen - 1))
+            return data + i;
+    }
+    return NULL;
+}
+
+#ifdef SCAN_X86
+// SSE2 kernel: filter 16 candidate positions at once on the first and last byte
+__attribute__((target("sse2")))
+static const char *find_sse2(const char *data, size_t len, const char *needle, size_t nlen) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+    size_t i = 0;
+
+    for (; i + nlen - 1 + 16 <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(data + i + nlen - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                                   _mm_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, needle + 1, nlen - 2) == 0)
+                return data + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    // Tail shorter than one vector
+    return find_scalar(data + i, len - i, needle, nlen);
+}
+
+// AVX2 kernel: same filter as SSE2 on 32 candidate positions
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *data, size_t len, const char *needle, size_t nlen) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+    size_t i = 0;
+
+    for (; i + nlen - 1 + 32 <= len; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(data + i + nlen - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                                                         _mm256_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, needle + 1, nlen - 2) == 0)
+                return data + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return find_scalar(data + i, len - i, needle, nlen);
+}
+
+// Function to fold the upper case letters of 16 bytes: adding 0x3f moves 'A'..'Z'
+// to the 26 smallest signed values, which then get the 0x20 bit set
+__attribute__((target("sse2")))
+static __m128i fold_sse2(__m128i block) {
+    __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(-128 + 26), _mm_add_epi8(block, _mm_set1_epi8(0x3f)));
+    return _mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+// SSE2 case-insensitive kernel: the SSE2 filter on folded blocks
+__attribute__((target("sse2")))
+static const char *find_icase_sse2(const char *data, size_t len, const char *needle, size_t nlen) {
+    const __m128i first = _mm_set1_epi8((char)fold((unsigned char)needle[0]));
+    const __m128i last = _mm_set1_epi8((char)fold((unsigned char)needle[nlen - 1]));
+    size_t i = 0;
+
+    for (; i + nlen - 1 + 16 <= len; i += 16) {
+        __m128i block_first = fold_sse2(_mm_loadu_si128((const __m128i *)(data + i)));
+        __m128i block_last = fold_sse2(_mm_loadu_si128((const __m128i *)(data + i + nlen - 1)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                                   _mm_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (equal_icase(data + i + bit + 1, needle + 1, nlen - 1))
+                return data + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return find_icase_scalar(data + i, len - i, needle, nlen);
+}
+
+// Function to fold the upper case letters of 32 bytes, as fold_sse2
+__attribute__((target("avx2")))
+static __m256i fold_avx2(__m256i block) {
+    __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26), _mm256_add_epi8(block, _mm256_set1_epi8(0x3f)));
+    return _mm256_or_si256(block, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+// AVX2 case-insensitive kernel: the AVX2 filter on folded blocks
+__attribute__((target("avx2")))
+static const char *find_icase_avx2(const char *data, size_t len, const char *needle, size_t nlen) {
+    const __m256i first = _mm256_set1_epi8((char)fold((unsigned char)needle[0]));
+    const __m256i last = _mm256_set1_epi8((char)fold((unsigned char)needle[nlen - 1]));
+    size_t i = 0;
+
+    for (; i + nlen - 1 + 32 <= len; i += 32) {
+        __m256i block_first = fold_avx2(_mm256_loadu_si256((const __m256i *)(data + i)));
+        __m256i block_last = fold_avx2(_mm256_loadu_si256((const __m256i *)(data + i + nlen - 1)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                                                         _mm256_cmpeq_epi8(last, block_last)));
+        while (mask) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (equal_icase(data + i + bit + 1, needle + 1, nlen - 1))
+                return data + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return find_icase_scalar(data + i, len - i, needle, nlen);
+}
+#endif
+
+// Function to select the kernel, returns -1 if the CPU does not support it
+int scan_select(ScanImpl impl) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (impl == SCAN_AUTO)
+        impl = __builtin_cpu_supports("avx2") ? SCAN_AVX2 : __builtin_cpu_supports("sse2") ? SCAN_SSE2 : SCAN_SCALAR;
+
+    switch (impl) {
+    case SCAN_AVX2:
+        if (!__builtin_cpu_supports("avx2"))
+            return -1;
+        active_find = find_avx2;
+        active_find_icase = find_icase_avx2;
+        active_name = "avx2";
+        return 0;
+    case SCAN_SSE2:
+        if (!__builtin_cpu_supports("sse2"))
+            return -1;
+        active_find = find_sse2;
+        active_find_icase = find_icase_sse2;
+        active_name = "sse2";
+        return 0;
+    default:
+        break;
+    }
+#else
+    if (impl != SCAN_AUTO && impl != SCAN_SCALAR)
+        return -1;
+#endif
+    active_find = find_scalar;
+    active_find_icase = find_icase_scalar;
+    active_name = "scalar";
+    return 0;
+}
+
+// Function to get the name of the selected kernel
+const char *scan_impl_name(void) {
+    return active_name;
+}
+
+// Function to initialize a scanner, selects the kernel on first use. SCAN_ICASE
+// is dropped for a search term without letters, the exact kernels find the same hits.
+void scanner_init(Scanner *sc, const char *needle, size_t len, int flags) {
+    if (!active_find)
+        scan_select(SCAN_AUTO);
+    sc->needle = needle;
+    sc->len = len;
+    sc->flags = flags & ~SCAN_ICASE;
+    for (size_t i = 0; i < len; ++i)
+        if ((unsigned)(((unsigned char)needle[i] | 0x20) - 'a') < 26)
+            sc->flags = flags;
+}
+
+// Function to find the first occurrence of the search term in data
+const char *scan_find(const Scanner *sc, const char *data, size_t len) {
+    if (sc->len == 0)
+        return data;
+    if (sc->len > len)
+        return NULL;
+    if (sc->flags & SCAN_ICASE)
+        return active_find_icase(data, len, sc->needle, sc->len);
+    if (sc->len == 1)
+        return memchr(data, sc->needle[0], len);
+    return active_find(data, len, sc->needle, sc->len);
+}
+
+// Function to check whether a word character is directly before or after the
+// len bytes at hit, line and end bound the data around it
+int scan_word_bounded(const char *hit, size_t len, const char *line, const char *end) {
+    if (hit > line && is_word((unsigned char)hit[-1]))
+        return 0;
+    return hit + len >= end || !is_word((unsigned char)hit[len]);
+}
+
+// Function to count the lines of a chunk containing the search term, reporting each to on_match if set.
+// With SCAN_WORD a hit inside a word is skipped and the search goes on from the next byte.
+size_t scan_count_lines(const Scanner *sc, const char *data, size_t len, match_fn on_match, void *ctx) {
+    const char *p = data; // Start of the line after the last counted one
+    const char *from = data; // Where the next search starts
+    const char *end = data + len;
+    size_t count = 0;
+
+    while (from < end) {
+        const char *hit = scan_find(sc, from, end - from);
+        if (!hit)
+            break;
+        if ((sc->flags & SCAN_WORD) && !scan_word_bounded(hit, sc->len, data, end)) {
+            from = hit + 1;
+            continue;
+        }
+
+        // A match may not span lines, a newline is only allowed as its last byte
+        const char *line_end = memchr(hit, '\n', end - hit);
+        if (sc->len > 1 && line_end && line_end < hit + sc->len - 1) {
+            p = from = line_end + 1;
+            continue;
+        }
+
+        count++;
+        if (on_match) {
+            const char *line = memrchr(p, '\n', hit - p);
+            line = line ? line + 1 : p;
+            on_match(line, (line_end ? line_end + 1 : end) - line, ctx);
+        }
+        if (!line_end)
+            break;
+        p = from = line_end + 1;
+    }
+    return count;
+}
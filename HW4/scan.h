@@ -0,0 +1,35 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Search kernel implementations, SCAN_AUTO picks the best one the CPU supports
+typedef enum {
+    SCAN_AUTO,
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} ScanImpl;
+
+// Scanner flags, also taken by the pattern and regex matchers
+#define SCAN_ICASE 0x1 // Ignore ASCII case
+#define SCAN_WORD 0x2 // Only count hits that are whole words
+
+typedef struct {
+    const char *needle; // Search term, not owned
+    size_t len; // Length of the search term
+    int flags; // SCAN_ICASE and SCAN_WORD
+} Scanner;
+
+// Callback receiving each matching line, including its newline if it has one
+typedef void (*match_fn)(const char *line, size_t len, void *ctx);
+
+// Function prototypes
+void scanner_init(Scanner *sc, const char *needle, size_t len, int flags);
+const char *scan_find(const Scanner *sc, const char *data, size_t len);
+size_t scan_count_lines(const Scanner *sc, const char *data, size_t len, match_fn on_match, void *ctx);
+int scan_word_bounded(const char *hit, size_t len, const char *line, const char *end);
+int scan_select(ScanImpl impl);
+const char *scan_impl_name(void);
+
+#endif /* SCAN_H */
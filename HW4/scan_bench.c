@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scan.h"
+
+// Microbenchmark comparing per-line strstr with the chunk search kernels
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+// Function to get the current monotonic time in seconds
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to read the whole file into memory
+static char *read_file(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) fatal("fopen");
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    char *data = malloc((size_t)size + 1);
+    if (!data) fatal("malloc");
+    if (fread(data, 1, (size_t)size, fp) != (size_t)size) fatal("fread");
+    data[size] = '\0';
+    fclose(fp);
+    *len = (size_t)size;
+    return data;
+}
+
+// Function to run strstr on every line, the way the streaming worker does
+static size_t strstr_lines(char *lines, size_t len, const char *search) {
+    size_t count = 0;
+    for (char *p = lines; p < lines + len; p += strlen(p) + 1)
+        if (strstr(p, search))
+            count++;
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <log_file> \"<search_term>\" [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *search = argv[2];
+    int iterations = argc > 3 ? atoi(argv[3]) : 50;
+    if (iterations <= 0) iterations = 1;
+
+    size_t len;
+    char *data = read_file(argv[1], &len);
+
+    // Pre-split copy with NUL terminated lines, excluded from the timing
+    char *lines = malloc(len + 1);
+    if (!lines) fatal("malloc");
+    memcpy(lines, data, len + 1);
+    for (size_t i = 0; i < len; ++i)
+        if (lines[i] == '\n') lines[i] = '\0';
+
+    double mb = (double)len * iterations / (1 << 20);
+
+    size_t base_count = 0;
+    double start = now();
+    for (int it = 0; it < iterations; ++it)
+        base_count = strstr_lines(lines, len, search);
+    double base_time = now() - start;
+    printf("%-8s %10zu matches %10.1f MB/s\n", "strstr", base_count, mb / base_time);
+
+    static const ScanImpl impls[] = { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); ++k) {
+        if (scan_select(impls[k]) == -1)
+            continue;
+        Scanner sc;
+        scanner_init(&sc, search, strlen(search), 0);
+
+        size_t count = 0;
+        start = now();
+        for (int it = 0; it < iterations; ++it)
+            count = scan_count_lines(&sc, data, len, NULL, NULL);
+        double t = now() - start;
+        printf("%-8s %10zu matches %10.1f MB/s %6.2fx%s\n", scan_impl_name(), count, mb / t, base_time / t,
+               count == base_count ? "" : "  MISMATCH");
+    }
+
+    free(lines);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include "scheduler.h"
+#include "exitcode.h"
+
+#define STEAL_ABORT ((void *)1) // A thief lost the race for the top item, the victim may have more
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to initialize the scheduler with a deque of at least capacity items per worker
+void scheduler_init(Scheduler *s, size_t num_workers, size_t capacity) {
+    size_t cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+
+    s->num_workers = num_workers;
+    s->deques = aligned_alloc(CACHE_LINE_SIZE, sizeof(WsDeque) * num_workers);
+    if (!s->deques) fatal("aligned_alloc");
+    for (size_t i = 0; i < num_workers; ++i) {
+        WsDeque *d = &s->deques[i];
+        atomic_init(&d->top, 0);
+        atomic_init(&d->bottom, 0);
+        d->slots = calloc(cap, sizeof(*d->slots));
+        if (!d->slots) fatal("calloc");
+        d->mask = (long)cap - 1;
+        d->group = 0;
+        d->seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+    atomic_init(&s->terminating, 0);
+    atomic_init(&s->finished, 0);
+    if (sem_init(&s->idle, 0, 0) == -1) fatal("sem_init");
+}
+
+// Function to free the deques
+void scheduler_destroy(Scheduler *s) {
+    for (size_t i = 0; i < s->num_workers; ++i)
+        free(s->deques[i].slots);
+    free(s->deques);
+    s->deques = NULL;
+    sem_destroy(&s->idle);
+}
+
+// Function to put a worker in a steal group, e.g. the workers of one NUMA node
+void scheduler_set_group(Scheduler *s, size_t worker, size_t group) {
+    s->deques[worker].group = group;
+}
+
+// Function to push an item to the bottom of a worker's deque, only called by the
+// main thread before the workers start. Returns -1 if the deque is full.
+int scheduler_push(Scheduler *s, size_t worker, void *item) {
+    WsDeque *d = &s->deques[worker];
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - t > d->mask)
+        return -1;
+    atomic_store_explicit(&d->slots[b & d->mask], item, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+// Function to take the most recently pushed item of the owner's deque, NULL if empty
+static void *take(WsDeque *d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (t > b) { // Empty
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    void *item = atomic_load_explicit(&d->slots[b & d->mask], memory_order_relaxed);
+    if (t == b) { // Last item, race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            item = NULL;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+// Function to steal the oldest item of a victim's deque, NULL if it is empty
+// and STEAL_ABORT if another worker got there first
+static void *steal(WsDeque *d) {
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b)
+        return NULL;
+
+    void *item = atomic_load_explicit(&d->slots[t & d->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        return STEAL_ABORT;
+    return item;
+}
+
+// Function to sweep the other deques once, trying the worker's own group first
+// when same_group is set. Sets *contended if a steal lost a race.
+static void *steal_pass(Scheduler *s, size_t worker, int same_group, int *contended) {
+    WsDeque *self = &s->deques[worker];
+    self->seed ^= self->seed << 13;
+    self->seed ^= self->seed >> 7;
+    self->seed ^= self->seed << 17;
+    size_t start = (size_t)(self->seed % s->num_workers);
+
+    for (size_t k = 0; k < s->num_workers; ++k) {
+        size_t victim = (start + k) % s->num_workers;
+        if (victim == worker || (s->deques[victim].group == self->group) != same_group)
+            continue;
+        void *item = steal(&s->deques[victim]);
+        if (item == STEAL_ABORT)
+            *contended = 1;
+        else if (item)
+            return item;
+    }
+    return NULL;
+}
+
+// Function to get the next item for a worker: its own deque first, then a
+// random victim in its group, then any victim. Returns NULL once every deque
+// is empty or the scheduler is terminating; the worker must then stop calling.
+void *scheduler_next(Scheduler *s, size_t worker) {
+    while (!atomic_load_explicit(&s->terminating, memory_order_relaxed)) {
+        void *item = take(&s->deques[worker]);
+        if (item)
+            return item;
+
+        int contended = 0;
+        if ((item = steal_pass(s, worker, 1, &contended)) || (item = steal_pass(s, worker, 0, &contended)))
+            return item;
+        if (!contended) // Nothing is pushed once the workers run, so no work is left anywhere
+            break;
+        sched_yield();
+    }
+    if (atomic_fetch_add_explicit(&s->finished, 1, memory_order_acq_rel) + 1 == s->num_workers)
+        sem_post(&s->idle);
+    return NULL;
+}
+
+// Function to block until every worker has run out of work or scheduler_wake is called
+void scheduler_wait(Scheduler *s) {
+    while (sem_wait(&s->idle) == -1)
+        if (errno != EINTR) fatal("sem_wait");
+}
+
+// Function to end a scheduler_wait early, safe to call from a signal handler
+void scheduler_wake(Scheduler *s) {
+    sem_post(&s->idle);
+}
+
+// Function to make every worker stop at its next item
+void scheduler_terminate(Scheduler *s) {
+    atomic_store_explicit(&s->terminating, 1, memory_order_relaxed);
+}
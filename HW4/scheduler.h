@@ -0,0 +1,42 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <semaphore.h>
+#include "lfring.h"
+
+// Chase-Lev deque of one worker: the owner pushes and takes at the bottom,
+// other workers steal from the top
+typedef struct {
+    alignas(CACHE_LINE_SIZE) atomic_long top; // Next item thieves take
+    alignas(CACHE_LINE_SIZE) atomic_long bottom; // One past the last item the owner pushed
+    _Atomic(void *) *slots;
+    long mask; // Capacity minus one, capacity is a power of two
+    size_t group; // Workers steal within their group before trying the others
+    uint64_t seed; // Victim selection state, only used by the owner
+} WsDeque;
+
+// Work-stealing scheduler for a fixed set of items known before the workers
+// start. Items are non-NULL opaque pointers, pushed by the owner of a deque.
+typedef struct {
+    WsDeque *deques; // One per worker
+    size_t num_workers;
+    atomic_int terminating; // Flag to make every worker stop
+    atomic_size_t finished; // Workers that have run out of work
+    sem_t idle; // Posted by the last worker to run out of work, or by scheduler_wake
+} Scheduler;
+
+// Function prototypes
+void scheduler_init(Scheduler *s, size_t num_workers, size_t capacity);
+void scheduler_destroy(Scheduler *s);
+void scheduler_set_group(Scheduler *s, size_t worker, size_t group);
+int scheduler_push(Scheduler *s, size_t worker, void *item);
+void *scheduler_next(Scheduler *s, size_t worker);
+void scheduler_wait(Scheduler *s);
+void scheduler_wake(Scheduler *s);
+void scheduler_terminate(Scheduler *s);
+
+#endif /* SCHEDULER_H */
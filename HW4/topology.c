@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include "topology.h"
+#include "exitcode.h"
+
+// Function to handle fatal errors
+static void fatal(const char *msg) {
+    perror(msg); // Print the error message
+    exit(EXIT_ERROR);
+}
+
+// Function to add the CPUs of a sysfs cpulist such as 0-3,8,10-11 that are in allowed
+static void parse_cpulist(const char *list, const cpu_set_t *allowed, NumaNode *node) {
+    const char *p = list;
+    while (*p && *p != '\n') {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p)
+            break;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        for (long cpu = lo; cpu <= hi; ++cpu) {
+            if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, allowed))
+                continue;
+            node->cpus = realloc(node->cpus, (node->num_cpus + 1) * sizeof(int));
+            if (!node->cpus) fatal("realloc");
+            node->cpus[node->num_cpus++] = (int)cpu;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+}
+
+// Function to order nodes by number
+static int compare_nodes(const void *a, const void *b) {
+    return ((const NumaNode *)a)->id - ((const NumaNode *)b)->id;
+}
+
+// Function to read the NUMA nodes and their CPUs from sysfs, keeping only the
+// CPUs in this process' affinity mask and the nodes left with at least one
+void topology_load(Topology *topo) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) fatal("sched_getaffinity");
+
+    topo->nodes = NULL;
+    topo->num_nodes = 0;
+    topo->num_cpus = 0;
+
+    DIR *dir = opendir(NUMA_SYSFS);
+    struct dirent *de;
+    while (dir && (de = readdir(dir))) {
+        int id;
+        char rest;
+        if (sscanf(de->d_name, "node%d%c", &id, &rest) != 1)
+            continue;
+
+        char path[512], list[4096];
+        snprintf(path, sizeof(path), "%s/%s/cpulist", NUMA_SYSFS, de->d_name);
+        FILE *fp = fopen(path, "r");
+        if (!fp)
+            continue;
+        if (!fgets(list, sizeof(list), fp))
+            list[0] = '\0';
+        fclose(fp);
+
+        NumaNode node = { id, NULL, 0 };
+        parse_cpulist(list, &allowed, &node);
+        if (node.num_cpus == 0)
+            continue; // Memory-only node or no CPU we may use
+        topo->nodes = realloc(topo->nodes, (topo->num_nodes + 1) * sizeof(NumaNode));
+        if (!topo->nodes) fatal("realloc");
+        topo->nodes[topo->num_nodes++] = node;
+        topo->num_cpus += node.num_cpus;
+    }
+    if (dir)
+        closedir(dir);
+
+    if (topo->num_nodes == 0) { // No NUMA information, every allowed CPU is on node 0
+        NumaNode node = { 0, NULL, 0 };
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &allowed))
+                continue;
+            node.cpus = realloc(node.cpus, (node.num_cpus + 1) * sizeof(int));
+            if (!node.cpus) fatal("realloc");
+            node.cpus[node.num_cpus++] = cpu;
+        }
+        topo->nodes = malloc(sizeof(NumaNode));
+        if (!topo->nodes) fatal("malloc");
+        topo->nodes[0] = node;
+        topo->num_nodes = 1;
+        topo->num_cpus = node.num_cpus;
+    }
+    qsort(topo->nodes, topo->num_nodes, sizeof(NumaNode), compare_nodes);
+}
+
+// Function to release the node list
+void topology_destroy(Topology *topo) {
+    for (size_t i = 0; i < topo->num_nodes; ++i)
+        free(topo->nodes[i].cpus);
+    free(topo->nodes);
+    topo->nodes = NULL;
+    topo->num_nodes = 0;
+}
+
+// Function to get the index-th usable CPU counting node by node, wrapping
+// around when there are more workers than CPUs. Sets the position of its node.
+int topology_cpu(const Topology *topo, size_t index, size_t *node) {
+    index %= topo->num_cpus;
+    for (size_t n = 0; n < topo->num_nodes; ++n) {
+        if (index < topo->nodes[n].num_cpus) {
+            *node = n;
+            return topo->nodes[n].cpus[index];
+        }
+        index -= topo->nodes[n].num_cpus;
+    }
+    *node = 0;
+    return topo->nodes[0].cpus[0];
+}
+
+// Function to pin the calling thread to one CPU, returns -1 on failure
+int topology_pin_self(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+}
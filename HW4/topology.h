@@ -0,0 +1,31 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+
+// sysfs directory listing the NUMA nodes
+#ifndef NUMA_SYSFS
+#define NUMA_SYSFS "/sys/devices/system/node"
+#endif
+
+// CPUs of one NUMA node this process may run on
+typedef struct {
+    int id; // Node number
+    int *cpus;
+    size_t num_cpus;
+} NumaNode;
+
+// Nodes with at least one usable CPU, a single node when sysfs has no NUMA information
+typedef struct {
+    NumaNode *nodes;
+    size_t num_nodes;
+    size_t num_cpus; // Usable CPUs over all nodes
+} Topology;
+
+// Function prototypes
+void topology_load(Topology *topo);
+void topology_destroy(Topology *topo);
+int topology_cpu(const Topology *topo, size_t index, size_t *node);
+int topology_pin_self(int cpu);
+
+#endif /* TOPOLOGY_H */
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "common.h"
+
+#define MAX_BENCH_CLIENTS 90 // Every client opens an account, the server keeps at most MAX_ACCOUNTS
+#define BENCH_AMOUNT 10 // Credits deposited by each transaction
+
+// Function to get the monotonic time in seconds
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to write a whole structure, retrying on EINTR and short writes
+bool writeAll(int fd, const void* data, size_t size) {
+    const char* p = data;
+    while (size > 0) {
+        ssize_t written = write(fd, p, size);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        p += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// Function to read a whole structure, retrying on EINTR and short reads
+bool readAll(int fd, void* data, size_t size) {
+    char* p = data;
+    while (size > 0) {
+        ssize_t readResult = read(fd, p, size);
+        if (readResult == -1 && errno == EINTR) continue;
+        if (readResult <= 0) return false; // End of file before the whole structure arrived
+        p += readResult;
+        size -= (size_t)readResult;
+    }
+    return true;
+}
+
+// Function to run one deposit through the server the way BankClient does,
+// without its pauses. accountId is "N" for a new account and receives the
+// account the server assigned.
+bool transact(int serverFd, int seq, char* accountId, int total) {
+    char requestFifo[50], responseFifo[50];
+    InitialClientRequest request;
+    InitialResponse initialResponse;
+    TransactionRequest txRequest;
+    TransactionResponse txResponse;
+
+    // Fresh FIFOs for every transaction, the previous teller may still hold the old ones open
+    snprintf(requestFifo, sizeof(requestFifo), "/tmp/bank_bench_%d_%d_request", getpid(), seq);
+    snprintf(responseFifo, sizeof(responseFifo), "/tmp/bank_bench_%d_%d_response", getpid(), seq);
+    if (mkfifo(requestFifo, 0666) == -1 || mkfifo(responseFifo, 0666) == -1) {
+        perror("mkfifo failed");
+        unlink(requestFifo);
+        return false;
+    }
+
+    memset(&request, 0, sizeof(request));
+    strncpy(request.accountId, accountId, MAX_ID_LENGTH - 1);
+    request.transactionType = 'D';
+    request.clientPid = getpid();
+    strncpy(request.clientRequestFifo, requestFifo, sizeof(request.clientRequestFifo) - 1);
+    strncpy(request.clientResponseFifo, responseFifo, sizeof(request.clientResponseFifo) - 1);
+    request.parentPid = getppid();
+    request.totalTransactions = total;
+    bool ok = writeAll(serverFd, &request, sizeof(request));
+
+    int responseFd = ok ? open(responseFifo, O_RDONLY) : -1; // Returns once the teller opens it
+    ok = responseFd != -1 && readAll(responseFd, &initialResponse, sizeof(initialResponse));
+    int requestFd = ok ? open(requestFifo, O_WRONLY) : -1;
+    ok = requestFd != -1;
+    unlink(requestFifo); // Both ends are open or the transaction failed
+    unlink(responseFifo);
+    if (!ok) {
+        if (responseFd != -1) close(responseFd);
+        return false;
+    }
+
+    memset(&txRequest, 0, sizeof(txRequest));
+    strncpy(txRequest.accountId, initialResponse.accountId, MAX_ID_LENGTH - 1);
+    txRequest.amount = BENCH_AMOUNT;
+    ok = writeAll(requestFd, &txRequest, sizeof(txRequest)) &&
+         readAll(responseFd, &txResponse, sizeof(txResponse)) &&
+         strcmp(txResponse.accountId, "INVALID") != 0;
+
+    close(requestFd);
+    close(responseFd);
+    if (ok) strncpy(accountId, initialResponse.accountId, MAX_ID_LENGTH - 1);
+    return ok;
+}
+
+// Function to run one benchmark client: reports ready, waits for the start,
+// opens an account with its first deposit and keeps depositing to it
+void runClient(const char* serverFifo, int transactions, int total, int readyFd, int startFd) {
+    char accountId[MAX_ID_LENGTH] = "N";
+    int failures = 0;
+
+    int serverFd = open(serverFifo, O_WRONLY);
+    if (serverFd == -1) {
+        perror("Failed to open server FIFO");
+        exit(1);
+    }
+
+    char go = 'R';
+    if (!writeAll(readyFd, &go, 1)) exit(1);
+    close(readyFd);
+    while (read(startFd, &go, 1) == -1 && errno == EINTR); // Returns 0 once the parent closes the pipe
+    close(startFd);
+
+    for (int i = 0; i < transactions; i++) {
+        if (!transact(serverFd, i, accountId, total)) failures++;
+    }
+
+    close(serverFd);
+    exit(failures > 0 ? 1 : 0);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4 || argc > 5) {
+        printf("Usage: %s <ServerFIFO> <transactions> <clients> [label]\n", argv[0]);
+        printf("  Runs the deposits from concurrent clients against a running BankServer\n");
+        printf("  (best started with -d 0) and reports the transactions per second\n");
+        return 1;
+    }
+    const char* serverFifo = argv[1];
+    int transactions = atoi(argv[2]);
+    int clients = atoi(argv[3]);
+    const char* label = argc == 5 ? argv[4] : "BankServer";
+    if (transactions < 1 || clients < 1 || clients > MAX_BENCH_CLIENTS) {
+        printf("Error: need at least one transaction and 1 to %d clients\n", MAX_BENCH_CLIENTS);
+        return 1;
+    }
+
+    int readyPipe[2], startPipe[2];
+    if (pipe(readyPipe) == -1 || pipe(startPipe) == -1) {
+        perror("pipe failed");
+        return 1;
+    }
+
+    pid_t pids[MAX_BENCH_CLIENTS];
+    int started = 0;
+    for (int i = 0; i < clients; i++) {
+        int share = transactions / clients + (i < transactions % clients);
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("Failed to fork");
+            break;
+        } else if (pid == 0) {
+            close(readyPipe[0]);
+            close(startPipe[1]);
+            runClient(serverFifo, share, transactions, readyPipe[1], startPipe[0]);
+        }
+        pids[started++] = pid;
+    }
+
+    // Once every client is connected and waiting, closing the pipe starts them together
+    close(readyPipe[1]);
+    char ready;
+    for (int i = 0; i < started; i++) { // A client that failed to connect closes its end without writing
+        if (!readAll(readyPipe[0], &ready, 1)) break;
+    }
+    close(readyPipe[0]);
+    close(startPipe[0]);
+    double begin = now();
+    close(startPipe[1]);
+
+    int failedClients = 0;
+    for (int i = 0; i < started; i++) {
+        int status;
+        waitpid(pids[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failedClients++;
+    }
+    double elapsed = now() - begin;
+
+    printf("%s: %d transactions by %d clients in %.3f s, %.1f transactions/s\n", label, transactions, started,
+           elapsed, transactions / elapsed);
+    if (failedClients > 0) printf("Warning: %d clients saw failed transactions\n", failedClients);
+    return failedClients > 0 || started < clients;
+}
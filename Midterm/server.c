@@ -11,6 +11,7 @@
 #include <semaphore.h>
 #include <sys/mman.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include "common.h"
 
@@ -21,6 +22,11 @@
 #define SEM_ACCOUNT_PREFIX "/bank_sem_account_" // Account semaphore prefix
 #define SEM_GLOBAL_ACCESS "/bank_global_access" // Global access semaphore
 #define SEM_SHM_ACCESS "/bank_shm_access_lock" // Semaphore to protect SHM access
+#define SHM_QUEUE_NAME "/bank_teller_queue" // Request queue of the teller pool
+#define SEM_QUEUE_ITEMS "/bank_sem_queue_items" // Requests waiting in the queue
+#define SEM_QUEUE_SLOTS "/bank_sem_queue_slots" // Free slots in the queue
+#define SEM_QUEUE_LOCK "/bank_sem_queue_lock" // Semaphore to protect the queue
+#define TELLER_QUEUE_SIZE 64 // Requests the queue holds before the server waits for a teller
 
 // Shared memory structure for communication between tellers and main process
 typedef struct {
@@ -33,6 +39,16 @@ typedef struct {
     char clientName[MAX_ID_LENGTH]; // Client name
 } SharedMemoryData;
 
+// Shared memory ring of client requests, filled by the main process and
+// drained by the tellers of the pool
+typedef struct {
+    int head; // Next request a teller takes
+    int tail; // Next free slot
+    int count; // Requests in the queue
+    int busy; // Tellers serving a request
+    InitialClientRequest requests[TELLER_QUEUE_SIZE];
+} TellerQueue;
+
 // Global variables 
 BankAccount accounts[MAX_ACCOUNTS]; // Array of accounts
 int accountCount = 0; // Number of accounts
@@ -49,12 +65,26 @@ sem_t* responseSemaphore; // Response semaphore
 sem_t* globalAccessSemaphore; // Protects global account array operations
 sem_t* shmAccessSemaphore;    // Protects access to the shared memory structure
 
+// Teller pool globals, the pool is only used with -t
+int tellerPoolSize = 0; // Pre-forked tellers, 0 forks a teller per request
+int tellerPauseSeconds = 1; // Pause of a teller before it answers the client
+int queueFd = -1; // Teller queue file descriptor
+TellerQueue* tellerQueue = NULL; // Pointer to the teller queue
+sem_t* queueItemsSemaphore; // Counts the requests in the queue
+sem_t* queueSlotsSemaphore; // Counts the free slots in the queue
+sem_t* queueLockSemaphore; // Protects the queue indices
+
 // Array to store account-specific semaphores
 sem_t* accountSemaphores[MAX_ACCOUNTS];
 char accountSemNames[MAX_ACCOUNTS][MAX_PATH_LENGTH];
 
 volatile sig_atomic_t shutdownRequested = 0; // Global flag to indicate if we're shutting down
 
+// Held by the bank thread while it runs a transaction and by Teller() across
+// fork(), so a teller is never forked while the bank thread holds the locks
+// of printf, malloc or the semaphores and never inherits them locked
+pthread_mutex_t forkMutex = PTHREAD_MUTEX_INITIALIZER;
+
 // Global variables for cleanup
 char logFileName[MAX_PATH_LENGTH]; // Log file name
 pid_t tellerPids[MAX_CLIENTS]; // Array to store teller process IDs
@@ -72,9 +102,12 @@ void withdraw(void* arg); // Withdraw
 void handleTransaction(SharedMemoryData* transaction); // Handle transaction
 void deleteAccount(const char* accountId); // Delete account
 
-// Function to create a teller process
+// Function to create a teller process, its semaphores are closed when it exits
 pid_t Teller(void* func, void* arg_func) {
+    pthread_mutex_lock(&forkMutex); // Wait until the bank thread is between transactions
+    fflush(stdout); // Otherwise the teller repeats whatever output is still buffered
     pid_t pid = fork();
+    pthread_mutex_unlock(&forkMutex); // The child owns its copy of the mutex and releases it here too
     if (pid == 0) {
         void (*tellerFunc)(void*) = (void (*)(void*))func;
         tellerFunc(arg_func);
@@ -226,6 +259,156 @@ void cleanupSharedResources() {
     }   
 }
 
+// Function to initialize the request queue of the teller pool
+void initializeTellerQueue() {
+    shm_unlink(SHM_QUEUE_NAME); // Remove any existing queue
+
+    queueFd = shm_open(SHM_QUEUE_NAME, O_CREAT | O_RDWR, 0666);
+    if (queueFd == -1) {
+        perror("shm_open queue failed");
+        exit(1);
+    }
+    if (ftruncate(queueFd, sizeof(TellerQueue)) == -1) {
+        perror("ftruncate queue failed");
+        close(queueFd);
+        shm_unlink(SHM_QUEUE_NAME);
+        exit(1);
+    }
+    tellerQueue = (TellerQueue*)mmap(NULL, sizeof(TellerQueue), PROT_READ | PROT_WRITE, MAP_SHARED, queueFd, 0);
+    if (tellerQueue == MAP_FAILED) {
+        perror("mmap queue failed");
+        tellerQueue = NULL;
+        close(queueFd);
+        shm_unlink(SHM_QUEUE_NAME);
+        exit(1);
+    }
+    memset(tellerQueue, 0, sizeof(TellerQueue));
+
+    sem_unlink(SEM_QUEUE_ITEMS);
+    sem_unlink(SEM_QUEUE_SLOTS);
+    sem_unlink(SEM_QUEUE_LOCK);
+    queueItemsSemaphore = sem_open(SEM_QUEUE_ITEMS, O_CREAT | O_EXCL, 0666, 0); // No requests yet
+    queueSlotsSemaphore = sem_open(SEM_QUEUE_SLOTS, O_CREAT | O_EXCL, 0666, TELLER_QUEUE_SIZE); // Every slot free
+    queueLockSemaphore = sem_open(SEM_QUEUE_LOCK, O_CREAT | O_EXCL, 0666, 1);
+    if (queueItemsSemaphore == SEM_FAILED || queueSlotsSemaphore == SEM_FAILED || queueLockSemaphore == SEM_FAILED) {
+        perror("sem_open queue failed");
+        sem_unlink(SEM_QUEUE_ITEMS);
+        sem_unlink(SEM_QUEUE_SLOTS);
+        sem_unlink(SEM_QUEUE_LOCK);
+        munmap(tellerQueue, sizeof(TellerQueue));
+        close(queueFd);
+        shm_unlink(SHM_QUEUE_NAME);
+        exit(1);
+    }
+}
+
+// Function to cleanup the request queue of the teller pool
+void cleanupTellerQueue() {
+    if (tellerQueue == NULL) return;
+
+    if (munmap(tellerQueue, sizeof(TellerQueue)) == -1) perror("munmap queue failed");
+    tellerQueue = NULL;
+    close(queueFd);
+    shm_unlink(SHM_QUEUE_NAME);
+
+    sem_close(queueItemsSemaphore);
+    sem_close(queueSlotsSemaphore);
+    sem_close(queueLockSemaphore);
+    sem_unlink(SEM_QUEUE_ITEMS);
+    sem_unlink(SEM_QUEUE_SLOTS);
+    sem_unlink(SEM_QUEUE_LOCK);
+}
+
+// Function to hand a client request to the teller pool, waits while the queue is full
+bool enqueueRequest(const InitialClientRequest* request) {
+    while (sem_wait(queueSlotsSemaphore) == -1) {
+        if (errno != EINTR || shutdownRequested) return false;
+    }
+
+    sem_wait(queueLockSemaphore);
+    tellerQueue->requests[tellerQueue->tail] = *request;
+    tellerQueue->tail = (tellerQueue->tail + 1) % TELLER_QUEUE_SIZE;
+    tellerQueue->count++;
+    sem_post(queueLockSemaphore);
+
+    sem_post(queueItemsSemaphore); // Wake a teller
+    return true;
+}
+
+// Function to check whether the queue is empty and every teller is idle
+bool tellerQueueIdle() {
+    sem_wait(queueLockSemaphore);
+    bool idle = tellerQueue->count == 0 && tellerQueue->busy == 0;
+    sem_post(queueLockSemaphore);
+    return idle;
+}
+
+// Pool teller function - serves queued requests until the server terminates it
+void tellerPoolLoop(void* arg) {
+    (void)arg;
+    signal(SIGINT, SIG_IGN); // The main process handles ctrl+c and stops the pool
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGTERM, SIG_DFL);
+
+    while (true) {
+        if (sem_wait(queueItemsSemaphore) == -1) {
+            if (errno == EINTR) continue;
+            perror("Teller failed to wait on the request queue");
+            return;
+        }
+
+        InitialClientRequest* request = malloc(sizeof(InitialClientRequest)); // Freed by deposit or withdraw
+        if (!request) {
+            perror("Failed to allocate memory for request");
+            return;
+        }
+        sem_wait(queueLockSemaphore);
+        *request = tellerQueue->requests[tellerQueue->head];
+        tellerQueue->head = (tellerQueue->head + 1) % TELLER_QUEUE_SIZE;
+        tellerQueue->count--;
+        tellerQueue->busy++;
+        sem_post(queueLockSemaphore);
+        sem_post(queueSlotsSemaphore);
+
+        if (request->transactionType == 'D') deposit(request);
+        else withdraw(request);
+        fflush(stdout); // Pool tellers never exit normally, so nothing else flushes their output
+
+        sem_wait(queueLockSemaphore);
+        tellerQueue->busy--;
+        sem_post(queueLockSemaphore);
+    }
+}
+
+// Function to fork the tellers of the pool
+void startTellerPool() {
+    for (int i = 0; i < tellerPoolSize; i++) {
+        pid_t tellerPid = Teller(tellerPoolLoop, NULL);
+        if (tellerPid > 0) tellerPids[tellerCount++] = tellerPid;
+        else printf("Error creating teller process\n");
+    }
+    printf("%d tellers are ready..\n", tellerCount);
+}
+
+// Bank thread function - runs the transactions tellers post to shared memory
+void* serveTellers(void* arg) {
+    (void)arg;
+    while (true) {
+        if (sem_wait(requestSemaphore) == -1) {
+            if (errno == EINTR) continue;
+            perror("Failed to wait on requestSemaphore");
+            break;
+        }
+        if (shutdownRequested) break; // Posted by the main process to stop the thread
+
+        pthread_mutex_lock(&forkMutex);
+        handleTransaction(sharedMemory);
+        pthread_mutex_unlock(&forkMutex);
+        sem_post(responseSemaphore);
+    }
+    return NULL;
+}
+
 // Function to find an account by ID (globalAccessSemaphore'u tutmayi unutma!)
 BankAccount* findAccount(const char* accountId) {
     for (int i = 0; i < accountCount; i++) {
@@ -391,7 +574,7 @@ void deposit(void* arg) {
     printf("-- Teller PID%d is active serving %s..", tellerPid, clientName);
     if (initialSuccess && requestType == 'E') printf(" Welcome back %s\n", clientName);
     else printf("\n");
-    sleep(1);
+    if (tellerPauseSeconds > 0) sleep(tellerPauseSeconds);
 
     strncpy(initialResponse.clientName, clientName, MAX_ID_LENGTH - 1);
     initialResponse.clientName[MAX_ID_LENGTH - 1] = '\0';
@@ -475,11 +658,6 @@ void deposit(void* arg) {
     close(requestFd);
     close(responseFd);
 
-    sem_close(requestSemaphore);
-    sem_close(responseSemaphore);
-    sem_close(shmAccessSemaphore);
-    sem_close(globalAccessSemaphore);
-
     free(initialRequest);
 }
 
@@ -528,7 +706,7 @@ void withdraw(void* arg) {
     printf("-- Teller PID%d is active serving %s..", tellerPid, clientName);
     if (initialSuccess) printf(" Welcome back %s\n", clientName);
     else printf("\n");
-    sleep(1);
+    if (tellerPauseSeconds > 0) sleep(tellerPauseSeconds);
 
     // Prepare initial response with determined account ID and client name
     strncpy(initialResponse.clientName, clientName, MAX_ID_LENGTH - 1);
@@ -615,11 +793,6 @@ void withdraw(void* arg) {
     close(requestFd);
     close(responseFd);
 
-    sem_close(requestSemaphore);
-    sem_close(responseSemaphore);
-    sem_close(shmAccessSemaphore);
-    sem_close(globalAccessSemaphore);
-
     free(initialRequest);
 }
 
@@ -1033,6 +1206,8 @@ void cleanupServer() {
         int status;
         waitpid(tellerPids[i], &status, 0);
     }
+
+    cleanupTellerQueue(); // Only set up for a teller pool
 }
 
 // Function to handle termination signals
@@ -1076,17 +1251,33 @@ int findAccountIndex(const char* accountId) {
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s <bankName> <serverFifoName>\n", argv[0]);
+    int opt;
+    while ((opt = getopt(argc, argv, "t:d:")) != -1) {
+        switch (opt) {
+            case 't': // Pre-fork this many tellers instead of one per request
+                tellerPoolSize = atoi(optarg);
+                break;
+            case 'd': // Seconds a teller pauses before answering, 0 for benchmarks
+                tellerPauseSeconds = atoi(optarg);
+                break;
+            default:
+                optind = argc + 1; // Print the usage below
+                break;
+        }
+    }
+    if (argc - optind != 2 || tellerPoolSize < 0 || tellerPoolSize > MAX_CLIENTS || tellerPauseSeconds < 0) {
+        printf("Usage: %s [-t tellers] [-d seconds] <bankName> <serverFifoName>\n", argv[0]);
+        printf("  -t tellers  Serve requests with a pool of 1 to %d pre-forked tellers (default: fork one per request)\n", MAX_CLIENTS);
+        printf("  -d seconds  Pause of a teller before it answers the client (default: 1)\n");
         return 1;
     }
     
     setupServerSignalHandlers(); // Set up signal handlers
     
-    strncpy(bankName, argv[1], sizeof(bankName) - 1);
+    strncpy(bankName, argv[optind], sizeof(bankName) - 1);
     bankName[sizeof(bankName) - 1] = '\0';
     
-    strncpy(serverFifoName, argv[2], sizeof(serverFifoName) - 1);
+    strncpy(serverFifoName, argv[optind + 1], sizeof(serverFifoName) - 1);
     serverFifoName[sizeof(serverFifoName) - 1] = '\0';
     
     snprintf(logFileName, MAX_PATH_LENGTH, "%s.bankLog", bankName); // Log file name determined based on bank name
@@ -1130,6 +1321,29 @@ int main(int argc, char* argv[]) {
     
     int flags = fcntl(serverFd, F_GETFL);
     fcntl(serverFd, F_SETFL, flags | O_NONBLOCK);
+
+    if (tellerPoolSize > 0) { // Pool tellers are forked before the bank thread starts
+        initializeTellerQueue();
+        startTellerPool();
+    }
+
+    // The bank thread answers tellers as soon as they post, signals stay with the main thread.
+    // Tellers forked from here on wait for forkMutex, see Teller()
+    pthread_t bankThread;
+    sigset_t blockedSignals, oldSignals;
+    sigemptyset(&blockedSignals);
+    sigaddset(&blockedSignals, SIGINT);
+    sigaddset(&blockedSignals, SIGTERM);
+    sigaddset(&blockedSignals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &blockedSignals, &oldSignals);
+    if (pthread_create(&bankThread, NULL, serveTellers, NULL) != 0) {
+        printf("Error creating the bank thread\n");
+        shutdownRequested = 1;
+        cleanupServer();
+        return 1;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+    bool dispatched = false; // A request went to the pool since the pool was last idle
     
     fd_set readFds;
     struct timeval tv;
@@ -1206,6 +1420,15 @@ int main(int argc, char* argv[]) {
                 }
             }
 
+            if (tellerPoolSize > 0) { // A pool teller picks the request up from the queue
+                if (request.transactionType != 'D' && request.transactionType != 'W') {
+                    printf("Error: Invalid transaction type: %c\n", request.transactionType);
+                    continue;
+                }
+                if (enqueueRequest(&request)) dispatched = true;
+                continue;
+            }
+
             InitialClientRequest* requestCopy = malloc(sizeof(InitialClientRequest));
             if (!requestCopy) {
                 perror("Failed to allocate memory for request");
@@ -1235,9 +1458,9 @@ int main(int argc, char* argv[]) {
             }
         }
         
-        if (sem_trywait(requestSemaphore) == 0) {
-            handleTransaction(sharedMemory);
-            sem_post(responseSemaphore);
+        if (tellerPoolSize > 0 && dispatched && tellerQueueIdle()) {
+            dispatched = false;
+            waitingForClient = true;
         }
         
         for (int i = 0; i < tellerCount; i++) {
@@ -1245,6 +1468,13 @@ int main(int argc, char* argv[]) {
             pid_t result = waitpid(tellerPids[i], &status, WNOHANG);
             
             if (result > 0) {
+                if (tellerPoolSize > 0 && !shutdownRequested) { // Replace a pool teller that died
+                    pid_t tellerPid = Teller(tellerPoolLoop, NULL);
+                    if (tellerPid > 0) {
+                        tellerPids[i] = tellerPid;
+                        continue;
+                    }
+                }
                 for (int j = i; j < tellerCount - 1; j++) tellerPids[j] = tellerPids[j + 1];
                 tellerCount--;
                 i--;
@@ -1253,6 +1483,8 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    sem_post(requestSemaphore); // Wake the bank thread so it sees the shutdown
+    pthread_join(bankThread, NULL);
     cleanupServer(); // Clean up resources
     
     printf("%s says \"Bye\"..\n", bankName);